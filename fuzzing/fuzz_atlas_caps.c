@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* SDP and a=fmtp parsing, then the caps handling of rtpatlasdepay: base64
+ * parameter sets, atlas data, SEI, common atlas data and unit header, and
+ * the codec_data built from them.
+ *
+ * Input: an SDP starting with "v=", or the value of an a=fmtp line */
+
+#include "fuzz_common.h"
+#include "gstrtpatlassdp.h"
+
+int LLVMFuzzerTestOneInput(const guint8 *data, size_t size) {
+  GstHarness *h;
+  GstCaps *caps;
+  gchar *text;
+
+  text = g_strndup((const gchar *)data, size);
+  if (g_str_has_prefix(text, "v=")) {
+    caps = gst_rtp_atlas_sdp_to_caps(text);
+  } else {
+    caps = gst_caps_new_simple("application/x-rtp", "media", G_TYPE_STRING,
+                               "application", "payload", G_TYPE_INT, 96,
+                               "clock-rate", G_TYPE_INT, 90000,
+                               "encoding-name", G_TYPE_STRING, "v3c", NULL);
+    gst_rtp_atlas_fmtp_to_caps(text, caps);
+  }
+  g_free(text);
+
+  if (caps == NULL)
+    return 0;
+
+  /* and back to an a=fmtp line */
+  g_free(gst_rtp_atlas_caps_to_fmtp(caps));
+
+  h = gst_harness_new("rtpatlasdepay");
+  atlas_fuzz_push_caps(h, caps);
+  gst_caps_unref(caps);
+  gst_harness_teardown(h);
+
+  return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* codec_data (V3CDecoderConfigurationRecord) and vuh_data (v3c_unit_header)
+ * parsing: the getters of utils.c, then the caps handling of rtpatlaspay.
+ *
+ * Input: 4 bytes of vuh_data, then the codec_data */
+
+#include "fuzz_common.h"
+#include "utils.h"
+
+int LLVMFuzzerTestOneInput(const guint8 *data, size_t size) {
+  GstBuffer *vuh, *codec_data, *vps;
+  GPtrArray *units;
+  GstHarness *h;
+  GstCaps *caps;
+  guint i;
+
+  if (size <= 4)
+    return 0;
+
+  vuh = gst_buffer_new_memdup(data, 4);
+  codec_data = gst_buffer_new_memdup(data + 4, size - 4);
+
+  gst_vuh_data_get_v3c_parameter_set_id(vuh);
+  gst_vuh_data_get_atlas_id(vuh);
+  gst_vuh_data_get_unit_type(vuh);
+
+  gst_codec_data_get_unit_size_precision_bytes_minus1(codec_data);
+  vps = gst_codec_data_get_vps_unit(codec_data);
+  gst_vps_data_get_ptl_tier_flag(vps);
+  gst_vps_data_get_ptl_codec_idc(vps);
+  gst_vps_data_get_ptl_toolset_idc(vps);
+  gst_vps_data_get_ptl_rec_idc(vps);
+  gst_vps_data_get_ptl_level_idc(vps);
+  gst_clear_buffer(&vps);
+
+  units = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  gst_codec_data_get_setup_units(codec_data, units);
+  for (i = 0; i < units->len; i++) {
+    GstBuffer *unit = g_ptr_array_index(units, i);
+    GstMapInfo map;
+    guint32 ps_id;
+
+    gst_buffer_map(unit, &map, GST_MAP_READ);
+    gst_atlas_nal_get_parameter_set_id(map.data, map.size, &ps_id);
+    gst_buffer_unmap(unit, &map);
+  }
+  g_ptr_array_unref(units);
+
+  h = gst_harness_new("rtpatlaspay");
+  caps = gst_caps_new_simple("video/x-atlas", "stream-format", G_TYPE_STRING,
+                             "v3cg", "alignment", G_TYPE_STRING, "au",
+                             "codec_data", GST_TYPE_BUFFER, codec_data,
+                             "vuh_data", GST_TYPE_BUFFER, vuh, NULL);
+  atlas_fuzz_push_caps(h, caps);
+  gst_caps_unref(caps);
+  gst_harness_teardown(h);
+
+  gst_buffer_unref(codec_data);
+  gst_buffer_unref(vuh);
+
+  return 0;
+}
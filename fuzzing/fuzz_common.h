@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __FUZZ_COMMON_H__
+#define __FUZZ_COMMON_H__
+
+#include <gst/check/gstharness.h>
+#include <gst/gst.h>
+
+GST_PLUGIN_STATIC_DECLARE(atlas);
+
+/* GStreamer without registry scan, and the plugin linked in statically */
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+  g_setenv("GST_REGISTRY_DISABLE", "yes", TRUE);
+  gst_init(NULL, NULL);
+  GST_PLUGIN_STATIC_REGISTER(atlas);
+
+  return 0;
+}
+
+/* gst_harness_set_src_caps() asserts that the caps are accepted, the
+ * targets push caps the element may refuse */
+static inline void atlas_fuzz_push_caps(GstHarness *h, GstCaps *caps) {
+  GstSegment segment;
+
+  gst_pad_push_event(h->srcpad, gst_event_new_caps(caps));
+  gst_segment_init(&segment, GST_FORMAT_TIME);
+  gst_pad_push_event(h->srcpad, gst_event_new_segment(&segment));
+}
+
+#endif /* __FUZZ_COMMON_H__ */
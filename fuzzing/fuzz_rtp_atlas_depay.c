@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* RTP payload processing of rtpatlasdepay: AP, FU and single NAL unit
+ * packets, DONL/DOND and v3c-tile-id fields, access unit assembly.
+ *
+ * Input: an options byte, then packets of a flags byte, a 16 bits big endian
+ * length and that many bytes of RTP payload.
+ *   options: bit 0 sprop-max-don-diff=8, bit 1 v3c-tile-id-pres=1,
+ *            bit 2 recording-mode, bit 3 forward-incomplete-nals,
+ *            bit 4 wait-for-keyframe, bits 5-6 nal-length-size minus 1
+ *   flags: bit 7 RTP marker, bits 0-6 sequence numbers lost before the
+ *          packet */
+
+#include "fuzz_common.h"
+#include <gst/rtp/gstrtpbuffer.h>
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const guint8 *data, size_t size) {
+  GstHarness *h;
+  GstCaps *caps;
+  gchar *launch;
+  guint8 options;
+  guint16 seqnum = 0;
+  guint32 rtptime = 0;
+  GstClockTime pts = 0;
+
+  if (size < 1)
+    return 0;
+  options = data[0];
+  data++;
+  size--;
+
+  launch = g_strdup_printf("rtpatlasdepay recording-mode=%d "
+                           "forward-incomplete-nals=%d wait-for-keyframe=%d "
+                           "nal-length-size=%u",
+                           (options & 0x04) != 0, (options & 0x08) != 0,
+                           (options & 0x10) != 0, ((options >> 5) & 0x03) + 1);
+  h = gst_harness_new_parse(launch);
+  g_free(launch);
+
+  caps = gst_caps_new_simple("application/x-rtp", "media", G_TYPE_STRING,
+                             "application", "payload", G_TYPE_INT, 96,
+                             "clock-rate", G_TYPE_INT, 90000,
+                             "encoding-name", G_TYPE_STRING, "v3c", NULL);
+  if (options & 0x01)
+    gst_caps_set_simple(caps, "sprop-max-don-diff", G_TYPE_INT, 8, NULL);
+  if (options & 0x02)
+    gst_caps_set_simple(caps, "v3c-tile-id-pres", G_TYPE_INT, 1, NULL);
+  gst_harness_set_src_caps(h, caps);
+
+  while (size >= 3) {
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    GstBuffer *buffer;
+    guint8 flags = data[0];
+    gsize len = MIN(GST_READ_UINT16_BE(data + 1), size - 3);
+
+    seqnum += 1 + (flags & 0x7f);
+
+    buffer = gst_rtp_buffer_new_allocate(len, 0, 0);
+    gst_rtp_buffer_map(buffer, GST_MAP_WRITE, &rtp);
+    gst_rtp_buffer_set_payload_type(&rtp, 96);
+    gst_rtp_buffer_set_seq(&rtp, seqnum);
+    gst_rtp_buffer_set_timestamp(&rtp, rtptime);
+    gst_rtp_buffer_set_marker(&rtp, (flags & 0x80) != 0);
+    memcpy(gst_rtp_buffer_get_payload(&rtp), data + 3, len);
+    gst_rtp_buffer_unmap(&rtp);
+    GST_BUFFER_PTS(buffer) = pts;
+
+    /* the marker ends the access unit */
+    if (flags & 0x80) {
+      rtptime += 3000;
+      pts += GST_SECOND / 30;
+    }
+
+    gst_harness_push(h, buffer);
+
+    data += 3 + len;
+    size -= 3 + len;
+  }
+
+  gst_harness_push_event(h, gst_event_new_eos());
+  gst_harness_teardown(h);
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gstatlasmeta.h"
+
+GType gst_atlas_tile_meta_api_get_type(void) {
+  static GType type = 0;
+  /* no tags, the meta is not tied to the memory layout of a media type */
+  static const gchar *tags[] = {NULL};
+
+  if (g_once_init_enter(&type)) {
+    GType _type = gst_meta_api_type_register("GstAtlasTileMetaAPI", tags);
+    g_once_init_leave(&type, _type);
+  }
+  return type;
+}
+
+static gboolean gst_atlas_tile_meta_init(GstMeta *meta, gpointer params,
+                                         GstBuffer *buffer) {
+  GstAtlasTileMeta *tmeta = (GstAtlasTileMeta *)meta;
+
+  tmeta->tile_id = 0;
+  tmeta->offset = 0;
+  tmeta->size = 0;
+
+  return TRUE;
+}
+
+/* There is no transform function, the offsets only hold for the buffer the
+ * meta was added to and are not carried over by copies */
+const GstMetaInfo *gst_atlas_tile_meta_get_info(void) {
+  static const GstMetaInfo *meta_info = NULL;
+
+  if (g_once_init_enter((GstMetaInfo **)&meta_info)) {
+    const GstMetaInfo *mi = gst_meta_register(
+        GST_ATLAS_TILE_META_API_TYPE, "GstAtlasTileMeta",
+        sizeof(GstAtlasTileMeta), gst_atlas_tile_meta_init, NULL, NULL);
+    g_once_init_leave((GstMetaInfo **)&meta_info, (GstMetaInfo *)mi);
+  }
+  return meta_info;
+}
+
+GstAtlasTileMeta *gst_buffer_add_atlas_tile_meta(GstBuffer *buffer,
+                                                 guint16 tile_id, gsize offset,
+                                                 gsize size) {
+  GstAtlasTileMeta *meta;
+
+  g_return_val_if_fail(GST_IS_BUFFER(buffer), NULL);
+
+  meta = (GstAtlasTileMeta *)gst_buffer_add_meta(
+      buffer, GST_ATLAS_TILE_META_INFO, NULL);
+  if (meta == NULL)
+    return NULL;
+
+  meta->tile_id = tile_id;
+  meta->offset = offset;
+  meta->size = size;
+
+  return meta;
+}
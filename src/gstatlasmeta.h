@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __GST_ATLAS_META_H__
+#define __GST_ATLAS_META_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_ATLAS_TILE_META_API_TYPE (gst_atlas_tile_meta_api_get_type())
+#define GST_ATLAS_TILE_META_INFO (gst_atlas_tile_meta_get_info())
+
+typedef struct _GstAtlasTileMeta GstAtlasTileMeta;
+
+/**
+ * GstAtlasTileMeta:
+ * @meta: parent #GstMeta
+ * @tile_id: v3c-tile-id of the coded atlas tile
+ * @offset: offset of the length prefixed NAL unit in the buffer
+ * @size: size of the length prefixed NAL unit
+ *
+ * Locates the NAL unit of one atlas tile in an access unit, so tiles can be
+ * selected or decoded in parallel. A buffer holds one meta per tile NAL unit.
+ */
+struct _GstAtlasTileMeta {
+  GstMeta meta;
+
+  guint16 tile_id;
+  gsize offset;
+  gsize size;
+};
+
+GType gst_atlas_tile_meta_api_get_type(void);
+const GstMetaInfo *gst_atlas_tile_meta_get_info(void);
+
+#define gst_buffer_get_atlas_tile_meta(b)                                      \
+  ((GstAtlasTileMeta *)gst_buffer_get_meta((b), GST_ATLAS_TILE_META_API_TYPE))
+
+GstAtlasTileMeta *gst_buffer_add_atlas_tile_meta(GstBuffer *buffer,
+                                                 guint16 tile_id, gsize offset,
+                                                 gsize size);
+
+G_END_DECLS
+#endif /* __GST_ATLAS_META_H__ */
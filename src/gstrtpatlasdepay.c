@@ -34,8 +34,10 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "gstatlasmeta.h"
 #include "gstrtpatlasdepay.h"
 #include "gstrtputils.h"
 #include <gst/base/gstbitreader.h>
@@ -49,6 +51,77 @@ GST_DEBUG_CATEGORY_STATIC(rtpatlasdepay_debug);
 #define GST_CAT_DEFAULT (rtpatlasdepay_debug)
 
 #define DEFAULT_STREAM_FORMAT GST_ATLAS_STREAM_FORMAT_V3CG
+#define DEFAULT_WAIT_FOR_KEYFRAME FALSE
+#define DEFAULT_REQUEST_KEYFRAME FALSE
+#define DEFAULT_REQUEST_KEYFRAME_INTERVAL 1000
+#define DEFAULT_MAX_TEMPORAL_ID 6
+#define DEFAULT_WORKER_THREADS FALSE
+#define DEFAULT_WORKER_QUEUE_SIZE 8
+#define DEFAULT_FORWARD_INCOMPLETE_NALS FALSE
+#define DEFAULT_REORDER_WINDOW 0
+#define DEFAULT_REORDER_WINDOW_TIME 0
+#define DEFAULT_NAL_LENGTH_SIZE 4
+#define DEFAULT_RECORDING_MODE FALSE
+#define DEFAULT_ATLAS_ID -1
+
+/* RTP streams of an MRST session tracked at once, the one seen first is
+ * forgotten beyond that */
+#define MAX_MRST_STREAMS 16
+/* older packets are dropped, as in the base class */
+#define RTP_MAX_MISORDER 100
+
+enum {
+  PROP_0,
+  PROP_WAIT_FOR_KEYFRAME,
+  PROP_REQUEST_KEYFRAME,
+  PROP_REQUEST_KEYFRAME_INTERVAL,
+  PROP_TILE_IDS,
+  PROP_MAX_TEMPORAL_ID,
+  PROP_WORKER_THREADS,
+  PROP_WORKER_QUEUE_SIZE,
+  PROP_FORWARD_INCOMPLETE_NALS,
+  PROP_REORDER_WINDOW,
+  PROP_REORDER_WINDOW_TIME,
+  PROP_NAL_LENGTH_SIZE,
+  PROP_RECORDING_MODE,
+  PROP_ATLAS_ID,
+};
+
+/* nal_unit_type of the setup unit arrays, in the order they are written
+ * to codec_data */
+static const guint8 setup_unit_array_types[] = {
+    GST_ATLAS_NAL_ASPS,
+    GST_ATLAS_NAL_AFPS,
+    GST_ATLAS_NAL_AAPS,
+    GST_ATLAS_NAL_PREFIX_NSEI,
+    GST_ATLAS_NAL_PREFIX_ESEI,
+    GST_ATLAS_NAL_SUFFIX_NSEI,
+    GST_ATLAS_NAL_SUFFIX_ESEI,
+    GST_ATLAS_NAL_CASPS,
+    GST_ATLAS_NAL_CAF_IDR,
+};
+
+G_STATIC_ASSERT(G_N_ELEMENTS(setup_unit_array_types) <=
+                GST_RTP_ATLAS_MAX_SETUP_UNIT_ARRAYS);
+
+#define NAL_TYPE_IS_PARAMETER_SET(nt)                                          \
+  (((nt) == GST_ATLAS_NAL_ASPS) || ((nt) == GST_ATLAS_NAL_AFPS) ||             \
+   ((nt) == GST_ATLAS_NAL_AAPS))
+
+#define NAL_TYPE_IS_SEI(nt)                                                    \
+  (((nt) == GST_ATLAS_NAL_PREFIX_NSEI) ||                                      \
+   ((nt) == GST_ATLAS_NAL_PREFIX_ESEI) ||                                      \
+   ((nt) == GST_ATLAS_NAL_SUFFIX_NSEI) || ((nt) == GST_ATLAS_NAL_SUFFIX_ESEI))
+
+/* a common atlas frame is a single NAL unit, and an access unit of its own */
+#define NAL_TYPE_IS_CAF(nt)                                                    \
+  (((nt) == GST_ATLAS_NAL_CAF_IDR) || ((nt) == GST_ATLAS_NAL_CAF_TRAIL))
+
+/* bit of v3cdcr_dirty for the part holding unit_size_precision_bytes_minus1
+ * and the V3C parameter set, others are indexed by the nal_unit_type */
+#define V3CDCR_VPS_PART 63
+#define V3CDCR_PART_BIT(part) (G_GUINT64_CONSTANT(1) << (part))
+#define V3CDCR_ALL_PARTS (~G_GUINT64_CONSTANT(0))
 
 static GstStaticPadTemplate gst_rtp_atlas_depay_src_template =
     GST_STATIC_PAD_TEMPLATE(
@@ -57,6 +130,15 @@ static GstStaticPadTemplate gst_rtp_atlas_depay_src_template =
                         "alignment=(string)au, "
                         "codec_data=(string)ANY; "));
 
+/* one more atlas of the same V3C bitstream per sometimes pad, announced by
+ * the atlas_id RTP header extension */
+static GstStaticPadTemplate gst_rtp_atlas_depay_atlas_src_template =
+    GST_STATIC_PAD_TEMPLATE(
+        "src_%u", GST_PAD_SRC, GST_PAD_SOMETIMES,
+        GST_STATIC_CAPS("video/x-atlas, stream-format=(string) { v3cg, v3ag }, "
+                        "alignment=(string)au, "
+                        "codec_data=(string)ANY; "));
+
 static GstStaticPadTemplate gst_rtp_atlas_depay_sink_template =
     GST_STATIC_PAD_TEMPLATE("sink", GST_PAD_SINK, GST_PAD_ALWAYS,
                             GST_STATIC_CAPS("application/x-rtp, "
@@ -88,6 +170,11 @@ G_DEFINE_TYPE(GstRtpAtlasDepay, gst_rtp_atlas_depay,
               GST_TYPE_RTP_BASE_DEPAYLOAD);
 
 static void gst_rtp_atlas_depay_finalize(GObject *object);
+static void gst_rtp_atlas_depay_set_property(GObject *object, guint prop_id,
+                                             const GValue *value,
+                                             GParamSpec *pspec);
+static void gst_rtp_atlas_depay_get_property(GObject *object, guint prop_id,
+                                             GValue *value, GParamSpec *pspec);
 
 static GstStateChangeReturn
 gst_rtp_atlas_depay_change_state(GstElement *element,
@@ -105,6 +192,37 @@ static GstBuffer *gst_rtp_atlas_complete_au(GstRtpAtlasDepay *rtpatlasdepay,
 static void gst_rtp_atlas_depay_push(GstRtpAtlasDepay *rtpatlasdepay,
                                      GstBuffer *outbuf, gboolean keyframe,
                                      GstClockTime timestamp, gboolean marker);
+static void gst_rtp_atlas_depay_flush_don_queue(GstRtpAtlasDepay *rtpatlasdepay);
+static GstRtpAtlasDepayAtlas *
+gst_rtp_atlas_depay_atlas_new(GstRtpAtlasDepay *rtpatlasdepay);
+static void gst_rtp_atlas_depay_atlas_free(GstRtpAtlasDepayAtlas *atlas);
+static GstFlowReturn gst_rtp_atlas_depay_chain(GstPad *pad, GstObject *parent,
+                                               GstBuffer *buffer);
+static GstFlowReturn gst_rtp_atlas_depay_chain_list(GstPad *pad,
+                                                    GstObject *parent,
+                                                    GstBufferList *list);
+
+/* NAL unit waiting in the de-interleaving buffer */
+typedef struct {
+  GstBuffer *nal;
+  gint64 abs_don;
+  GstClockTime timestamp;
+  gboolean marker;
+  GstRtpAtlasDepayAtlas *atlas;
+} GstRtpAtlasDonNal;
+
+/* next sequence number of an RTP stream of an MRST session */
+typedef struct {
+  guint32 ssrc;
+  guint16 next_seqnum;
+} GstRtpAtlasMrstStream;
+
+/* RTP packet waiting in the reorder window */
+typedef struct {
+  GstBuffer *buffer;
+  guint16 seqnum;
+  gint64 arrival;
+} GstRtpAtlasReorderPacket;
 
 static void gst_rtp_atlas_depay_class_init(GstRtpAtlasDepayClass *klass) {
   GObjectClass *gobject_class;
@@ -116,9 +234,139 @@ static void gst_rtp_atlas_depay_class_init(GstRtpAtlasDepayClass *klass) {
   gstrtpbasedepayload_class = (GstRTPBaseDepayloadClass *)klass;
 
   gobject_class->finalize = gst_rtp_atlas_depay_finalize;
+  gobject_class->set_property = gst_rtp_atlas_depay_set_property;
+  gobject_class->get_property = gst_rtp_atlas_depay_get_property;
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_WAIT_FOR_KEYFRAME,
+      g_param_spec_boolean(
+          "wait-for-keyframe", "Wait for Keyframe",
+          "Drop NAL units until the first IRAP and output cached "
+          "ASPS/AFPS/AAPS in front of it",
+          DEFAULT_WAIT_FOR_KEYFRAME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_REQUEST_KEYFRAME,
+      g_param_spec_boolean(
+          "request-keyframe", "Request Keyframe",
+          "Request new keyframe upstream when data was lost",
+          DEFAULT_REQUEST_KEYFRAME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_REQUEST_KEYFRAME_INTERVAL,
+      g_param_spec_uint(
+          "request-keyframe-interval", "Request Keyframe Interval",
+          "Minimum interval between keyframe requests in milliseconds",
+          0, G_MAXUINT, DEFAULT_REQUEST_KEYFRAME_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_TILE_IDS,
+      gst_param_spec_array(
+          "tile-ids", "Tile IDs",
+          "v3c-tile-id of the atlas tiles to output, empty for all. Can also "
+          "be changed with a GstAtlasTileSelection event",
+          g_param_spec_uint("tile-id", "Tile ID", "v3c-tile-id", 0, G_MAXUINT16,
+                            0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_MAX_TEMPORAL_ID,
+      g_param_spec_uint(
+          "max-temporal-id", "Maximum temporal id",
+          "Drop NAL units of higher temporal sub-layers, a raised value "
+          "applies from the next IRAP, TSA or STSA",
+          0, 6, DEFAULT_MAX_TEMPORAL_ID,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_WORKER_THREADS,
+      g_param_spec_boolean(
+          "worker-threads", "Worker threads",
+          "Push the access units of each src_%u pad from a thread of its own, "
+          "the always src pad stays on the streaming thread",
+          DEFAULT_WORKER_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_WORKER_QUEUE_SIZE,
+      g_param_spec_uint(
+          "worker-queue-size", "Worker queue size",
+          "Maximum access units waiting for the worker of a src_%u pad, "
+          "assembly blocks when it is full",
+          1, G_MAXUINT, DEFAULT_WORKER_QUEUE_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_FORWARD_INCOMPLETE_NALS,
+      g_param_spec_boolean(
+          "forward-incomplete-nals", "Forward incomplete NALs",
+          "Forward the fragments received before a loss within a "
+          "Fragmentation Unit as a NAL unit with the F bit set, in an access "
+          "unit flagged corrupted, instead of dropping it",
+          DEFAULT_FORWARD_INCOMPLETE_NALS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_REORDER_WINDOW,
+      g_param_spec_uint(
+          "reorder-window", "Reorder window",
+          "Maximum RTP packets held to put them back in sequence number "
+          "order, so that no rtpjitterbuffer is needed (0 = disabled)",
+          0, 1000, DEFAULT_REORDER_WINDOW,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_REORDER_WINDOW_TIME,
+      g_param_spec_uint(
+          "reorder-window-time", "Reorder window time",
+          "Maximum time in milliseconds a packet waits in the reorder window "
+          "for a missing one, checked when packets arrive (0 = no limit)",
+          0, 10000, DEFAULT_REORDER_WINDOW_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_NAL_LENGTH_SIZE,
+      g_param_spec_uint(
+          "nal-length-size", "NAL length size",
+          "Size in bytes of the NAL unit length prefix of the output, "
+          "signalled as unit_size_precision_bytes_minus1 in codec_data. "
+          "An access unit with a NAL unit that does not fit is an error",
+          1, 4, DEFAULT_NAL_LENGTH_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_RECORDING_MODE,
+      g_param_spec_boolean(
+          "recording-mode", "Recording mode",
+          "Output access units for a muxer: the NAL units share the memory "
+          "of the RTP packets instead of being copied, video metas are not "
+          "copied, and every access unit is a sample with DTS and the marker "
+          "flag set",
+          DEFAULT_RECORDING_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_ATLAS_ID,
+      g_param_spec_int(
+          "atlas-id", "Atlas id",
+          "atlas_id of the atlas pushed on the always src pad when the caps "
+          "carry no v3c-unit-header, the other atlases get a src_%u pad. "
+          "-1 for only the packets without the atlas_id header extension",
+          -1, 63, DEFAULT_ATLAS_ID,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_READY));
 
   gst_element_class_add_static_pad_template(gstelement_class,
                                             &gst_rtp_atlas_depay_src_template);
+  gst_element_class_add_static_pad_template(
+      gstelement_class, &gst_rtp_atlas_depay_atlas_src_template);
   gst_element_class_add_static_pad_template(gstelement_class,
                                             &gst_rtp_atlas_depay_sink_template);
 
@@ -137,53 +385,568 @@ static void gst_rtp_atlas_depay_class_init(GstRtpAtlasDepayClass *klass) {
                           "Atlas RTP Depayloader");
 }
 
+/* Replaces the wanted tile ids from a GstValueArray of integers */
+static void gst_rtp_atlas_depay_set_tile_ids(GstRtpAtlasDepay *rtpatlasdepay,
+                                             const GValue *value) {
+  guint i, n;
+
+  GST_OBJECT_LOCK(rtpatlasdepay);
+  g_array_set_size(rtpatlasdepay->tile_ids, 0);
+  n = gst_value_array_get_size(value);
+  for (i = 0; i < n; i++) {
+    const GValue *v = gst_value_array_get_value(value, i);
+    guint16 tile_id;
+
+    if (G_VALUE_HOLDS_UINT(v))
+      tile_id = g_value_get_uint(v);
+    else if (G_VALUE_HOLDS_INT(v))
+      tile_id = g_value_get_int(v);
+    else
+      continue;
+    g_array_append_val(rtpatlasdepay->tile_ids, tile_id);
+  }
+  GST_OBJECT_UNLOCK(rtpatlasdepay);
+
+  GST_DEBUG_OBJECT(rtpatlasdepay, "selected %u tiles", n);
+}
+
+/* GstAtlasTileSelection carries the tile-ids array, it may come from
+ * downstream (e.g. a viewport dependent renderer) or from upstream */
+static gboolean
+gst_rtp_atlas_depay_handle_tile_selection(GstRtpAtlasDepay *rtpatlasdepay,
+                                          GstEvent *event) {
+  const GstStructure *structure = gst_event_get_structure(event);
+  const GValue *value;
+
+  if (!structure || !gst_structure_has_name(structure, "GstAtlasTileSelection"))
+    return FALSE;
+
+  value = gst_structure_get_value(structure, "tile-ids");
+  if (value && GST_VALUE_HOLDS_ARRAY(value))
+    gst_rtp_atlas_depay_set_tile_ids(rtpatlasdepay, value);
+
+  return TRUE;
+}
+
+static GstPadProbeReturn
+gst_rtp_atlas_depay_src_event_probe(GstPad *pad, GstPadProbeInfo *info,
+                                    gpointer user_data) {
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+  if (GST_EVENT_TYPE(event) == GST_EVENT_CUSTOM_UPSTREAM &&
+      gst_rtp_atlas_depay_handle_tile_selection(GST_RTP_ATLAS_DEPAY(user_data),
+                                                event))
+    return GST_PAD_PROBE_HANDLED;
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void gst_rtp_atlas_don_nal_clear(GstRtpAtlasDonNal *item) {
+  gst_clear_buffer(&item->nal);
+}
+
+static void gst_rtp_atlas_reorder_packet_clear(GstRtpAtlasReorderPacket *item) {
+  gst_clear_buffer(&item->buffer);
+}
+
 static void gst_rtp_atlas_depay_init(GstRtpAtlasDepay *rtpatlasdepay) {
-  rtpatlasdepay->adapter = gst_adapter_new();
-  rtpatlasdepay->atlas_frame_adapter = gst_adapter_new();
+  GstPad *sinkpad;
+
   rtpatlasdepay->output_format = DEFAULT_STREAM_FORMAT;
   rtpatlasdepay->stream_format = NULL;
-  rtpatlasdepay->asps =
-      g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
-  rtpatlasdepay->afps =
-      g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
-  rtpatlasdepay->aaps =
+  rtpatlasdepay->wait_for_keyframe = DEFAULT_WAIT_FOR_KEYFRAME;
+  rtpatlasdepay->request_keyframe = DEFAULT_REQUEST_KEYFRAME;
+  rtpatlasdepay->request_keyframe_interval = DEFAULT_REQUEST_KEYFRAME_INTERVAL;
+  rtpatlasdepay->max_temporal_id = DEFAULT_MAX_TEMPORAL_ID;
+  rtpatlasdepay->worker_threads = DEFAULT_WORKER_THREADS;
+  rtpatlasdepay->worker_queue_size = DEFAULT_WORKER_QUEUE_SIZE;
+  rtpatlasdepay->forward_incomplete_nals = DEFAULT_FORWARD_INCOMPLETE_NALS;
+  rtpatlasdepay->reorder_window = DEFAULT_REORDER_WINDOW;
+  rtpatlasdepay->reorder_window_time = DEFAULT_REORDER_WINDOW_TIME;
+  rtpatlasdepay->nal_length_size = DEFAULT_NAL_LENGTH_SIZE;
+  rtpatlasdepay->recording_mode = DEFAULT_RECORDING_MODE;
+  rtpatlasdepay->atlas_id = DEFAULT_ATLAS_ID;
+  rtpatlasdepay->cad =
       g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  rtpatlasdepay->don_queue =
+      g_array_new(FALSE, FALSE, sizeof(GstRtpAtlasDonNal));
+  g_array_set_clear_func(rtpatlasdepay->don_queue,
+                         (GDestroyNotify)gst_rtp_atlas_don_nal_clear);
+  rtpatlasdepay->reorder_queue =
+      g_array_new(FALSE, FALSE, sizeof(GstRtpAtlasReorderPacket));
+  g_array_set_clear_func(rtpatlasdepay->reorder_queue,
+                         (GDestroyNotify)gst_rtp_atlas_reorder_packet_clear);
+  rtpatlasdepay->mrst_streams =
+      g_array_new(FALSE, FALSE, sizeof(GstRtpAtlasMrstStream));
+  rtpatlasdepay->tile_ids = g_array_new(FALSE, FALSE, sizeof(guint16));
+  rtpatlasdepay->atlases = g_ptr_array_new_with_free_func(
+      (GDestroyNotify)gst_rtp_atlas_depay_atlas_free);
+
+  /* the atlas of the caps, pushed on the always src pad */
+  rtpatlasdepay->default_atlas = gst_rtp_atlas_depay_atlas_new(rtpatlasdepay);
+  rtpatlasdepay->default_atlas->srcpad =
+      GST_RTP_BASE_DEPAYLOAD_SRCPAD(rtpatlasdepay);
+  rtpatlasdepay->current_atlas = rtpatlasdepay->default_atlas;
+
+  gst_pad_add_probe(GST_RTP_BASE_DEPAYLOAD_SRCPAD(rtpatlasdepay),
+                    GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+                    gst_rtp_atlas_depay_src_event_probe, rtpatlasdepay, NULL);
+
+  /* the reorder window and the sequence numbers of MRST sit in front of
+   * the base class, which drops packets older than the last one */
+  sinkpad = GST_RTP_BASE_DEPAYLOAD_SINKPAD(rtpatlasdepay);
+  rtpatlasdepay->base_chain = GST_PAD_CHAINFUNC(sinkpad);
+  rtpatlasdepay->base_chain_list = GST_PAD_CHAINLISTFUNC(sinkpad);
+  gst_pad_set_chain_function(sinkpad, gst_rtp_atlas_depay_chain);
+  gst_pad_set_chain_list_function(sinkpad, gst_rtp_atlas_depay_chain_list);
+}
+
+/* V3C unit header of another atlas: the one of the caps with vuh_atlas_id
+ * replaced, or a V3C_AD header of V3C parameter set 0 without caps */
+static GstBuffer *gst_rtp_atlas_depay_atlas_vuh(GstBuffer *vuh,
+                                                guint8 atlas_id) {
+  guint8 data[4] = {1 << 3, 0, 0, 0};
+
+  if (vuh != NULL && gst_buffer_get_size(vuh) == 4)
+    gst_buffer_extract(vuh, 0, data, 4);
+
+  data[1] = (data[1] & 0x81) | ((atlas_id & 0x3F) << 1);
+
+  return gst_buffer_new_memdup(data, 4);
+}
+
+static GstRtpAtlasDepayFu *gst_rtp_atlas_depay_fu_new(guint32 ssrc) {
+  GstRtpAtlasDepayFu *fu = g_new0(GstRtpAtlasDepayFu, 1);
+
+  fu->ssrc = ssrc;
+  fu->wait_start = TRUE;
+
+  return fu;
+}
+
+static void gst_rtp_atlas_depay_fu_free(GstRtpAtlasDepayFu *fu) {
+  gst_clear_buffer(&fu->buffer);
+  g_free(fu);
+}
+
+static GstRtpAtlasDepayAtlas *
+gst_rtp_atlas_depay_atlas_new(GstRtpAtlasDepay *rtpatlasdepay) {
+  GstRtpAtlasDepayAtlas *atlas = g_new0(GstRtpAtlasDepayAtlas, 1);
+
+  atlas->atlas_frame_adapter = gst_adapter_new();
+  atlas->fus =
+      g_ptr_array_new_with_free_func((GDestroyNotify)gst_rtp_atlas_depay_fu_free);
+  atlas->fu = gst_rtp_atlas_depay_fu_new(0);
+  g_ptr_array_add(atlas->fus, atlas->fu);
+  atlas->waiting_for_keyframe = rtpatlasdepay->wait_for_keyframe;
+  atlas->temporal_id_limit = rtpatlasdepay->max_temporal_id;
+  atlas->asps = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  atlas->afps = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  atlas->aaps = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  atlas->sei = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  atlas->new_codec_data = TRUE;
+  atlas->v3cdcr_dirty = V3CDCR_ALL_PARTS;
+  gst_allocation_params_init(&atlas->params);
+
+  return atlas;
+}
+
+static void gst_rtp_atlas_depay_atlas_free(GstRtpAtlasDepayAtlas *atlas) {
+  guint i;
+
+  gst_buffer_replace(&atlas->vuh, NULL);
+  gst_buffer_replace(&atlas->codec_data, NULL);
+  gst_buffer_replace(&atlas->v3cdcr, NULL);
+  gst_buffer_replace(&atlas->v3cdcr_vps, NULL);
+  for (i = 0; i < GST_RTP_ATLAS_MAX_SETUP_UNIT_ARRAYS; i++)
+    gst_buffer_replace(&atlas->v3cdcr_arrays[i], NULL);
+  gst_caps_replace(&atlas->src_caps, NULL);
+
+  g_ptr_array_free(atlas->fus, TRUE);
+  g_object_unref(atlas->atlas_frame_adapter);
+
+  g_ptr_array_free(atlas->asps, TRUE);
+  g_ptr_array_free(atlas->afps, TRUE);
+  g_ptr_array_free(atlas->aaps, TRUE);
+  g_ptr_array_free(atlas->sei, TRUE);
+
+  if (atlas->allocator != NULL)
+    gst_object_unref(atlas->allocator);
+  if (atlas->queue != NULL)
+    g_object_unref(atlas->queue);
+  gst_event_replace(&atlas->segment, NULL);
+
+  g_free(atlas);
+}
+
+static void gst_rtp_atlas_depay_queue_item_free(GstDataQueueItem *item) {
+  if (item->object)
+    gst_mini_object_unref(item->object);
+  g_free(item);
+}
+
+static gboolean gst_rtp_atlas_depay_queue_full(GstDataQueue *queue,
+                                               guint visible, guint bytes,
+                                               guint64 time,
+                                               gpointer checkdata) {
+  return visible >= GPOINTER_TO_UINT(checkdata);
+}
+
+/* Pushes a buffer or a serialized event on a src_%u pad, or queues it for
+ * the worker of the pad. Only buffers count against worker-queue-size */
+static void gst_rtp_atlas_depay_atlas_output(GstPad *pad,
+                                             GstMiniObject *object) {
+  GstRtpAtlasDepayAtlas *atlas = gst_pad_get_element_private(pad);
+  GstDataQueueItem *item;
+
+  if (atlas->queue == NULL) {
+    if (GST_IS_BUFFER(object))
+      gst_pad_push(pad, GST_BUFFER_CAST(object));
+    else
+      gst_pad_push_event(pad, GST_EVENT_CAST(object));
+    return;
+  }
+
+  item = g_new0(GstDataQueueItem, 1);
+  item->object = object;
+  item->visible = GST_IS_BUFFER(object);
+  item->size = item->visible ? gst_buffer_get_size(GST_BUFFER_CAST(object)) : 0;
+  item->destroy = (GDestroyNotify)gst_rtp_atlas_depay_queue_item_free;
+
+  /* blocks while the queue is full, fails when flushing */
+  if (!gst_data_queue_push(atlas->queue, item))
+    item->destroy(item);
+}
+
+static void gst_rtp_atlas_depay_atlas_loop(GstPad *pad) {
+  GstRtpAtlasDepayAtlas *atlas = gst_pad_get_element_private(pad);
+  GstDataQueueItem *item;
+  GstMiniObject *object;
+
+  if (!gst_data_queue_pop(atlas->queue, &item)) {
+    GST_DEBUG_OBJECT(pad, "flushing, pausing worker");
+    gst_pad_pause_task(pad);
+    return;
+  }
+
+  object = g_steal_pointer(&item->object);
+  item->destroy(item);
+
+  if (!GST_IS_BUFFER(object))
+    gst_pad_push_event(pad, GST_EVENT_CAST(object));
+  else if (gst_pad_push(pad, GST_BUFFER_CAST(object)) == GST_FLOW_FLUSHING)
+    gst_pad_pause_task(pad);
+}
+
+/* Unblocks the streaming thread waiting on a full worker queue, e.g.
+ * before the pads are deactivated */
+static gboolean gst_rtp_atlas_depay_flush_worker(GstElement *element,
+                                                 GstPad *pad,
+                                                 gpointer user_data) {
+  GstRtpAtlasDepayAtlas *atlas;
+
+  if (pad == GST_RTP_BASE_DEPAYLOAD_SRCPAD(element))
+    return TRUE;
+
+  atlas = gst_pad_get_element_private(pad);
+  if (atlas->queue)
+    gst_data_queue_set_flushing(atlas->queue, TRUE);
+
+  return TRUE;
+}
+
+static void gst_rtp_atlas_depay_reset_atlas(GstRtpAtlasDepay *rtpatlasdepay,
+                                            GstRtpAtlasDepayAtlas *atlas,
+                                            gboolean hard) {
+  guint i;
+
+  /* the FUs of the RTP streams seen last are kept for MRST */
+  if (hard)
+    g_ptr_array_set_size(atlas->fus, 1);
+  atlas->fu = g_ptr_array_index(atlas->fus, 0);
+  for (i = 0; i < atlas->fus->len; i++) {
+    GstRtpAtlasDepayFu *fu = g_ptr_array_index(atlas->fus, i);
+
+    gst_clear_buffer(&fu->buffer);
+    fu->wait_start = TRUE;
+    fu->type = 0;
+  }
+  atlas->waiting_for_keyframe = rtpatlasdepay->wait_for_keyframe;
+  atlas->skip_rasl = FALSE;
+  atlas->temporal_id_limit = rtpatlasdepay->max_temporal_id;
+  gst_adapter_clear(atlas->atlas_frame_adapter);
+  atlas->atlas_frame_start = FALSE;
+  atlas->last_keyframe = FALSE;
+  atlas->last_ts = 0;
+  atlas->discont = FALSE;
+  atlas->new_codec_data = TRUE;
+  atlas->v3cdcr_dirty = V3CDCR_ALL_PARTS;
+  atlas->src_caps_hash = 0;
+  gst_caps_replace(&atlas->src_caps, NULL);
+
+  if (hard) {
+    /* parameter sets from caps must survive a flush, they are not resent */
+    g_ptr_array_set_size(atlas->asps, 0);
+    g_ptr_array_set_size(atlas->afps, 0);
+    g_ptr_array_set_size(atlas->aaps, 0);
+    g_ptr_array_set_size(atlas->sei, 0);
+
+    if (atlas->allocator != NULL) {
+      gst_object_unref(atlas->allocator);
+      atlas->allocator = NULL;
+    }
+    gst_allocation_params_init(&atlas->params);
+  }
 }
 
 static void gst_rtp_atlas_depay_reset(GstRtpAtlasDepay *rtpatlasdepay,
                                       gboolean hard) {
-  gst_adapter_clear(rtpatlasdepay->adapter);
-  rtpatlasdepay->wait_start = TRUE;
-  gst_adapter_clear(rtpatlasdepay->atlas_frame_adapter);
-  rtpatlasdepay->atlas_frame_start = FALSE;
-  rtpatlasdepay->last_keyframe = FALSE;
-  rtpatlasdepay->last_ts = 0;
-  rtpatlasdepay->current_fu_type = 0;
-  rtpatlasdepay->new_codec_data = TRUE;
-  g_ptr_array_set_size(rtpatlasdepay->asps, 0);
-  g_ptr_array_set_size(rtpatlasdepay->afps, 0);
-  g_ptr_array_set_size(rtpatlasdepay->aaps, 0);
+  guint i;
+
+  rtpatlasdepay->current_atlas = rtpatlasdepay->default_atlas;
+  gst_rtp_atlas_depay_reset_atlas(rtpatlasdepay, rtpatlasdepay->default_atlas,
+                                  hard);
+  for (i = 0; i < rtpatlasdepay->atlases->len; i++)
+    gst_rtp_atlas_depay_reset_atlas(
+        rtpatlasdepay, g_ptr_array_index(rtpatlasdepay->atlases, i), hard);
+
+  rtpatlasdepay->last_keyframe_request = -1;
+  g_array_set_size(rtpatlasdepay->don_queue, 0);
+  rtpatlasdepay->have_don = FALSE;
+  g_array_set_size(rtpatlasdepay->reorder_queue, 0);
+  rtpatlasdepay->have_next_seqnum = FALSE;
+  g_array_set_size(rtpatlasdepay->mrst_streams, 0);
+
+  if (hard)
+    g_ptr_array_set_size(rtpatlasdepay->cad, 0);
+}
 
-  if (hard) {
-    if (rtpatlasdepay->allocator != NULL) {
-      gst_object_unref(rtpatlasdepay->allocator);
-      rtpatlasdepay->allocator = NULL;
+/* Removes the src_%u pads, called after a hard reset */
+static void gst_rtp_atlas_depay_remove_atlases(GstRtpAtlasDepay *rtpatlasdepay) {
+  guint i;
+
+  rtpatlasdepay->current_atlas = rtpatlasdepay->default_atlas;
+
+  for (i = 0; i < rtpatlasdepay->atlases->len; i++) {
+    GstRtpAtlasDepayAtlas *atlas = g_ptr_array_index(rtpatlasdepay->atlases, i);
+
+    if (atlas->queue) {
+      gst_data_queue_set_flushing(atlas->queue, TRUE);
+      gst_pad_stop_task(atlas->srcpad);
     }
-    gst_allocation_params_init(&rtpatlasdepay->params);
+    gst_pad_set_active(atlas->srcpad, FALSE);
+    gst_element_remove_pad(GST_ELEMENT_CAST(rtpatlasdepay), atlas->srcpad);
   }
+  g_ptr_array_set_size(rtpatlasdepay->atlases, 0);
+  rtpatlasdepay->have_default_atlas_id = FALSE;
 }
 
 static void gst_rtp_atlas_depay_drain(GstRtpAtlasDepay *rtpatlasdepay) {
   GstClockTime timestamp;
   gboolean keyframe;
   GstBuffer *outbuf;
+  guint i;
 
-  if (!rtpatlasdepay->atlas_frame_start)
-    return;
+  gst_rtp_atlas_depay_flush_don_queue(rtpatlasdepay);
 
-  outbuf = gst_rtp_atlas_complete_au(rtpatlasdepay, &timestamp, &keyframe);
-  if (outbuf)
-    gst_rtp_atlas_depay_push(rtpatlasdepay, outbuf, keyframe, timestamp, FALSE);
+  for (i = 0; i <= rtpatlasdepay->atlases->len; i++) {
+    rtpatlasdepay->current_atlas =
+        i == 0 ? rtpatlasdepay->default_atlas
+               : g_ptr_array_index(rtpatlasdepay->atlases, i - 1);
+
+    if (!rtpatlasdepay->current_atlas->atlas_frame_start)
+      continue;
+
+    outbuf = gst_rtp_atlas_complete_au(rtpatlasdepay, &timestamp, &keyframe);
+    if (outbuf)
+      gst_rtp_atlas_depay_push(rtpatlasdepay, outbuf, keyframe, timestamp,
+                               FALSE);
+  }
+  rtpatlasdepay->current_atlas = rtpatlasdepay->default_atlas;
+}
+
+/* Hands the packets at the head of the reorder window to the base class:
+ * the next one in sequence, or the oldest one once it waited too long or
+ * the window is full. All of them when drain is set */
+static GstFlowReturn
+gst_rtp_atlas_depay_reorder_release(GstRtpAtlasDepay *rtpatlasdepay,
+                                    gboolean drain, gint64 now) {
+  GstPad *sinkpad = GST_RTP_BASE_DEPAYLOAD_SINKPAD(rtpatlasdepay);
+  GArray *window = rtpatlasdepay->reorder_queue;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  while (window->len > 0) {
+    GstRtpAtlasReorderPacket *head =
+        &g_array_index(window, GstRtpAtlasReorderPacket, 0);
+    GstBuffer *buffer;
+
+    if (!drain && rtpatlasdepay->have_next_seqnum &&
+        head->seqnum != rtpatlasdepay->next_seqnum &&
+        window->len <= rtpatlasdepay->reorder_window &&
+        (rtpatlasdepay->reorder_window_time == 0 ||
+         now - head->arrival < rtpatlasdepay->reorder_window_time *
+                                   G_TIME_SPAN_MILLISECOND))
+      break;
+
+    if (rtpatlasdepay->have_next_seqnum &&
+        head->seqnum != rtpatlasdepay->next_seqnum)
+      GST_DEBUG_OBJECT(rtpatlasdepay,
+                       "gave up waiting for packets %u to %u",
+                       rtpatlasdepay->next_seqnum, (guint16)(head->seqnum - 1));
+
+    buffer = g_steal_pointer(&head->buffer);
+    rtpatlasdepay->next_seqnum = head->seqnum + 1;
+    rtpatlasdepay->have_next_seqnum = TRUE;
+    g_array_remove_index(window, 0);
+
+    if (ret == GST_FLOW_OK)
+      ret = rtpatlasdepay->base_chain(sinkpad, GST_OBJECT_CAST(rtpatlasdepay),
+                                      buffer);
+    else
+      gst_buffer_unref(buffer);
+  }
+
+  return ret;
+}
+
+/* tx-mode MRST: checks the sequence number of the packet in the RTP stream
+ * of its SSRC, dropping old and duplicate packets and flagging a gap as
+ * DISCONT. The base class then gets the packet as the next one of a single
+ * stream. The reorder window does not apply, the NAL units are put in
+ * decoding order by DON */
+static GstFlowReturn gst_rtp_atlas_depay_mrst_chain(GstPad *pad,
+                                                    GstObject *parent,
+                                                    GstBuffer *buffer) {
+  GstRtpAtlasDepay *rtpatlasdepay = GST_RTP_ATLAS_DEPAY(parent);
+  GArray *streams = rtpatlasdepay->mrst_streams;
+  GstRtpAtlasMrstStream *stream = NULL;
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  guint32 ssrc;
+  guint16 seqnum;
+  guint i;
+
+  /* invalid packets are reported by the base class */
+  if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp))
+    return rtpatlasdepay->base_chain(pad, parent, buffer);
+  ssrc = gst_rtp_buffer_get_ssrc(&rtp);
+  seqnum = gst_rtp_buffer_get_seq(&rtp);
+  gst_rtp_buffer_unmap(&rtp);
+
+  for (i = 0; stream == NULL && i < streams->len; i++) {
+    if (g_array_index(streams, GstRtpAtlasMrstStream, i).ssrc == ssrc)
+      stream = &g_array_index(streams, GstRtpAtlasMrstStream, i);
+  }
+
+  if (stream == NULL) {
+    GstRtpAtlasMrstStream new_stream = {ssrc, seqnum};
+
+    GST_DEBUG_OBJECT(rtpatlasdepay, "new RTP stream, SSRC %08x", ssrc);
+    if (streams->len == 0)
+      rtpatlasdepay->mrst_ssrc = ssrc;
+    if (streams->len == MAX_MRST_STREAMS)
+      g_array_remove_index(streams, 0);
+    g_array_append_val(streams, new_stream);
+    stream = &g_array_index(streams, GstRtpAtlasMrstStream, streams->len - 1);
+  } else {
+    gint gap = gst_rtp_buffer_compare_seqnum(stream->next_seqnum, seqnum);
+
+    if (gap < 0 && gap >= -RTP_MAX_MISORDER) {
+      GST_LOG_OBJECT(rtpatlasdepay,
+                     "dropping old or duplicate packet %u of SSRC %08x",
+                     seqnum, ssrc);
+      gst_buffer_unref(buffer);
+      return GST_FLOW_OK;
+    }
+    if (gap != 0) {
+      GST_DEBUG_OBJECT(rtpatlasdepay,
+                       "expected packet %u of SSRC %08x, got %u",
+                       stream->next_seqnum, ssrc, seqnum);
+      buffer = gst_buffer_make_writable(buffer);
+      GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DISCONT);
+    }
+  }
+  stream->next_seqnum = seqnum + 1;
+
+  buffer = gst_buffer_make_writable(buffer);
+  if (gst_rtp_buffer_map(buffer, GST_MAP_WRITE, &rtp)) {
+    gst_rtp_buffer_set_ssrc(&rtp, rtpatlasdepay->mrst_ssrc);
+    gst_rtp_buffer_set_seq(&rtp, rtpatlasdepay->mrst_seqnum);
+    gst_rtp_buffer_unmap(&rtp);
+  }
+  rtpatlasdepay->mrst_seqnum++;
+  rtpatlasdepay->packet_ssrc = ssrc;
+  rtpatlasdepay->packet_seqnum = seqnum;
+
+  return rtpatlasdepay->base_chain(pad, parent, buffer);
+}
+
+static GstFlowReturn gst_rtp_atlas_depay_chain(GstPad *pad, GstObject *parent,
+                                               GstBuffer *buffer) {
+  GstRtpAtlasDepay *rtpatlasdepay = GST_RTP_ATLAS_DEPAY(parent);
+  GArray *window = rtpatlasdepay->reorder_queue;
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  GstRtpAtlasReorderPacket packet;
+  guint i;
+
+  if (rtpatlasdepay->mrst)
+    return gst_rtp_atlas_depay_mrst_chain(pad, parent, buffer);
+
+  if (rtpatlasdepay->reorder_window == 0 && window->len == 0)
+    return rtpatlasdepay->base_chain(pad, parent, buffer);
+
+  /* invalid packets are reported by the base class */
+  if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp))
+    return rtpatlasdepay->base_chain(pad, parent, buffer);
+  packet.seqnum = gst_rtp_buffer_get_seq(&rtp);
+  gst_rtp_buffer_unmap(&rtp);
+
+  /* too late, the base class drops it */
+  if (rtpatlasdepay->have_next_seqnum &&
+      gst_rtp_buffer_compare_seqnum(rtpatlasdepay->next_seqnum,
+                                    packet.seqnum) < 0)
+    return rtpatlasdepay->base_chain(pad, parent, buffer);
+
+  for (i = window->len; i > 0; i--) {
+    gint diff = gst_rtp_buffer_compare_seqnum(
+        g_array_index(window, GstRtpAtlasReorderPacket, i - 1).seqnum,
+        packet.seqnum);
+
+    if (diff == 0) {
+      GST_LOG_OBJECT(rtpatlasdepay, "dropping duplicate packet %u",
+                     packet.seqnum);
+      gst_buffer_unref(buffer);
+      return GST_FLOW_OK;
+    }
+    if (diff > 0)
+      break;
+  }
+
+  packet.buffer = buffer;
+  packet.arrival = g_get_monotonic_time();
+  g_array_insert_val(window, i, packet);
+
+  return gst_rtp_atlas_depay_reorder_release(rtpatlasdepay, FALSE,
+                                             packet.arrival);
+}
+
+static GstFlowReturn gst_rtp_atlas_depay_chain_list(GstPad *pad,
+                                                    GstObject *parent,
+                                                    GstBufferList *list) {
+  GstRtpAtlasDepay *rtpatlasdepay = GST_RTP_ATLAS_DEPAY(parent);
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint i, len;
+
+  if (!rtpatlasdepay->mrst && rtpatlasdepay->reorder_window == 0 &&
+      rtpatlasdepay->reorder_queue->len == 0)
+    return rtpatlasdepay->base_chain_list(pad, parent, list);
+
+  len = gst_buffer_list_length(list);
+  for (i = 0; ret == GST_FLOW_OK && i < len; i++)
+    ret = gst_rtp_atlas_depay_chain(
+        pad, parent, gst_buffer_ref(gst_buffer_list_get(list, i)));
+  gst_buffer_list_unref(list);
+
+  return ret;
 }
 
 static void gst_rtp_atlas_depay_finalize(GObject *object) {
@@ -191,15 +954,15 @@ static void gst_rtp_atlas_depay_finalize(GObject *object) {
 
   rtpatlasdepay = GST_RTP_ATLAS_DEPAY(object);
 
-  if (rtpatlasdepay->codec_data)
-    gst_buffer_unref(rtpatlasdepay->codec_data);
-
-  g_object_unref(rtpatlasdepay->adapter);
-  g_object_unref(rtpatlasdepay->atlas_frame_adapter);
+  g_ptr_array_free(rtpatlasdepay->atlases, TRUE);
+  gst_rtp_atlas_depay_atlas_free(rtpatlasdepay->default_atlas);
 
-  g_ptr_array_free(rtpatlasdepay->asps, TRUE);
-  g_ptr_array_free(rtpatlasdepay->afps, TRUE);
-  g_ptr_array_free(rtpatlasdepay->aaps, TRUE);
+  gst_buffer_replace(&rtpatlasdepay->vps, NULL);
+  g_ptr_array_free(rtpatlasdepay->cad, TRUE);
+  g_array_free(rtpatlasdepay->don_queue, TRUE);
+  g_array_free(rtpatlasdepay->reorder_queue, TRUE);
+  g_array_free(rtpatlasdepay->mrst_streams, TRUE);
+  g_array_free(rtpatlasdepay->tile_ids, TRUE);
 
   G_OBJECT_CLASS(parent_class)->finalize(object);
 }
@@ -266,6 +1029,7 @@ static void gst_rtp_atlas_depay_negotiate(GstRtpAtlasDepay *rtpatlasdepay) {
 static gboolean
 gst_rtp_atlas_depay_set_output_caps(GstRtpAtlasDepay *rtpatlasdepay,
                                     GstCaps *caps) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
   GstAllocationParams params;
   GstAllocator *allocator = NULL;
   GstPad *srcpad;
@@ -273,11 +1037,20 @@ gst_rtp_atlas_depay_set_output_caps(GstRtpAtlasDepay *rtpatlasdepay,
 
   gst_allocation_params_init(&params);
 
-  srcpad = GST_RTP_BASE_DEPAYLOAD_SRCPAD(rtpatlasdepay);
+  srcpad = atlas->srcpad;
 
-  res = gst_pad_set_caps(srcpad, caps);
+  if (atlas->queue) {
+    /* in order with the access units queued for the worker. Downstream
+     * does not have the caps yet, so there is no ALLOCATION query and the
+     * access units use the default allocator */
+    gst_rtp_atlas_depay_atlas_output(
+        srcpad, GST_MINI_OBJECT_CAST(gst_event_new_caps(caps)));
+    res = TRUE;
+  } else {
+    res = gst_pad_set_caps(srcpad, caps);
+  }
 
-  if (res) {
+  if (res && !atlas->queue) {
     GstQuery *query;
 
     query = gst_query_new_allocation(caps, TRUE);
@@ -292,211 +1065,542 @@ gst_rtp_atlas_depay_set_output_caps(GstRtpAtlasDepay *rtpatlasdepay,
     gst_query_unref(query);
   }
 
-  if (rtpatlasdepay->allocator)
-    gst_object_unref(rtpatlasdepay->allocator);
+  if (atlas->allocator)
+    gst_object_unref(atlas->allocator);
 
-  rtpatlasdepay->allocator = allocator;
-  rtpatlasdepay->params = params;
+  atlas->allocator = allocator;
+  atlas->params = params;
 
   return res;
 }
 
-static gboolean gst_rtp_atlas_set_src_caps(GstRtpAtlasDepay *rtpatlasdepay) {
-  gboolean res, update_caps;
-  GstCaps *old_caps;
-  GstCaps *srccaps;
-  GstPad *srcpad;
+static GPtrArray *
+gst_rtp_atlas_depay_get_setup_units(GstRtpAtlasDepay *rtpatlasdepay,
+                                    guint8 nal_unit_type) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
+  switch (nal_unit_type) {
+  case GST_ATLAS_NAL_ASPS:
+    return atlas->asps;
+  case GST_ATLAS_NAL_AFPS:
+    return atlas->afps;
+  case GST_ATLAS_NAL_AAPS:
+    return atlas->aaps;
+  case GST_ATLAS_NAL_PREFIX_NSEI:
+  case GST_ATLAS_NAL_PREFIX_ESEI:
+  case GST_ATLAS_NAL_SUFFIX_NSEI:
+  case GST_ATLAS_NAL_SUFFIX_ESEI:
+    return atlas->sei;
+  case GST_ATLAS_NAL_CASPS:
+  case GST_ATLAS_NAL_CAF_IDR:
+    return rtpatlasdepay->cad;
+  default:
+    return NULL;
+  }
+}
 
-  GST_DEBUG_OBJECT(rtpatlasdepay, "rtpatlasdepay->new_codec_data %d",
-                   rtpatlasdepay->new_codec_data);
+static inline void
+gst_rtp_atlas_depay_mark_codec_data(GstRtpAtlasDepay *rtpatlasdepay,
+                                    guint part) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
+  guint i;
 
-  if (!rtpatlasdepay->new_codec_data){
-    return TRUE;
-  }
+  atlas->v3cdcr_dirty |= V3CDCR_PART_BIT(part);
+  atlas->new_codec_data = TRUE;
 
-  srccaps = gst_caps_new_simple("video/x-atlas", "stream-format", G_TYPE_STRING,
-                                rtpatlasdepay->stream_format, "alignment",
-                                G_TYPE_STRING, "au", NULL);
-  GstBuffer *codec_data;
-  gint i = 0;
-  gint len;
-  guint num_asps = rtpatlasdepay->asps->len;
-  guint num_afps = rtpatlasdepay->afps->len;
-  guint num_aaps = rtpatlasdepay->aaps->len;
-  GstMapInfo map, vpsmap;
-  guint8 *data;
-  guint8 num_arrays = 0;
-  guint8 unit_size_precision_bytes_minus1 = 3;
+  /* shared by all atlases, the record of every other atlas changes too */
+  if (part != V3CDCR_VPS_PART && part != GST_ATLAS_NAL_CASPS &&
+      part != GST_ATLAS_NAL_CAF_IDR)
+    return;
 
-  /* start with 1 bytes unit_size_precision_bytes_minus1,
-   * num_of_v3c_parameter_sets = 0 */
-  len = 1;
+  for (i = 0; i <= rtpatlasdepay->atlases->len; i++) {
+    atlas = i == 0 ? rtpatlasdepay->default_atlas
+                   : g_ptr_array_index(rtpatlasdepay->atlases, i - 1);
 
-  if (rtpatlasdepay->vps){
-    gst_buffer_map(rtpatlasdepay->vps, &map, GST_MAP_WRITE);
-    /* 2 bytes for v3c_parameter_set_length*/
-    len += 2;
-    /* v3c_parameter_set size */
-    len += map.size;
-    gst_buffer_unmap(rtpatlasdepay->vps, &map);
+    atlas->v3cdcr_dirty |= V3CDCR_PART_BIT(part);
+    atlas->new_codec_data = TRUE;
   }
+}
 
-  /* 1 byte for num_of_setup_unit_arrays */
-  len += 1;
+/* unit_size_precision_bytes_minus1, num_of_v3c_parameter_sets and the
+ * V3C parameter set */
+static GstBuffer *
+gst_rtp_atlas_depay_serialize_vps_part(GstRtpAtlasDepay *rtpatlasdepay) {
+  GstBuffer *part;
+  GstMapInfo map;
+  guint8 unit_size_precision_bytes_minus1 = rtpatlasdepay->nal_length_size - 1;
+  gsize vps_size = 0;
 
-  num_arrays = (num_asps > 0) + (num_afps > 0) + (num_aaps > 0);
-  /* each array will have at least 2 bytes
-    array_completeness, nal_unit_type, num_nal_units*/
-  len += 2 * num_arrays;
+  if (rtpatlasdepay->vps)
+    vps_size = gst_buffer_get_size(rtpatlasdepay->vps);
 
-  /* add size of asps, afps & aaps */
-  for (i = 0; i < num_asps; i++) {
-    /* 2 bytes for setup_unit_length and the unit itself */
-    len += 2 + gst_buffer_get_size(g_ptr_array_index(rtpatlasdepay->asps, i));
-  }
-  for (i = 0; i < num_afps; i++) {
-    /* 2 bytes for setup_unit_length and the unit itself */
-    len += 2 + gst_buffer_get_size(g_ptr_array_index(rtpatlasdepay->afps, i));
+  /* 1 byte, and 2 bytes for v3c_parameter_set_length when present */
+  part = gst_buffer_new_allocate(NULL, 1 + (vps_size ? 2 + vps_size : 0),
+                                 NULL);
+  gst_buffer_map(part, &map, GST_MAP_WRITE);
+
+  map.data[0] = unit_size_precision_bytes_minus1 << 5;
+  if (vps_size) {
+    /* num_of_v3c_parameter_sets */
+    map.data[0] |= 0x01;
+    /* v3c_parameter_set_length */
+    GST_WRITE_UINT16_BE(map.data + 1, vps_size);
+    gst_buffer_extract(rtpatlasdepay->vps, 0, map.data + 3, vps_size);
+
+    GST_DEBUG_OBJECT(rtpatlasdepay, "Copied VPS of length %u", (guint)vps_size);
   }
-  for (i = 0; i < num_aaps; i++) {
+  gst_buffer_unmap(part, &map);
+
+  return part;
+}
+
+/* TRUE for a unit of nal_unit_type whose size fits setup_unit_length */
+static gboolean gst_rtp_atlas_depay_setup_unit_fits(GstBuffer *unit,
+                                                    guint8 nal_unit_type) {
+  guint8 header;
+
+  if (gst_buffer_extract(unit, 0, &header, 1) != 1 ||
+      ((header >> 1) & 0x3f) != nal_unit_type)
+    return FALSE;
+
+  return gst_buffer_get_size(unit) <= G_MAXUINT16;
+}
+
+/* a single setup unit array holding the units of nal_unit_type, at most
+ * 255 of them, NULL if there is no unit of that type */
+static GstBuffer *
+gst_rtp_atlas_depay_serialize_setup_units(GstRtpAtlasDepay *rtpatlasdepay,
+                                          guint8 nal_unit_type,
+                                          GPtrArray *units) {
+  GstBuffer *part;
+  GstMapInfo map;
+  guint8 *data;
+  guint8 num_nal_units = 0;
+  gsize len;
+  guint i;
+
+  if (units == NULL || units->len == 0)
+    return NULL;
+
+  /* array_completeness, nal_unit_type, num_nal_units */
+  len = 2;
+  for (i = 0; i < units->len; i++) {
+    GstBuffer *unit = g_ptr_array_index(units, i);
+
+    if (!gst_rtp_atlas_depay_setup_unit_fits(unit, nal_unit_type))
+      continue;
+    if (num_nal_units == G_MAXUINT8)
+      break;
+
     /* 2 bytes for setup_unit_length and the unit itself */
-    len += 2 + gst_buffer_get_size(g_ptr_array_index(rtpatlasdepay->aaps, i));
+    len += 2 + gst_buffer_get_size(unit);
+    num_nal_units++;
   }
 
-  GST_DEBUG_OBJECT(rtpatlasdepay, "codec_data length %u", (guint)len);
+  if (num_nal_units == 0)
+    return NULL;
 
-  codec_data = gst_buffer_new_and_alloc(len);
-  gst_buffer_map(codec_data, &map, GST_MAP_READWRITE);
+  part = gst_buffer_new_allocate(NULL, len, NULL);
+  gst_buffer_map(part, &map, GST_MAP_WRITE);
   data = map.data;
 
-  memset(data, 0, map.size);
-  data[0] = unit_size_precision_bytes_minus1 << 5;
-  
-  if (rtpatlasdepay->vps) {
-    /* num_of_v3c_parameter_sets */
-    data[0] = data[0] | 0x01;
-    data++;
-    gst_buffer_map(rtpatlasdepay->vps, &vpsmap, GST_MAP_READWRITE);
+  /* array_completeness | reserved_zero bit | nal_unit_type */
+  data[0] = 0x00 | (nal_unit_type & 0x3f);
+  data[1] = num_nal_units;
+  data += 2;
 
-    /* v3c_parameter_set_length */
-    GST_WRITE_UINT16_BE(data, vpsmap.size);
-    data += 2;
-    memcpy(data, vpsmap.data, vpsmap.size);
-    data += vpsmap.size;
+  for (i = 0; i < units->len && num_nal_units > 0; i++) {
+    GstBuffer *unit = g_ptr_array_index(units, i);
+    gsize nal_size = gst_buffer_get_size(unit);
 
-    GST_DEBUG_OBJECT(rtpatlasdepay, "Copied VPS of length %u",
-                     (guint)vpsmap.size);
+    if (!gst_rtp_atlas_depay_setup_unit_fits(unit, nal_unit_type))
+      continue;
+    num_nal_units--;
 
-    gst_buffer_unmap(rtpatlasdepay->vps, &vpsmap);
+    GST_WRITE_UINT16_BE(data, nal_size);
+    gst_buffer_extract(unit, 0, data + 2, nal_size);
+    data += 2 + nal_size;
+    GST_DEBUG_OBJECT(rtpatlasdepay, "Copied setup unit %d of type %u of "
+                     "length %u", i, nal_unit_type, (guint)nal_size);
   }
+  gst_buffer_unmap(part, &map);
 
-  /* num_of_setup_unit_arrays */
-  data[0] = num_arrays;
+  return part;
+}
 
-  GST_DEBUG_OBJECT(rtpatlasdepay, "num of arrays %d ", num_arrays);
+/* Brings the serialized V3CDecoderConfigurationRecord up to date, only
+ * the parts that changed since the last call are serialized again, the
+ * record itself shares the memory of its parts.
+ * Returns the content hash of the record. */
+static guint32 gst_rtp_atlas_depay_update_v3cdcr(GstRtpAtlasDepay *rtpatlasdepay) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
+  GstBuffer *v3cdcr;
+  GstMapInfo map;
+  guint8 num_arrays = 0;
+  guint32 hash;
+  guint i;
+
+  if (atlas->v3cdcr != NULL && atlas->v3cdcr_dirty == 0)
+    goto done;
+
+  if (atlas->v3cdcr_vps == NULL ||
+      atlas->v3cdcr_dirty & V3CDCR_PART_BIT(V3CDCR_VPS_PART)) {
+    gst_buffer_replace(&atlas->v3cdcr_vps, NULL);
+    atlas->v3cdcr_vps =
+        gst_rtp_atlas_depay_serialize_vps_part(rtpatlasdepay);
+    atlas->v3cdcr_vps_hash = gst_atlas_hash_buffer(
+        GST_ATLAS_HASH_INIT, atlas->v3cdcr_vps);
+  }
 
-  if (num_asps > 0) {
-    /* array_completeness | reserved_zero bit | nal_unit_type */
-    data[0] = 0x00 | 0x24;
-    data++;
-
-    data[0] = num_asps;
-    data += 1;
-
-    for (i = 0; i < num_asps; i++) {
-      gsize nal_size =
-          gst_buffer_get_size(g_ptr_array_index(rtpatlasdepay->asps, i));
-      GST_WRITE_UINT16_BE(data, nal_size);
-      gst_buffer_extract(g_ptr_array_index(rtpatlasdepay->asps, i), 0, data + 2,
-                         nal_size);
-      data += 2 + nal_size;
-      GST_DEBUG_OBJECT(rtpatlasdepay, "Copied ASPS %d of length %u", i,
-                       (guint)nal_size);
+  for (i = 0; i < G_N_ELEMENTS(setup_unit_array_types); i++) {
+    guint8 nal_unit_type = setup_unit_array_types[i];
+
+    if (atlas->v3cdcr_dirty & V3CDCR_PART_BIT(nal_unit_type)) {
+      gst_buffer_replace(&atlas->v3cdcr_arrays[i], NULL);
+      atlas->v3cdcr_arrays[i] =
+          gst_rtp_atlas_depay_serialize_setup_units(
+              rtpatlasdepay, nal_unit_type,
+              gst_rtp_atlas_depay_get_setup_units(rtpatlasdepay,
+                                                  nal_unit_type));
+      atlas->v3cdcr_array_hash[i] = gst_atlas_hash_buffer(
+          GST_ATLAS_HASH_INIT, atlas->v3cdcr_arrays[i]);
     }
+    if (atlas->v3cdcr_arrays[i])
+      num_arrays++;
   }
+  atlas->v3cdcr_dirty = 0;
 
-  if (num_afps > 0) {
-    /* array_completeness | reserved_zero bit | nal_unit_type */
-    data[0] = 0x00 | 0x25;
-    data++;
+  /* assemble the record from the parts without copying them */
+  v3cdcr = gst_buffer_copy_region(atlas->v3cdcr_vps,
+                                  GST_BUFFER_COPY_MEMORY, 0, -1);
+  /* num_of_setup_unit_arrays */
+  {
+    GstMemory *num_of_arrays = gst_allocator_alloc(NULL, 1, NULL);
 
-    data[0] = num_afps;
-    data += 1;
+    gst_memory_map(num_of_arrays, &map, GST_MAP_WRITE);
+    map.data[0] = num_arrays;
+    gst_memory_unmap(num_of_arrays, &map);
+    gst_buffer_append_memory(v3cdcr, num_of_arrays);
+  }
+  GST_DEBUG_OBJECT(rtpatlasdepay, "num of arrays %d ", num_arrays);
 
-    for (i = 0; i < num_afps; i++) {
-      gsize nal_size =
-          gst_buffer_get_size(g_ptr_array_index(rtpatlasdepay->afps, i));
-      GST_WRITE_UINT16_BE(data, nal_size);
-      gst_buffer_extract(g_ptr_array_index(rtpatlasdepay->afps, i), 0, data + 2,
-                         nal_size);
-      data += 2 + nal_size;
-      GST_DEBUG_OBJECT(rtpatlasdepay, "Copied AFPS %d of length %u", i,
-                       (guint)nal_size);
-    }
+  for (i = 0; i < G_N_ELEMENTS(setup_unit_array_types); i++) {
+    if (atlas->v3cdcr_arrays[i])
+      v3cdcr = gst_buffer_append_region(
+          v3cdcr, gst_buffer_ref(atlas->v3cdcr_arrays[i]), 0, -1);
   }
 
-  if (num_aaps > 0) {
-    /* array_completeness | reserved_zero bit | nal_unit_type */
-    data[0] = 0x00 | 0x2F;
-    data++;
+  GST_DEBUG_OBJECT(rtpatlasdepay, "codec_data length %u",
+                   (guint)gst_buffer_get_size(v3cdcr));
+
+  gst_buffer_replace(&atlas->v3cdcr, NULL);
+  atlas->v3cdcr = v3cdcr;
+
+done:
+  /* combine the hashes of the parts */
+  hash = atlas->v3cdcr_vps_hash;
+  for (i = 0; i < G_N_ELEMENTS(setup_unit_array_types); i++)
+    hash = hash * 31 + atlas->v3cdcr_array_hash[i];
+
+  return hash;
+}
+
+/* TRUE when buffer holds the bytes of the buffer field of s, or both are
+ * missing */
+static gboolean gst_rtp_atlas_depay_caps_buffer_equal(const GstStructure *s,
+                                                      const gchar *field,
+                                                      GstBuffer *buffer) {
+  const GValue *value = gst_structure_get_value(s, field);
+  GstBuffer *sent;
+  GstMapInfo map;
+  gboolean equal;
+
+  if (value == NULL || buffer == NULL)
+    return value == NULL && buffer == NULL;
+
+  sent = gst_value_get_buffer(value);
+  if (gst_buffer_get_size(sent) != gst_buffer_get_size(buffer) ||
+      !gst_buffer_map(buffer, &map, GST_MAP_READ))
+    return FALSE;
+  equal = gst_buffer_memcmp(sent, 0, map.data, map.size) == 0;
+  gst_buffer_unmap(buffer, &map);
+
+  return equal;
+}
 
-    data[0] = num_aaps;
-    data += 1;
+static gboolean gst_rtp_atlas_set_src_caps(GstRtpAtlasDepay *rtpatlasdepay) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
+  gboolean res;
+  GstCaps *srccaps;
+  GstPad *srcpad;
+  guint32 hash;
+
+  GST_DEBUG_OBJECT(rtpatlasdepay, "atlas->new_codec_data %d",
+                   atlas->new_codec_data);
 
-    for (i = 0; i < num_aaps; i++) {
-      gsize nal_size =
-          gst_buffer_get_size(g_ptr_array_index(rtpatlasdepay->aaps, i));
-      GST_WRITE_UINT16_BE(data, nal_size);
-      gst_buffer_extract(g_ptr_array_index(rtpatlasdepay->aaps, i), 0,
-                         data + 2, nal_size);
-      data += 2 + nal_size;
-      GST_DEBUG_OBJECT(rtpatlasdepay, "Copied AAPS %d of length %u", i,
-                       (guint)nal_size);
+  if (!atlas->new_codec_data){
+    return TRUE;
+  }
+
+  hash = gst_rtp_atlas_depay_update_v3cdcr(rtpatlasdepay);
+  hash = gst_atlas_hash_buffer(hash, atlas->vuh);
+  hash = gst_atlas_hash_data(hash, (const guint8 *)rtpatlasdepay->stream_format,
+                             rtpatlasdepay->stream_format ?
+                             strlen(rtpatlasdepay->stream_format) : 0);
+
+  srcpad = atlas->srcpad;
+
+  /* the caps only depend on what was hashed, skip renegotiation when the
+   * content did not change. The hash may collide, a match is confirmed on
+   * the bytes of the caps sent last */
+  if (hash == atlas->src_caps_hash && atlas->src_caps != NULL &&
+      gst_pad_has_current_caps(srcpad)) {
+    GstStructure *s = gst_caps_get_structure(atlas->src_caps, 0);
+
+    if (g_strcmp0(gst_structure_get_string(s, "stream-format"),
+                  rtpatlasdepay->stream_format) == 0 &&
+        gst_rtp_atlas_depay_caps_buffer_equal(s, "vuh_data", atlas->vuh) &&
+        gst_rtp_atlas_depay_caps_buffer_equal(s, "codec_data",
+                                              atlas->v3cdcr)) {
+      GST_DEBUG_OBJECT(rtpatlasdepay, "src caps unchanged");
+      atlas->new_codec_data = FALSE;
+      return TRUE;
     }
+    GST_DEBUG_OBJECT(rtpatlasdepay, "src caps hash collision");
   }
 
-  if (rtpatlasdepay->vuh != NULL) {
+  srccaps = gst_caps_new_simple("video/x-atlas", "stream-format", G_TYPE_STRING,
+                                rtpatlasdepay->stream_format, "alignment",
+                                G_TYPE_STRING, "au", NULL);
+
+  if (atlas->vuh != NULL) {
     gst_caps_set_simple(srccaps, "vuh_data", GST_TYPE_BUFFER,
-                        rtpatlasdepay->vuh, NULL);
+                        atlas->vuh, NULL);
   }
 
-  gst_caps_set_simple(srccaps, "codec_data", GST_TYPE_BUFFER, codec_data, NULL);
-  gst_buffer_unmap(codec_data, &map);
-  gst_buffer_unref(codec_data);
+  gst_caps_set_simple(srccaps, "codec_data", GST_TYPE_BUFFER,
+                      atlas->v3cdcr, NULL);
+
+  res = gst_rtp_atlas_depay_set_output_caps(rtpatlasdepay, srccaps);
+
+  if (res) {
+    gst_caps_replace(&atlas->src_caps, srccaps);
+    atlas->src_caps_hash = hash;
+    atlas->new_codec_data = FALSE;
+  }
 
-  srcpad = GST_RTP_BASE_DEPAYLOAD_SRCPAD(rtpatlasdepay);
+  gst_caps_unref(srccaps);
 
-  old_caps = gst_pad_get_current_caps(srcpad);
-  if (old_caps != NULL) {
+  return res;
+}
 
-    GstCaps *tmp_caps = gst_caps_copy(srccaps);
-    GstStructure *old_s, *tmp_s;
+static gboolean gst_rtp_atlas_parameter_set_get_id(GstMapInfo *map,
+                                                   guint32 *ps_id) {
+  return gst_atlas_nal_get_parameter_set_id(map->data, map->size, ps_id);
+}
 
-    old_s = gst_caps_get_structure(old_caps, 0);
-    tmp_s = gst_caps_get_structure(tmp_caps, 0);
-    if (gst_structure_has_field(old_s, "codec_data"))
-      gst_structure_set_value(tmp_s, "codec_data",
-                              gst_structure_get_value(old_s, "codec_data"));
+/* Stores the ASPS, AFPS or AAPS in the corresponding array indexed by its
+ * parameter set id. A set with an id already known replaces the old one.
+ * Takes ownership of nal. Returns TRUE if the stored sets changed. */
+gboolean gst_rtp_atlas_add_asps_afps_aaps(GstElement *rtpatlas, GPtrArray *asps,
+                                          GPtrArray *afps, GPtrArray *aaps,
+                                          GstBuffer *nal) {
+  GstMapInfo map;
+  GPtrArray *array;
+  const gchar *name;
+  guint8 type;
+  guint32 ps_id;
+  guint i;
 
-    update_caps = !gst_caps_is_equal(old_caps, tmp_caps);
-    gst_caps_unref(tmp_caps);
-    gst_caps_unref(old_caps);
-  } else {
-    update_caps = TRUE;
+  gst_buffer_map(nal, &map, GST_MAP_READ);
+
+  if (map.size < 3)
+    goto drop;
+
+  type = (map.data[0] >> 1) & 0x3f;
+
+  switch (type) {
+  case GST_ATLAS_NAL_ASPS:
+    array = asps;
+    name = "ASPS";
+    break;
+  case GST_ATLAS_NAL_AFPS:
+    array = afps;
+    name = "AFPS";
+    break;
+  case GST_ATLAS_NAL_AAPS:
+    array = aaps;
+    name = "AAPS";
+    break;
+  default:
+    goto drop;
   }
 
-  if (update_caps) {
-    res = gst_rtp_atlas_depay_set_output_caps(rtpatlasdepay, srccaps);
-  } else {
-    res = TRUE;
+  if (!gst_rtp_atlas_parameter_set_get_id(&map, &ps_id)) {
+    GST_WARNING_OBJECT(rtpatlas, "Invalid %s, can't parse its id", name);
+    goto drop;
   }
 
-  gst_caps_unref(srccaps);
+  for (i = 0; i < array->len; i++) {
+    GstBuffer *ps = g_ptr_array_index(array, i);
+    GstMapInfo psmap;
+    guint32 tmp_ps_id;
 
-  if (res)
-    rtpatlasdepay->new_codec_data = FALSE;
+    gst_buffer_map(ps, &psmap, GST_MAP_READ);
+    if (!gst_rtp_atlas_parameter_set_get_id(&psmap, &tmp_ps_id) ||
+        tmp_ps_id != ps_id) {
+      gst_buffer_unmap(ps, &psmap);
+      continue;
+    }
 
-  return res;
+    /* If this is already present in the array, then it's not new */
+    if (map.size == psmap.size &&
+        memcmp(map.data, psmap.data, psmap.size) == 0) {
+      GST_LOG_OBJECT(rtpatlas, "Unchanged %s %u, not updating", name, ps_id);
+      gst_buffer_unmap(ps, &psmap);
+      goto drop;
+    }
+
+    gst_buffer_unmap(ps, &psmap);
+    GST_LOG_OBJECT(rtpatlas, "Modified %s %u, replacing", name, ps_id);
+    gst_buffer_unmap(nal, &map);
+    /* keep the order in which the sets were received */
+    g_ptr_array_index(array, i) = nal;
+    gst_buffer_unref(ps);
+    return TRUE;
+  }
+
+  GST_LOG_OBJECT(rtpatlas, "Adding new %s %u", name, ps_id);
+  gst_buffer_unmap(nal, &map);
+  g_ptr_array_add(array, nal);
+
+  return TRUE;
+
+drop:
+  gst_buffer_unmap(nal, &map);
+  gst_buffer_unref(nal);
+  return FALSE;
+}
+
+static gboolean gst_rtp_atlas_depay_replace_buffer(GstBuffer **old_buf,
+                                                   const guchar *data,
+                                                   gsize size) {
+  GstBuffer *buf;
+
+  if (*old_buf != NULL && gst_buffer_get_size(*old_buf) == size &&
+      gst_buffer_memcmp(*old_buf, 0, data, size) == 0)
+    return FALSE;
+
+  buf = gst_buffer_new_allocate(NULL, size, NULL);
+  gst_buffer_fill(buf, 0, data, size);
+  gst_buffer_replace(old_buf, buf);
+  gst_buffer_unref(buf);
+
+  return TRUE;
+}
+
+/* SEI and common atlas data have no id usable here, the v3c-sei and
+ * v3c-common-atlas-data lists replace the stored ones as a whole. Only
+ * units stored in the same array are accepted */
+static void gst_rtp_atlas_depay_set_units(GstRtpAtlasDepay *rtpatlasdepay,
+                                          GPtrArray **stored,
+                                          const gchar *field,
+                                          const gchar *units_base64) {
+  GPtrArray *units;
+  gchar **params_base64;
+  gboolean changed;
+  guint i;
+
+  units = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  params_base64 = g_strsplit(units_base64, ",", 0);
+
+  for (i = 0; params_base64[i]; i++) {
+    guchar *param;
+    guint8 param_type;
+    gsize size;
+
+    param = g_base64_decode(params_base64[i], &size);
+    if (size < 2) {
+      GST_WARNING_OBJECT(rtpatlasdepay, "got too short NAL unit on %s", field);
+      g_free(param);
+      continue;
+    }
+
+    param_type = (param[0] & 0x7E) >> 1;
+    if (gst_rtp_atlas_depay_get_setup_units(rtpatlasdepay, param_type) ==
+        *stored) {
+      GST_DEBUG_OBJECT(rtpatlasdepay,
+                       "got NAL unit %d of size %" G_GSIZE_FORMAT " on %s",
+                       param_type, size, field);
+      g_ptr_array_add(units, gst_buffer_new_memdup(param, size));
+    } else {
+      GST_WARNING_OBJECT(rtpatlasdepay, "got unexpected NAL unit %d on %s",
+                         param_type, field);
+    }
+    g_free(param);
+  }
+  g_strfreev(params_base64);
+
+  changed = units->len != (*stored)->len;
+  for (i = 0; !changed && i < units->len; i++) {
+    GstBuffer *new_unit = g_ptr_array_index(units, i);
+    GstBuffer *old_unit = g_ptr_array_index(*stored, i);
+    GstMapInfo map;
+
+    gst_buffer_map(new_unit, &map, GST_MAP_READ);
+    changed = gst_buffer_get_size(old_unit) != map.size ||
+              gst_buffer_memcmp(old_unit, 0, map.data, map.size) != 0;
+    gst_buffer_unmap(new_unit, &map);
+  }
+
+  if (!changed) {
+    g_ptr_array_free(units, TRUE);
+    return;
+  }
+
+  g_ptr_array_free(*stored, TRUE);
+  *stored = units;
+  for (i = 0; i < G_N_ELEMENTS(setup_unit_array_types); i++) {
+    if (gst_rtp_atlas_depay_get_setup_units(
+            rtpatlasdepay, setup_unit_array_types[i]) == units)
+      gst_rtp_atlas_depay_mark_codec_data(rtpatlasdepay,
+                                          setup_unit_array_types[i]);
+  }
+}
+
+/* CASPS and CAF_IDR received in-band replace the stored unit of the same
+ * type, takes ownership of unit. Returns TRUE when the stored common atlas
+ * data changed */
+static gboolean gst_rtp_atlas_depay_store_cad(GstRtpAtlasDepay *rtpatlasdepay,
+                                              guint8 nal_type,
+                                              GstBuffer *unit) {
+  GstMapInfo map;
+  guint i;
+
+  gst_buffer_map(unit, &map, GST_MAP_READ);
+  for (i = 0; i < rtpatlasdepay->cad->len; i++) {
+    GstBuffer *stored = g_ptr_array_index(rtpatlasdepay->cad, i);
+    guint8 header;
+
+    gst_buffer_extract(stored, 0, &header, 1);
+    if (((header >> 1) & 0x3f) != nal_type)
+      continue;
+
+    if (gst_buffer_get_size(stored) == map.size &&
+        gst_buffer_memcmp(stored, 0, map.data, map.size) == 0) {
+      gst_buffer_unmap(unit, &map);
+      gst_buffer_unref(unit);
+      return FALSE;
+    }
+
+    gst_buffer_unmap(unit, &map);
+    g_ptr_array_index(rtpatlasdepay->cad, i) = unit;
+    gst_buffer_unref(stored);
+    return TRUE;
+  }
+  gst_buffer_unmap(unit, &map);
+
+  g_ptr_array_add(rtpatlasdepay->cad, unit);
+  return TRUE;
 }
 
 static gboolean gst_rtp_atlas_depay_setcaps(GstRTPBaseDepayload *depayload,
@@ -507,10 +1611,19 @@ static gboolean gst_rtp_atlas_depay_setcaps(GstRTPBaseDepayload *depayload,
   const gchar *ad_base64 = NULL;
   const gchar *vps_base64 = NULL;
   const gchar *vuh_base64 = NULL;
-  GstMapInfo map;
+  const gchar *sei_base64 = NULL;
+  const gchar *cad_base64 = NULL;
+  const gchar *tx_mode = NULL;
+  GstRtpAtlasDepayAtlas *atlas;
+  gint max_don_diff = 0;
+  gint tile_id_pres = 0;
+  guint n;
 
   rtpatlasdepay = GST_RTP_ATLAS_DEPAY(depayload);
 
+  /* the caps describe the atlas of the always src pad */
+  atlas = rtpatlasdepay->current_atlas = rtpatlasdepay->default_atlas;
+
   if (!gst_structure_get_int(structure, "clock-rate", &clock_rate))
     clock_rate = 90000;
   depayload->clock_rate = clock_rate;
@@ -520,10 +1633,13 @@ static gboolean gst_rtp_atlas_depay_setcaps(GstRTPBaseDepayload *depayload,
     gsize size;
     guchar *vps = g_base64_decode(vps_base64, &size);
 
-    rtpatlasdepay->vps = gst_buffer_new_allocate(NULL, size, NULL);
-    gst_buffer_map(rtpatlasdepay->vps, &map, GST_MAP_WRITE);
-    memcpy(map.data, vps, size);
-    gst_buffer_unmap(rtpatlasdepay->vps, &map);
+    /* v3c_parameter_set_length of the codec_data is 16 bits */
+    if (size > G_MAXUINT16)
+      GST_WARNING_OBJECT(rtpatlasdepay, "ignoring V3C parameter set of %"
+                         G_GSIZE_FORMAT " bytes", size);
+    else if (gst_rtp_atlas_depay_replace_buffer(&rtpatlasdepay->vps, vps, size))
+      gst_rtp_atlas_depay_mark_codec_data(rtpatlasdepay, V3CDCR_VPS_PART);
+    g_free(vps);
   }
 
   /* Base64 encoded, comma separated config NALs */
@@ -538,29 +1654,65 @@ static gboolean gst_rtp_atlas_depay_setcaps(GstRTPBaseDepayload *depayload,
     for (i = 0; params_base64[i]; i++) {
       gchar param_type = 0;
       guchar *param = g_base64_decode(params_base64[i], &size);
+
+      if (size < 2) {
+        GST_WARNING_OBJECT(rtpatlasdepay,
+                           "got too short Setup Unit on v3c-atlas-data");
+        g_free(param);
+        continue;
+      }
+
       param_type = (param[0] & 0x7E) >> 1;
-      if(param_type == GST_ATLAS_NAL_ASPS) {
-        GST_DEBUG_OBJECT(rtpatlasdepay, "got ASPS of size %ld on v3c-atlas-data",
-                         size);
-        GstBuffer *asps = gst_buffer_new_allocate(NULL, size, NULL);
-        gst_buffer_map(asps, &map, GST_MAP_WRITE);
-        memcpy(map.data, param, size);
-        gst_buffer_unmap(asps, &map);
-        g_ptr_array_add(rtpatlasdepay->asps, asps);
-
-      } else if (param_type == GST_ATLAS_NAL_AFPS) {
-        GST_DEBUG_OBJECT(rtpatlasdepay, "got AFPS of size %ld on v3c-atlas-data",
-                         size);
-        GstBuffer *afps = gst_buffer_new_allocate(NULL, size, NULL);
-        gst_buffer_map(afps, &map, GST_MAP_WRITE);
-        memcpy(map.data, param, size);
-        gst_buffer_unmap(afps, &map);
-        g_ptr_array_add(rtpatlasdepay->afps, afps);
+      if (NAL_TYPE_IS_PARAMETER_SET(param_type)) {
+        GST_DEBUG_OBJECT(rtpatlasdepay,
+                         "got parameter set %d of size %" G_GSIZE_FORMAT
+                         " on v3c-atlas-data",
+                         param_type, size);
+        if (gst_rtp_atlas_add_asps_afps_aaps(
+                GST_ELEMENT_CAST(rtpatlasdepay), atlas->asps,
+                atlas->afps, atlas->aaps,
+                gst_buffer_new_memdup(param, size)))
+          gst_rtp_atlas_depay_mark_codec_data(rtpatlasdepay, param_type);
       } else {
-        GST_WARNING_OBJECT(rtpatlasdepay, "got Setup Unit on v3c-atlas-data that is not implemented");
+        GST_WARNING_OBJECT(rtpatlasdepay, "got Setup Unit %d on v3c-atlas-data "
+                           "that is not a parameter set", param_type);
       }
+      g_free(param);
     }
+    g_strfreev(params_base64);
+  }
+
+  /* DONL is present in MRST or when NAL units may be reordered */
+  tx_mode = gst_structure_get_string(structure, "tx-mode");
+  if (!gst_structure_get_int(structure, "sprop-max-don-diff", &max_don_diff)) {
+    const gchar *str = gst_structure_get_string(structure, "sprop-max-don-diff");
+
+    max_don_diff = str ? atoi(str) : 0;
+  }
+  rtpatlasdepay->max_don_diff = CLAMP(max_don_diff, 0, 32767);
+  rtpatlasdepay->mrst = tx_mode && g_str_equal(tx_mode, "MRST");
+  rtpatlasdepay->donl_present = rtpatlasdepay->mrst || max_don_diff > 0;
+  GST_DEBUG_OBJECT(rtpatlasdepay, "DONL present %d, sprop-max-don-diff %u",
+                   rtpatlasdepay->donl_present, rtpatlasdepay->max_don_diff);
+
+  if (!gst_structure_get_int(structure, "v3c-tile-id-pres", &tile_id_pres)) {
+    const gchar *str = gst_structure_get_string(structure, "v3c-tile-id-pres");
+
+    tile_id_pres = str ? atoi(str) : 0;
   }
+  rtpatlasdepay->tile_id_pres = tile_id_pres == 1;
+
+  /* Base64 encoded, comma separated prefix and suffix SEI NALs */
+  sei_base64 = gst_structure_get_string(structure, "v3c-sei");
+  if (sei_base64)
+    gst_rtp_atlas_depay_set_units(rtpatlasdepay, &atlas->sei,
+                                  "v3c-sei", sei_base64);
+
+  /* Base64 encoded, comma separated CASPS and CAF_IDR NALs */
+  cad_base64 = gst_structure_get_string(structure, "v3c-common-atlas-data");
+  if (cad_base64)
+    gst_rtp_atlas_depay_set_units(rtpatlasdepay, &rtpatlasdepay->cad,
+                                  "v3c-common-atlas-data", cad_base64);
 
   vuh_base64 = gst_structure_get_string(structure, "v3c-unit-header");
   if (vuh_base64) {
@@ -569,13 +1721,46 @@ static gboolean gst_rtp_atlas_depay_setcaps(GstRTPBaseDepayload *depayload,
     if (size != 4) {
       GST_ERROR_OBJECT(rtpatlasdepay,
                        "V3C unit header size %" G_GSIZE_FORMAT "!= 4", size);
+      g_free(vuh);
       return TRUE;
     }
-    rtpatlasdepay->vuh = gst_buffer_new_allocate(NULL, size, NULL);
-    gst_buffer_map(rtpatlasdepay->vuh, &map, GST_MAP_WRITE);
-    memcpy(map.data, vuh, size);
-    gst_buffer_unmap(rtpatlasdepay->vuh, &map);
+    if (gst_rtp_atlas_depay_replace_buffer(&atlas->vuh, vuh, size))
+      atlas->new_codec_data = TRUE;
+    g_free(vuh);
+
+    rtpatlasdepay->default_atlas_id =
+        gst_vuh_data_get_atlas_id(atlas->vuh);
+    rtpatlasdepay->have_default_atlas_id = TRUE;
+  } else if (rtpatlasdepay->atlas_id >= 0) {
+    /* without V3C unit header the atlas-id property names the atlas of the
+     * always src pad */
+    rtpatlasdepay->default_atlas_id = rtpatlasdepay->atlas_id;
+    rtpatlasdepay->have_default_atlas_id = TRUE;
+    if (atlas->vuh == NULL) {
+      atlas->vuh = gst_rtp_atlas_depay_atlas_vuh(NULL, rtpatlasdepay->atlas_id);
+      atlas->new_codec_data = TRUE;
+    }
+  }
+
+  /* extmap-<id> = urn:x-v3c:atlas-id when the session carries several
+   * atlases */
+  rtpatlasdepay->atlas_id_ext_id = 0;
+  for (n = 0; n < gst_structure_n_fields(structure); n++) {
+    const gchar *name = gst_structure_nth_field_name(structure, n);
+    const gchar *uri;
+    gint ext_id;
+
+    if (!g_str_has_prefix(name, "extmap-"))
+      continue;
+
+    uri = gst_structure_get_string(structure, name);
+    ext_id = atoi(name + strlen("extmap-"));
+    if (uri && g_str_equal(uri, GST_RTP_ATLAS_ID_EXTMAP_URI) && ext_id >= 1 &&
+        ext_id <= 14)
+      rtpatlasdepay->atlas_id_ext_id = ext_id;
   }
+  GST_DEBUG_OBJECT(rtpatlasdepay, "atlas_id header extension id %u",
+                   rtpatlasdepay->atlas_id_ext_id);
 
   /* negotiate with downstream w.r.t. output format and alignment */
   gst_rtp_atlas_depay_negotiate(rtpatlasdepay);
@@ -586,13 +1771,14 @@ static gboolean gst_rtp_atlas_depay_setcaps(GstRTPBaseDepayload *depayload,
 static GstBuffer *
 gst_rtp_atlas_depay_allocate_output_buffer(GstRtpAtlasDepay *depay,
                                            gsize size) {
+  GstRtpAtlasDepayAtlas *atlas = depay->current_atlas;
   GstBuffer *buffer = NULL;
 
   g_return_val_if_fail(size > 0, NULL);
 
   GST_LOG_OBJECT(depay, "want output buffer of %u bytes", (guint)size);
 
-  buffer = gst_buffer_new_allocate(depay->allocator, size, &depay->params);
+  buffer = gst_buffer_new_allocate(atlas->allocator, size, &atlas->params);
   if (buffer == NULL) {
     GST_INFO_OBJECT(depay, "couldn't allocate output buffer");
     buffer = gst_buffer_new_allocate(NULL, size, NULL);
@@ -601,59 +1787,173 @@ gst_rtp_atlas_depay_allocate_output_buffer(GstRtpAtlasDepay *depay,
   return buffer;
 }
 
+/* NAL units are assembled with a 4 bytes length prefix, the output uses
+ * length_size bytes */
+static inline void gst_rtp_atlas_depay_write_nal_length(guint8 *data,
+                                                        guint length_size,
+                                                        guint32 nal_size) {
+  switch (length_size) {
+  case 1:
+    GST_WRITE_UINT8(data, nal_size);
+    break;
+  case 2:
+    GST_WRITE_UINT16_BE(data, nal_size);
+    break;
+  case 3:
+    GST_WRITE_UINT24_BE(data, nal_size);
+    break;
+  default:
+    GST_WRITE_UINT32_BE(data, nal_size);
+    break;
+  }
+}
+
+/* recording-mode: the access unit chains the memories of its NAL units
+ * behind length prefixes written to one shared memory, takes ownership of
+ * list */
+static GstBuffer *gst_rtp_atlas_depay_chain_au(GstRtpAtlasDepay *rtpatlasdepay,
+                                               GstBufferList *list,
+                                               guint length_size) {
+  guint b, n_bufs = gst_buffer_list_length(list);
+  GstBuffer *outbuf = gst_buffer_new();
+  GstMemory *prefixes;
+  GstMapInfo map;
+  gsize offset = 0;
+
+  prefixes = gst_allocator_alloc(NULL, MAX(n_bufs, 1) * length_size, NULL);
+  gst_memory_map(prefixes, &map, GST_MAP_WRITE);
+  for (b = 0; b < n_bufs; b++)
+    gst_rtp_atlas_depay_write_nal_length(
+        map.data + b * length_size, length_size,
+        gst_buffer_get_size(gst_buffer_list_get(list, b)) - 4);
+  gst_memory_unmap(prefixes, &map);
+
+  for (b = 0; b < n_bufs; b++) {
+    GstBuffer *buf = gst_buffer_list_get(list, b);
+    GstAtlasTileMeta *tile_meta;
+    gsize nal_size = gst_buffer_get_size(buf) - 4;
+
+    gst_buffer_append_memory(
+        outbuf, gst_memory_share(prefixes, b * length_size, length_size));
+    gst_buffer_copy_into(outbuf, buf, GST_BUFFER_COPY_MEMORY, 4, -1);
+
+    if (GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_CORRUPTED))
+      GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_CORRUPTED);
+
+    tile_meta = gst_buffer_get_atlas_tile_meta(buf);
+    if (tile_meta)
+      gst_buffer_add_atlas_tile_meta(outbuf, tile_meta->tile_id, offset,
+                                     length_size + nal_size);
+    offset += length_size + nal_size;
+  }
+  gst_memory_unref(prefixes);
+  gst_buffer_list_unref(list);
+
+  return outbuf;
+}
+
 static GstBuffer *gst_rtp_atlas_complete_au(GstRtpAtlasDepay *rtpatlasdepay,
                                             GstClockTime *out_timestamp,
                                             gboolean *out_keyframe) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
   GstBufferList *list;
   GstMapInfo outmap;
   GstBuffer *outbuf;
   guint outsize, offset = 0;
   gint b, n_bufs, m, n_mem;
+  gsize max_nal_size = 0;
+  guint length_size;
 
   /* we had a atlas frame in the adapter and we completed it */
   GST_DEBUG_OBJECT(rtpatlasdepay, "taking completed AU");
-  outsize = gst_adapter_available(rtpatlasdepay->atlas_frame_adapter);
+  outsize = gst_adapter_available(atlas->atlas_frame_adapter);
+  list =
+      gst_adapter_take_buffer_list(atlas->atlas_frame_adapter, outsize);
 
-  outbuf = gst_rtp_atlas_depay_allocate_output_buffer(rtpatlasdepay, outsize);
+  n_bufs = gst_buffer_list_length(list);
+  for (b = 0; b < n_bufs; ++b)
+    max_nal_size = MAX(max_nal_size,
+                       gst_buffer_get_size(gst_buffer_list_get(list, b)) - 4);
+  /* the size is signalled in codec_data, it does not change mid-stream */
+  length_size = rtpatlasdepay->nal_length_size;
+  if (length_size < 4 &&
+      max_nal_size >= G_GUINT64_CONSTANT(1) << (8 * length_size)) {
+    GST_ELEMENT_WARNING(rtpatlasdepay, STREAM, FORMAT, (NULL),
+                        ("NAL unit of %" G_GSIZE_FORMAT " bytes does not fit "
+                         "nal-length-size %u, dropping the access unit",
+                         max_nal_size, length_size));
+    gst_buffer_list_unref(list);
+    atlas->discont = TRUE;
+    outbuf = NULL;
+    goto done;
+  }
+  outsize -= n_bufs * (4 - length_size);
 
-  if (outbuf == NULL)
-    return NULL;
+  if (rtpatlasdepay->recording_mode) {
+    outbuf = gst_rtp_atlas_depay_chain_au(rtpatlasdepay, list, length_size);
+    goto done;
+  }
 
-  if (!gst_buffer_map(outbuf, &outmap, GST_MAP_WRITE))
-    return NULL;
+  outbuf = gst_rtp_atlas_depay_allocate_output_buffer(rtpatlasdepay, outsize);
 
-  list =
-      gst_adapter_take_buffer_list(rtpatlasdepay->atlas_frame_adapter, outsize);
+  if (outbuf == NULL || !gst_buffer_map(outbuf, &outmap, GST_MAP_WRITE)) {
+    gst_clear_buffer(&outbuf);
+    gst_buffer_list_unref(list);
+    return NULL;
+  }
 
-  n_bufs = gst_buffer_list_length(list);
   for (b = 0; b < n_bufs; ++b) {
     GstBuffer *buf = gst_buffer_list_get(list, b);
+    GstAtlasTileMeta *tile_meta;
+    gsize nal_size = gst_buffer_get_size(buf) - 4;
+    guint nal_offset = offset;
+    gsize skip = 4;
 
+    gst_rtp_atlas_depay_write_nal_length(outmap.data + offset, length_size,
+                                         nal_size);
+    offset += length_size;
+
+    /* copy the NAL unit behind the 4 bytes prefix it was assembled with */
     n_mem = gst_buffer_n_memory(buf);
     for (m = 0; m < n_mem; ++m) {
       GstMemory *mem = gst_buffer_peek_memory(buf, m);
       gsize mem_size = gst_memory_get_sizes(mem, NULL, NULL);
       GstMapInfo mem_map;
 
+      if (skip >= mem_size) {
+        skip -= mem_size;
+        continue;
+      }
+
       if (gst_memory_map(mem, &mem_map, GST_MAP_READ)) {
-        memcpy(outmap.data + offset, mem_map.data, mem_size);
+        memcpy(outmap.data + offset, mem_map.data + skip, mem_size - skip);
         gst_memory_unmap(mem, &mem_map);
       } else {
-        memset(outmap.data + offset, 0, mem_size);
+        memset(outmap.data + offset, 0, mem_size - skip);
       }
-      offset += mem_size;
+      offset += mem_size - skip;
+      skip = 0;
     }
 
+    if (GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_CORRUPTED))
+      GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_CORRUPTED);
+
+    tile_meta = gst_buffer_get_atlas_tile_meta(buf);
+    if (tile_meta)
+      gst_buffer_add_atlas_tile_meta(outbuf, tile_meta->tile_id, nal_offset,
+                                     length_size + nal_size);
+
     gst_rtp_copy_video_meta(rtpatlasdepay, outbuf, buf);
   }
   gst_buffer_list_unref(list);
   gst_buffer_unmap(outbuf, &outmap);
 
-  *out_timestamp = rtpatlasdepay->last_ts;
-  *out_keyframe = rtpatlasdepay->last_keyframe;
+done:
+  *out_timestamp = atlas->last_ts;
+  *out_keyframe = atlas->last_keyframe;
 
-  rtpatlasdepay->last_keyframe = FALSE;
-  rtpatlasdepay->atlas_frame_start = FALSE;
+  atlas->last_keyframe = FALSE;
+  atlas->atlas_frame_start = FALSE;
 
   return outbuf;
 }
@@ -661,10 +1961,6 @@ static GstBuffer *gst_rtp_atlas_complete_au(GstRtpAtlasDepay *rtpatlasdepay,
 /* ASPS/AFPS/AAPS/RADL/TSA/RASL/IDR/CRA is considered key, all others DELTA;
  * so downstream waiting for keyframe can pick up at ASPS/AFPS/AAPS/IDR */
 
-#define NAL_TYPE_IS_PARAMETER_SET(nt)                                          \
-  (((nt) == GST_ATLAS_NAL_ASPS) || ((nt) == GST_ATLAS_NAL_AFPS) ||             \
-   ((nt) == GST_ATLAS_NAL_AAPS))
-
 #define NAL_TYPE_IS_CODED_ATLAS_TILE_SEGMENT(nt)                               \
   (((nt) == GST_ATLAS_NAL_TRAIL_N) || ((nt) == GST_ATLAS_NAL_TRAIL_R) ||       \
    ((nt) == GST_ATLAS_NAL_TSA_N) || ((nt) == GST_ATLAS_NAL_TSA_R) ||           \
@@ -681,61 +1977,374 @@ static GstBuffer *gst_rtp_atlas_complete_au(GstRtpAtlasDepay *rtpatlasdepay,
 /* Intra random access point */
 #define NAL_TYPE_IS_IRAP(nt)                                                   \
   (((nt) == GST_ATLAS_NAL_BLA_W_LP) || ((nt) == GST_ATLAS_NAL_BLA_W_RADL) ||   \
-   ((nt) == GST_ATLAS_NAL_BLA_N_LP) || ((nt) == GST_ATLAS_NAL_IDR_W_RADL) ||   \
-   ((nt) == GST_ATLAS_NAL_IDR_N_LP) || ((nt) == GST_ATLAS_NAL_CRA))
+   ((nt) == GST_ATLAS_NAL_BLA_N_LP) || ((nt) == GST_ATLAS_NAL_GBLA_W_LP) ||    \
+   ((nt) == GST_ATLAS_NAL_GBLA_W_RADL) || ((nt) == GST_ATLAS_NAL_GBLA_N_LP) || \
+   ((nt) == GST_ATLAS_NAL_IDR_W_RADL) || ((nt) == GST_ATLAS_NAL_IDR_N_LP) ||   \
+   ((nt) == GST_ATLAS_NAL_GIDR_W_RADL) || ((nt) == GST_ATLAS_NAL_GIDR_N_LP) || \
+   ((nt) == GST_ATLAS_NAL_CRA) || ((nt) == GST_ATLAS_NAL_GCRA) ||             \
+   ((nt) == GST_ATLAS_NAL_CAF_IDR))
+
+/* NAL units that may precede the first ACL NAL unit of an access unit */
+#define NAL_TYPE_IS_AU_PREFIX(nt)                                              \
+  (((nt) == GST_ATLAS_NAL_AUD) || ((nt) == GST_ATLAS_NAL_V3C_AUD) ||           \
+   ((nt) == GST_ATLAS_NAL_PREFIX_NSEI) || ((nt) == GST_ATLAS_NAL_PREFIX_ESEI))
 
 #define NAL_TYPE_IS_KEY(nt)                                                    \
-  (NAL_TYPE_IS_PARAMETER_SET(nt) || NAL_TYPE_IS_IRAP(nt))
+  (NAL_TYPE_IS_PARAMETER_SET(nt) || NAL_TYPE_IS_IRAP(nt) ||                   \
+   ((nt) == GST_ATLAS_NAL_CASPS))
+
+/* src_%u pads follow the segment of the always src pad */
+static void gst_rtp_atlas_depay_push_atlas_segment(GstRtpAtlasDepay *rtpatlasdepay) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
+  GstEvent *segment;
+
+  segment = gst_pad_get_sticky_event(GST_RTP_BASE_DEPAYLOAD_SRCPAD(rtpatlasdepay),
+                                     GST_EVENT_SEGMENT, 0);
+  if (segment == NULL) {
+    if (atlas->segment != NULL)
+      return;
+    segment =
+        gst_event_new_segment(&GST_RTP_BASE_DEPAYLOAD(rtpatlasdepay)->segment);
+  }
+
+  if (segment != atlas->segment) {
+    gst_event_replace(&atlas->segment, segment);
+    gst_rtp_atlas_depay_atlas_output(atlas->srcpad,
+                                     GST_MINI_OBJECT_CAST(gst_event_ref(segment)));
+  }
+  gst_event_unref(segment);
+}
 
 static void gst_rtp_atlas_depay_push(GstRtpAtlasDepay *rtpatlasdepay,
                                      GstBuffer *outbuf, gboolean keyframe,
                                      GstClockTime timestamp, gboolean marker) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
+  gboolean corrupted =
+      GST_BUFFER_FLAG_IS_SET(outbuf, GST_BUFFER_FLAG_CORRUPTED);
+
+  /* parameter sets received in-band changed, update codec_data first */
+  if (G_UNLIKELY(atlas->new_codec_data) &&
+      !gst_rtp_atlas_set_src_caps(rtpatlasdepay))
+    GST_WARNING_OBJECT(rtpatlasdepay, "failed to update codec_data");
+
   /* prepend codec_data */
-  if (rtpatlasdepay->codec_data) {
+  if (atlas->codec_data) {
     GST_DEBUG_OBJECT(rtpatlasdepay, "prepending codec_data");
-    gst_rtp_copy_video_meta(rtpatlasdepay, rtpatlasdepay->codec_data, outbuf);
-    outbuf = gst_buffer_append(rtpatlasdepay->codec_data, outbuf);
-    rtpatlasdepay->codec_data = NULL;
+    gst_rtp_copy_video_meta(rtpatlasdepay, atlas->codec_data, outbuf);
+    outbuf = gst_buffer_append(atlas->codec_data, outbuf);
+    atlas->codec_data = NULL;
     keyframe = TRUE;
   }
-  outbuf = gst_buffer_make_writable(outbuf);
+  outbuf = gst_buffer_make_writable(outbuf);
+
+  if (rtpatlasdepay->recording_mode) {
+    /* one sample per access unit, decoded in the order it is sent */
+    GST_BUFFER_DTS(outbuf) = timestamp;
+    marker = TRUE;
+  } else {
+    gst_rtp_drop_non_video_meta(rtpatlasdepay, outbuf);
+  }
+
+  GST_BUFFER_PTS(outbuf) = timestamp;
+
+  if (keyframe)
+    GST_BUFFER_FLAG_UNSET(outbuf, GST_BUFFER_FLAG_DELTA_UNIT);
+  else
+    GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  if (marker)
+    GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_MARKER);
+
+  if (corrupted)
+    GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_CORRUPTED);
+
+  if (atlas->discont) {
+    GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_DISCONT);
+    atlas->discont = FALSE;
+  }
+
+  if (atlas != rtpatlasdepay->default_atlas) {
+    gst_rtp_atlas_depay_push_atlas_segment(rtpatlasdepay);
+    gst_rtp_atlas_depay_atlas_output(atlas->srcpad,
+                                     GST_MINI_OBJECT_CAST(outbuf));
+    return;
+  }
+
+  gst_rtp_base_depayload_push(GST_RTP_BASE_DEPAYLOAD(rtpatlasdepay), outbuf);
+}
+
+/* NAL units above max-temporal-id are dropped. The sub-layer switching
+ * points are followed in decoding order */
+static gboolean
+gst_rtp_atlas_depay_temporal_id_wanted(GstRtpAtlasDepay *rtpatlasdepay,
+                                       guint8 nal_type,
+                                       guint8 temporal_id_plus1) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
+
+  if (gst_atlas_nal_temporal_id_allowed(nal_type, temporal_id_plus1,
+                                        rtpatlasdepay->max_temporal_id,
+                                        &atlas->temporal_id_limit))
+    return TRUE;
+
+  GST_LOG_OBJECT(rtpatlasdepay, "dropping NAL type %u of temporal id %u",
+                 nal_type, temporal_id_plus1 - 1);
+  return FALSE;
+}
+
+/* For tile selection only coded atlas tile NAL units are dropped,
+ * everything else is needed to decode the selected tiles. With DONL the
+ * temporal id is checked once the NAL unit leaves the de-interleaving
+ * buffer */
+static gboolean gst_rtp_atlas_depay_nal_wanted(GstRtpAtlasDepay *rtpatlasdepay,
+                                               guint8 nal_type,
+                                               guint8 temporal_id_plus1,
+                                               guint16 tile_id) {
+  gboolean wanted;
+  guint i;
+
+  if (!rtpatlasdepay->donl_present &&
+      !gst_rtp_atlas_depay_temporal_id_wanted(rtpatlasdepay, nal_type,
+                                              temporal_id_plus1))
+    return FALSE;
+
+  if (!rtpatlasdepay->tile_id_pres ||
+      !NAL_TYPE_IS_CODED_ATLAS_TILE_SEGMENT(nal_type))
+    return TRUE;
+
+  GST_OBJECT_LOCK(rtpatlasdepay);
+  wanted = rtpatlasdepay->tile_ids->len == 0;
+  for (i = 0; !wanted && i < rtpatlasdepay->tile_ids->len; i++)
+    wanted = g_array_index(rtpatlasdepay->tile_ids, guint16, i) == tile_id;
+  GST_OBJECT_UNLOCK(rtpatlasdepay);
+
+  if (!wanted)
+    GST_LOG_OBJECT(rtpatlasdepay, "dropping NAL type %u of tile %u", nal_type,
+                   tile_id);
+
+  return wanted;
+}
+
+/* The NAL unit carrying the marker was dropped, outputs what was
+ * assembled. Returns FALSE when no access unit was started */
+static gboolean gst_rtp_atlas_depay_finish_au(GstRtpAtlasDepay *rtpatlasdepay) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
+  GstClockTime timestamp;
+  gboolean keyframe;
+  GstBuffer *outbuf;
+
+  if (!atlas->atlas_frame_start)
+    return FALSE;
+
+  outbuf = gst_rtp_atlas_complete_au(rtpatlasdepay, &timestamp, &keyframe);
+  if (outbuf)
+    gst_rtp_atlas_depay_push(rtpatlasdepay, outbuf, keyframe, timestamp, TRUE);
+
+  return TRUE;
+}
+
+/* With DONL the decoding order is not known when a packet is dropped, the
+ * AU then completes at the next boundary */
+static void gst_rtp_atlas_depay_marker_dropped(GstRtpAtlasDepay *rtpatlasdepay) {
+  if (!rtpatlasdepay->donl_present)
+    gst_rtp_atlas_depay_finish_au(rtpatlasdepay);
+}
+
+/* Sends GstForceKeyUnit upstream, rtpbin turns it into RTCP PLI/FIR. The
+ * event is built by hand as the plugin does not link to gstreamer-video */
+static void gst_rtp_atlas_depay_request_keyframe(GstRtpAtlasDepay *rtpatlasdepay) {
+  GstEvent *event;
+  gint64 now;
+
+  if (!rtpatlasdepay->request_keyframe)
+    return;
+
+  now = g_get_monotonic_time();
+  if (rtpatlasdepay->last_keyframe_request != -1 &&
+      now - rtpatlasdepay->last_keyframe_request <
+          rtpatlasdepay->request_keyframe_interval * G_TIME_SPAN_MILLISECOND) {
+    GST_LOG_OBJECT(rtpatlasdepay, "keyframe requested recently, skipping");
+    return;
+  }
+  rtpatlasdepay->last_keyframe_request = now;
+
+  GST_DEBUG_OBJECT(rtpatlasdepay, "requesting keyframe");
+  event = gst_event_new_custom(
+      GST_EVENT_CUSTOM_UPSTREAM,
+      gst_structure_new("GstForceKeyUnit", "running-time", GST_TYPE_CLOCK_TIME,
+                        GST_CLOCK_TIME_NONE, "all-headers", G_TYPE_BOOLEAN,
+                        TRUE, "count", G_TYPE_UINT, 0, NULL));
+  gst_pad_push_event(GST_RTP_BASE_DEPAYLOAD_SINKPAD(rtpatlasdepay), event);
+}
 
-  gst_rtp_drop_non_video_meta(rtpatlasdepay, outbuf);
+static void
+gst_rtp_atlas_depay_push_setup_units(GstRtpAtlasDepay *rtpatlasdepay,
+                                     guint8 nal_unit_type) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
+  GPtrArray *units;
+  guint i;
+
+  units = gst_rtp_atlas_depay_get_setup_units(rtpatlasdepay, nal_unit_type);
+  for (i = 0; i < units->len; i++) {
+    GstBuffer *unit = g_ptr_array_index(units, i);
+    GstBuffer *nal;
+    GstMapInfo map;
+    guint8 header;
 
-  GST_BUFFER_PTS(outbuf) = timestamp;
+    gst_buffer_extract(unit, 0, &header, 1);
+    if (((header >> 1) & 0x3f) != nal_unit_type)
+      continue;
 
-  if (keyframe)
-    GST_BUFFER_FLAG_UNSET(outbuf, GST_BUFFER_FLAG_DELTA_UNIT);
-  else
-    GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_DELTA_UNIT);
+    /* stored without the length prefix */
+    nal = gst_buffer_new_allocate(NULL, 4, NULL);
+    gst_buffer_map(nal, &map, GST_MAP_WRITE);
+    GST_WRITE_UINT32_BE(map.data, gst_buffer_get_size(unit));
+    gst_buffer_unmap(nal, &map);
 
-  if (marker)
-    GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_MARKER);
+    gst_adapter_push(atlas->atlas_frame_adapter,
+                     gst_buffer_append(nal, gst_buffer_ref(unit)));
+  }
+}
 
-  gst_rtp_base_depayload_push(GST_RTP_BASE_DEPAYLOAD(rtpatlasdepay), outbuf);
+/* Puts the cached ASPS/AFPS/AAPS, or the CASPS for a common atlas frame,
+ * in front of the prefix NAL units collected for the first decodable
+ * access unit */
+static void
+gst_rtp_atlas_depay_start_keyframe(GstRtpAtlasDepay *rtpatlasdepay,
+                                   guint8 nal_type) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
+  GstBufferList *prefix = NULL;
+  guint avail, i;
+
+  GST_DEBUG_OBJECT(rtpatlasdepay, "got IRAP %u, inserting %u ASPS, %u AFPS, "
+                   "%u AAPS or the CASPS", nal_type, atlas->asps->len,
+                   atlas->afps->len, atlas->aaps->len);
+
+  avail = gst_adapter_available(atlas->atlas_frame_adapter);
+  if (avail)
+    prefix = gst_adapter_take_buffer_list(atlas->atlas_frame_adapter,
+                                          avail);
+
+  if (nal_type == GST_ATLAS_NAL_CAF_IDR) {
+    gst_rtp_atlas_depay_push_setup_units(rtpatlasdepay, GST_ATLAS_NAL_CASPS);
+  } else {
+    gst_rtp_atlas_depay_push_setup_units(rtpatlasdepay, GST_ATLAS_NAL_ASPS);
+    gst_rtp_atlas_depay_push_setup_units(rtpatlasdepay, GST_ATLAS_NAL_AFPS);
+    gst_rtp_atlas_depay_push_setup_units(rtpatlasdepay, GST_ATLAS_NAL_AAPS);
+  }
+
+  if (prefix) {
+    for (i = 0; i < gst_buffer_list_length(prefix); i++)
+      gst_adapter_push(atlas->atlas_frame_adapter,
+                       gst_buffer_ref(gst_buffer_list_get(prefix, i)));
+    gst_buffer_list_unref(prefix);
+  }
+
+  atlas->waiting_for_keyframe = FALSE;
+  /* the RASL NAL units following a CRA reference atlas frames before it */
+  atlas->skip_rasl =
+      nal_type == GST_ATLAS_NAL_CRA || nal_type == GST_ATLAS_NAL_GCRA;
 }
 
 static void gst_rtp_atlas_depay_handle_nal(GstRtpAtlasDepay *rtpatlasdepay,
                                            GstBuffer *nal,
                                            GstClockTime in_timestamp,
                                            gboolean marker) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
   GstRTPBaseDepayload *depayload = GST_RTP_BASE_DEPAYLOAD(rtpatlasdepay);
   gint nal_type;
-  GstMapInfo map;
+  guint8 header[3] = {0, 0, 0};
+  gsize size;
   GstBuffer *outbuf = NULL;
   GstClockTime out_timestamp;
   gboolean keyframe, out_keyframe;
 
-  gst_buffer_map(nal, &map, GST_MAP_READ);
-  if (G_UNLIKELY(map.size < 5))
+  /* NAL units may chain the memory of RTP packets, only the header and the
+   * first byte after it are read */
+  size = gst_buffer_get_size(nal);
+  if (G_UNLIKELY(size < 5))
     goto short_nal;
+  gst_buffer_extract(nal, 4, header, sizeof header);
 
-  nal_type = (map.data[4] >> 1) & 0x3f;
+  nal_type = (header[0] >> 1) & 0x3f;
   GST_DEBUG_OBJECT(rtpatlasdepay, "handle NAL type %d (RTP marker bit %d)",
                    nal_type, marker);
 
+  /* NAL units are in decoding order here when DONL is present */
+  if (rtpatlasdepay->donl_present &&
+      !gst_rtp_atlas_depay_temporal_id_wanted(rtpatlasdepay, nal_type,
+                                              header[1] & 0x07)) {
+    gst_buffer_unref(nal);
+    if (marker)
+      gst_rtp_atlas_depay_finish_au(rtpatlasdepay);
+    return;
+  }
+
   keyframe = NAL_TYPE_IS_KEY(nal_type);
 
+  /* keep the parameter sets for codec_data, they are also kept in-band */
+  if (NAL_TYPE_IS_PARAMETER_SET(nal_type)) {
+    if (gst_rtp_atlas_add_asps_afps_aaps(
+            GST_ELEMENT_CAST(rtpatlasdepay), atlas->asps,
+            atlas->afps, atlas->aaps,
+            gst_buffer_copy_region(nal, GST_BUFFER_COPY_ALL, 4,
+                                   size - 4))) {
+      GST_DEBUG_OBJECT(rtpatlasdepay, "parameter set %d changed", nal_type);
+      gst_rtp_atlas_depay_mark_codec_data(rtpatlasdepay, nal_type);
+    }
+  } else if (nal_type == GST_ATLAS_NAL_CASPS ||
+             nal_type == GST_ATLAS_NAL_CAF_IDR) {
+    if (gst_rtp_atlas_depay_store_cad(
+            rtpatlasdepay, nal_type,
+            gst_buffer_copy_region(nal, GST_BUFFER_COPY_ALL, 4,
+                                   size - 4))) {
+      GST_DEBUG_OBJECT(rtpatlasdepay, "common atlas data %d changed",
+                       nal_type);
+      gst_rtp_atlas_depay_mark_codec_data(rtpatlasdepay, nal_type);
+    }
+  }
+
+  /* output started at a CRA or GCRA, its RASL atlas frames cannot be
+   * decoded. Skipping ends at the first ACL NAL unit of the next atlas
+   * frame that is not RASL */
+  if (G_UNLIKELY(atlas->skip_rasl) &&
+      NAL_TYPE_IS_CODED_ATLAS_TILE_SEGMENT(nal_type)) {
+    if (nal_type == GST_ATLAS_NAL_RASL_N || nal_type == GST_ATLAS_NAL_RASL_R) {
+      GST_DEBUG_OBJECT(rtpatlasdepay, "dropping RASL NAL type %d", nal_type);
+      gst_buffer_unref(nal);
+      if (marker && !gst_rtp_atlas_depay_finish_au(rtpatlasdepay))
+        gst_adapter_clear(atlas->atlas_frame_adapter);
+      return;
+    }
+    if ((header[2] >> 7) & 0x01)
+      atlas->skip_rasl = FALSE;
+  }
+
+  if (G_UNLIKELY(atlas->waiting_for_keyframe)) {
+    if (NAL_TYPE_IS_IRAP(nal_type)) {
+      gst_rtp_atlas_depay_start_keyframe(rtpatlasdepay, nal_type);
+    } else {
+      /* the cached parameter sets are inserted at the IRAP, of the other
+       * non-ACL NAL units only the prefix of the next access unit is kept */
+      if (NAL_TYPE_IS_CODED_ATLAS_TILE_SEGMENT(nal_type) ||
+          nal_type == GST_ATLAS_NAL_AUD || nal_type == GST_ATLAS_NAL_V3C_AUD)
+        gst_adapter_clear(atlas->atlas_frame_adapter);
+
+      if (NAL_TYPE_IS_AU_PREFIX(nal_type) && !marker) {
+        gst_adapter_push(atlas->atlas_frame_adapter, nal);
+        return;
+      }
+
+      GST_DEBUG_OBJECT(rtpatlasdepay, "waiting for IRAP, dropping NAL type %d",
+                       nal_type);
+      if (NAL_TYPE_IS_CODED_ATLAS_TILE_SEGMENT(nal_type))
+        gst_rtp_atlas_depay_request_keyframe(rtpatlasdepay);
+      if (marker)
+        gst_adapter_clear(atlas->atlas_frame_adapter);
+      gst_buffer_unref(nal);
+      return;
+    }
+  }
+
   out_keyframe = keyframe;
   out_timestamp = in_timestamp;
 
@@ -748,31 +2357,34 @@ static void gst_rtp_atlas_depay_handle_nal(GstRtpAtlasDepay *rtpatlasdepay,
        * (Y) has the high-order bit of the first byte after its NAL unit
        * header equal to 1 */
       start = TRUE;
-      if (((map.data[6] >> 7) & 0x01) == 1) {
+      if (((header[2] >> 7) & 0x01) == 1) {
         complete = TRUE;
       }
     } else if ((nal_type >= GST_ATLAS_NAL_ASPS &&
                 nal_type <= GST_ATLAS_NAL_AUD) ||
                nal_type == GST_ATLAS_NAL_PREFIX_NSEI ||
                nal_type == GST_ATLAS_NAL_PREFIX_ESEI ||
-               nal_type == GST_ATLAS_NAL_AAPS ) {
+               nal_type == GST_ATLAS_NAL_AAPS ||
+               nal_type == GST_ATLAS_NAL_CASPS) {
       /* ASPS, AFPS, AAPS, SEI, ... terminate an access unit */
       complete = TRUE;
+    } else if (NAL_TYPE_IS_CAF(nal_type)) {
+      /* a common atlas frame is an access unit of its own */
+      start = TRUE;
+      complete = TRUE;
     }
     GST_DEBUG_OBJECT(depayload, "start %d, complete %d", start, complete);
 
-    if (complete && rtpatlasdepay->atlas_frame_start)
+    if (complete && atlas->atlas_frame_start)
       outbuf = gst_rtp_atlas_complete_au(rtpatlasdepay, &out_timestamp,
                                          &out_keyframe);
   }
   /* add to adapter */
-  gst_buffer_unmap(nal, &map);
-
   GST_DEBUG_OBJECT(depayload, "adding NAL to atlas frame adapter");
-  gst_adapter_push(rtpatlasdepay->atlas_frame_adapter, nal);
-  rtpatlasdepay->last_ts = in_timestamp;
-  rtpatlasdepay->last_keyframe |= keyframe;
-  rtpatlasdepay->atlas_frame_start |= start;
+  gst_adapter_push(atlas->atlas_frame_adapter, nal);
+  atlas->last_ts = in_timestamp;
+  atlas->last_keyframe |= keyframe;
+  atlas->atlas_frame_start |= start;
 
   if (marker)
     outbuf =
@@ -782,56 +2394,406 @@ static void gst_rtp_atlas_depay_handle_nal(GstRtpAtlasDepay *rtpatlasdepay,
                              marker);
   }
 
+  if (NAL_TYPE_IS_CAF(nal_type) && !marker) {
+    outbuf =
+        gst_rtp_atlas_complete_au(rtpatlasdepay, &out_timestamp, &out_keyframe);
+    if (outbuf)
+      gst_rtp_atlas_depay_push(rtpatlasdepay, outbuf, out_keyframe,
+                               out_timestamp, TRUE);
+  }
+
   return;
 
   /* ERRORS */
 short_nal : {
   GST_WARNING_OBJECT(depayload, "dropping short NAL");
-  gst_buffer_unmap(nal, &map);
   gst_buffer_unref(nal);
   return;
 }
 }
 
+/* Hands the NAL unit with the lowest DON to AU assembly */
+static void gst_rtp_atlas_depay_release_don_nal(GstRtpAtlasDepay *rtpatlasdepay) {
+  GstRtpAtlasDonNal *item;
+  GstRtpAtlasDepayAtlas *atlas, *current;
+  GstBuffer *nal;
+  GstClockTime timestamp;
+  gboolean marker;
+
+  item = &g_array_index(rtpatlasdepay->don_queue, GstRtpAtlasDonNal, 0);
+  nal = g_steal_pointer(&item->nal);
+  timestamp = item->timestamp;
+  marker = item->marker;
+  atlas = item->atlas;
+  rtpatlasdepay->last_out_abs_don = item->abs_don;
+  g_array_remove_index(rtpatlasdepay->don_queue, 0);
+
+  /* the DON is shared by the atlases of the session */
+  current = rtpatlasdepay->current_atlas;
+  rtpatlasdepay->current_atlas = atlas;
+  gst_rtp_atlas_depay_handle_nal(rtpatlasdepay, nal, timestamp, marker);
+  rtpatlasdepay->current_atlas = current;
+}
+
+static void gst_rtp_atlas_depay_flush_don_queue(GstRtpAtlasDepay *rtpatlasdepay) {
+  while (rtpatlasdepay->don_queue->len > 0)
+    gst_rtp_atlas_depay_release_don_nal(rtpatlasdepay);
+}
+
+/* De-interleaving buffer: NAL units are kept sorted by DON and released
+ * once the DON span exceeds sprop-max-don-diff */
+static void gst_rtp_atlas_depay_queue_nal(GstRtpAtlasDepay *rtpatlasdepay,
+                                          GstBuffer *nal, guint16 don,
+                                          GstClockTime timestamp,
+                                          gboolean marker) {
+  GstRtpAtlasDonNal item;
+  GArray *queue = rtpatlasdepay->don_queue;
+  gint64 abs_don;
+  guint i;
+
+  if (!rtpatlasdepay->donl_present) {
+    gst_rtp_atlas_depay_handle_nal(rtpatlasdepay, nal, timestamp, marker);
+    return;
+  }
+
+  /* unwrap the 16 bit DON around the last seen one */
+  if (rtpatlasdepay->have_don)
+    abs_don = rtpatlasdepay->last_abs_don +
+              (gint16)(don - (guint16)rtpatlasdepay->last_abs_don);
+  else
+    abs_don = don;
+  if (!rtpatlasdepay->have_don || abs_don > rtpatlasdepay->last_abs_don)
+    rtpatlasdepay->last_abs_don = abs_don;
+
+  if (rtpatlasdepay->have_don && abs_don <= rtpatlasdepay->last_out_abs_don) {
+    GST_WARNING_OBJECT(rtpatlasdepay, "NAL unit with DON %u arrived after "
+                       "later ones were output", don);
+    gst_rtp_atlas_depay_handle_nal(rtpatlasdepay, nal, timestamp, marker);
+    return;
+  }
+  if (!rtpatlasdepay->have_don) {
+    rtpatlasdepay->last_out_abs_don = abs_don - 1;
+    rtpatlasdepay->have_don = TRUE;
+  }
+
+  GST_LOG_OBJECT(rtpatlasdepay, "queueing NAL unit with DON %u", don);
+
+  item.nal = nal;
+  item.abs_don = abs_don;
+  item.timestamp = timestamp;
+  item.marker = marker;
+  item.atlas = rtpatlasdepay->current_atlas;
+
+  /* mostly in order, search from the end */
+  for (i = queue->len; i > 0; i--) {
+    if (g_array_index(queue, GstRtpAtlasDonNal, i - 1).abs_don <= abs_don)
+      break;
+  }
+  g_array_insert_val(queue, i, item);
+
+  while (queue->len > 0 &&
+         g_array_index(queue, GstRtpAtlasDonNal, queue->len - 1).abs_don -
+                 g_array_index(queue, GstRtpAtlasDonNal, 0).abs_don >
+             rtpatlasdepay->max_don_diff)
+    gst_rtp_atlas_depay_release_don_nal(rtpatlasdepay);
+
+  /* nothing can precede the next NAL unit in decoding order */
+  while (queue->len > 0 &&
+         g_array_index(queue, GstRtpAtlasDonNal, 0).abs_don ==
+             rtpatlasdepay->last_out_abs_don + 1)
+    gst_rtp_atlas_depay_release_don_nal(rtpatlasdepay);
+}
+
+/* Starts the reassembly buffer of a Fragmentation Unit with the 4 bytes
+ * length prefix and the first fragment, sized from the running estimate of
+ * the NAL unit type so that the following fragments are usually copied in
+ * place without growing it */
+static void
+gst_rtp_atlas_depay_start_fragmentation_unit(GstRtpAtlasDepay *rtpatlasdepay,
+                                             guint8 fu_type, guint16 nal_header,
+                                             const guint8 *data, gsize size) {
+  GstRtpAtlasDepayFu *fu = rtpatlasdepay->current_atlas->fu;
+  gsize estimate = rtpatlasdepay->fu_size_estimate[fu_type];
+  GstMapInfo map;
+
+  gst_clear_buffer(&fu->buffer);
+  fu->buffer = gst_buffer_new_allocate(
+      NULL, MAX(6 + size, estimate + estimate / 4), NULL);
+  fu->size = 6 + size;
+
+  gst_buffer_map(fu->buffer, &map, GST_MAP_WRITE);
+  GST_WRITE_UINT16_BE(map.data + 4, nal_header);
+  memcpy(map.data + 6, data, size);
+  gst_buffer_unmap(fu->buffer, &map);
+}
+
+/* Copies a following fragment behind the data of the reassembly buffer,
+ * which grows geometrically when the estimate was too small */
+static void
+gst_rtp_atlas_depay_append_fragment(GstRtpAtlasDepay *rtpatlasdepay,
+                                    const guint8 *data, gsize size) {
+  GstRtpAtlasDepayFu *fu = rtpatlasdepay->current_atlas->fu;
+  GstBuffer *fu_buffer = fu->buffer;
+  gsize capacity = gst_buffer_get_size(fu_buffer);
+
+  if (fu->size + size > capacity) {
+    GstMemory *mem;
+    GstMapInfo map;
+
+    capacity = MAX(capacity * 2, fu->size + size);
+    GST_LOG_OBJECT(rtpatlasdepay, "growing reassembly buffer to %" G_GSIZE_FORMAT,
+                   capacity);
+    mem = gst_allocator_alloc(NULL, capacity, NULL);
+    gst_memory_map(mem, &map, GST_MAP_WRITE);
+    gst_buffer_extract(fu_buffer, 0, map.data, fu->size);
+    gst_memory_unmap(mem, &map);
+    gst_buffer_replace_all_memory(fu_buffer, mem);
+  }
+
+  gst_buffer_fill(fu_buffer, fu->size, data, size);
+  fu->size += size;
+}
+
+/* a truncated NAL unit gets the F bit set and GST_BUFFER_FLAG_CORRUPTED */
 static void
-gst_rtp_atlas_finish_fragmentation_unit(GstRtpAtlasDepay *rtpatlasdepay) {
+gst_rtp_atlas_finish_fragmentation_unit(GstRtpAtlasDepay *rtpatlasdepay,
+                                        gboolean truncated) {
+  GstRtpAtlasDepayFu *fu = rtpatlasdepay->current_atlas->fu;
   guint outsize;
   GstMapInfo map;
   GstBuffer *outbuf;
+  guint8 nal_type;
 
-  outsize = gst_adapter_available(rtpatlasdepay->adapter);
-  g_assert(outsize >= 4);
+  g_assert(fu->buffer != NULL);
 
-  outbuf = gst_adapter_take_buffer(rtpatlasdepay->adapter, outsize);
+  outsize = fu->size;
+  outbuf = g_steal_pointer(&fu->buffer);
+  gst_buffer_set_size(outbuf, outsize);
 
+  /* the length prefix is written in place */
   gst_buffer_map(outbuf, &map, GST_MAP_WRITE);
   GST_DEBUG_OBJECT(rtpatlasdepay, "output %d bytes", outsize);
   GST_WRITE_UINT32_BE(map.data, outsize - 4);
+  if (truncated)
+    map.data[4] |= 0x80;
+  nal_type = (map.data[4] >> 1) & 0x3f;
   gst_buffer_unmap(outbuf, &map);
 
-  rtpatlasdepay->current_fu_type = 0;
+  /* running average of the NAL unit sizes of that type */
+  if (!truncated)
+    rtpatlasdepay->fu_size_estimate[nal_type] =
+        (rtpatlasdepay->fu_size_estimate[nal_type] * 3 + outsize) / 4;
+
+  if (truncated)
+    GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_CORRUPTED);
+
+  fu->type = 0;
+
+  if (rtpatlasdepay->tile_id_pres)
+    gst_buffer_add_atlas_tile_meta(outbuf, fu->tile_id, 0, outsize);
+
+  gst_rtp_atlas_depay_queue_nal(rtpatlasdepay, outbuf, fu->don, fu->timestamp,
+                                fu->marker);
+}
+
+/* Data of the Fragmentation Unit being assembled was lost. With
+ * forward-incomplete-nals the fragments received so far are forwarded as a
+ * truncated NAL unit, returns FALSE when they were dropped */
+static gboolean
+gst_rtp_atlas_depay_lost_fragmentation_unit(GstRtpAtlasDepay *rtpatlasdepay) {
+  GstRtpAtlasDepayFu *fu = rtpatlasdepay->current_atlas->fu;
+
+  if (rtpatlasdepay->forward_incomplete_nals &&
+      fu->type != 0 && fu->size > 6) {
+    GST_DEBUG_OBJECT(rtpatlasdepay, "forwarding truncated NAL unit of %u bytes",
+                     (guint)fu->size - 4);
+    gst_rtp_atlas_finish_fragmentation_unit(rtpatlasdepay, TRUE);
+    return TRUE;
+  }
+
+  gst_clear_buffer(&fu->buffer);
+  fu->type = 0;
+  return FALSE;
+}
+
+static GstRtpAtlasDepayAtlas *
+gst_rtp_atlas_depay_add_atlas(GstRtpAtlasDepay *rtpatlasdepay,
+                              guint8 atlas_id) {
+  GstElementClass *klass = GST_ELEMENT_GET_CLASS(rtpatlasdepay);
+  GstRtpAtlasDepayAtlas *atlas;
+  gchar *pad_name, *stream_id;
+
+  atlas = gst_rtp_atlas_depay_atlas_new(rtpatlasdepay);
+  atlas->atlas_id = atlas_id;
+  atlas->vuh = gst_rtp_atlas_depay_atlas_vuh(
+      rtpatlasdepay->default_atlas->vuh, atlas_id);
+
+  pad_name = g_strdup_printf("src_%u", atlas_id);
+  atlas->srcpad = gst_pad_new_from_template(
+      gst_element_class_get_pad_template(klass, "src_%u"), pad_name);
+  g_free(pad_name);
+
+  gst_pad_set_element_private(atlas->srcpad, atlas);
+  gst_pad_use_fixed_caps(atlas->srcpad);
+  gst_pad_add_probe(atlas->srcpad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+                    gst_rtp_atlas_depay_src_event_probe, rtpatlasdepay, NULL);
+  gst_pad_set_active(atlas->srcpad, TRUE);
+
+  stream_id = gst_pad_create_stream_id_printf(
+      atlas->srcpad, GST_ELEMENT_CAST(rtpatlasdepay), "%u", atlas_id);
+  gst_pad_push_event(atlas->srcpad, gst_event_new_stream_start(stream_id));
+  g_free(stream_id);
+
+  if (rtpatlasdepay->worker_threads) {
+    atlas->queue = gst_data_queue_new(
+        gst_rtp_atlas_depay_queue_full, NULL, NULL,
+        GUINT_TO_POINTER(rtpatlasdepay->worker_queue_size));
+    gst_pad_start_task(atlas->srcpad,
+                       (GstTaskFunction)gst_rtp_atlas_depay_atlas_loop,
+                       atlas->srcpad, NULL);
+  }
+
+  GST_DEBUG_OBJECT(rtpatlasdepay, "atlas %u on pad %s", atlas_id,
+                   GST_PAD_NAME(atlas->srcpad));
 
-  gst_rtp_atlas_depay_handle_nal(rtpatlasdepay, outbuf,
-                                 rtpatlasdepay->fu_timestamp,
-                                 rtpatlasdepay->fu_marker);
+  g_ptr_array_add(rtpatlasdepay->atlases, atlas);
+  gst_element_add_pad(GST_ELEMENT_CAST(rtpatlasdepay), atlas->srcpad);
+
+  return atlas;
+}
+
+/* Selects the atlas of the packet from its atlas_id header extension, an
+ * atlas seen for the first time gets a src_%u pad. The atlas of the always
+ * src pad is the one of v3c-unit-header or of the atlas-id property, packets
+ * without the header extension belong to it */
+static void
+gst_rtp_atlas_depay_select_packet_atlas(GstRtpAtlasDepay *rtpatlasdepay,
+                                        GstRTPBuffer *rtp) {
+  GstRtpAtlasDepayAtlas *atlas = NULL;
+  gpointer data;
+  guint size, i;
+  guint8 atlas_id;
+
+  rtpatlasdepay->current_atlas = rtpatlasdepay->default_atlas;
+
+  if (rtpatlasdepay->atlas_id_ext_id == 0 ||
+      !gst_rtp_buffer_get_extension_onebyte_header(
+          rtp, rtpatlasdepay->atlas_id_ext_id, 0, &data, &size) ||
+      size < 1)
+    return;
+
+  atlas_id = *(guint8 *)data & 0x3F;
+
+  if (rtpatlasdepay->have_default_atlas_id &&
+      atlas_id == rtpatlasdepay->default_atlas_id)
+    return;
+
+  for (i = 0; atlas == NULL && i < rtpatlasdepay->atlases->len; i++) {
+    GstRtpAtlasDepayAtlas *a = g_ptr_array_index(rtpatlasdepay->atlases, i);
+
+    if (a->atlas_id == atlas_id)
+      atlas = a;
+  }
+  if (atlas == NULL)
+    atlas = gst_rtp_atlas_depay_add_atlas(rtpatlasdepay, atlas_id);
+
+  rtpatlasdepay->current_atlas = atlas;
+}
+
+/* Selects the Fragmentation Unit state of the RTP stream of the packet in
+ * the current atlas, one per SSRC after the first one in MRST */
+static void
+gst_rtp_atlas_depay_select_packet_fu(GstRtpAtlasDepay *rtpatlasdepay,
+                                     guint32 ssrc) {
+  GstRtpAtlasDepayAtlas *atlas = rtpatlasdepay->current_atlas;
+  guint i;
+
+  if (!rtpatlasdepay->mrst) {
+    atlas->fu = g_ptr_array_index(atlas->fus, 0);
+    return;
+  }
+
+  for (i = 1; i < atlas->fus->len; i++) {
+    GstRtpAtlasDepayFu *fu = g_ptr_array_index(atlas->fus, i);
+
+    if (fu->ssrc == ssrc) {
+      atlas->fu = fu;
+      return;
+    }
+  }
+
+  if (atlas->fus->len > MAX_MRST_STREAMS)
+    g_ptr_array_remove_index(atlas->fus, 1);
+  atlas->fu = gst_rtp_atlas_depay_fu_new(ssrc);
+  g_ptr_array_add(atlas->fus, atlas->fu);
+}
+
+/* recording-mode: a NAL unit of a single NAL unit packet or an AP made of
+ * its length prefix and header, and the data shared with the RTP packet */
+static GstBuffer *gst_rtp_atlas_depay_wrap_nal(GstRTPBuffer *rtp,
+                                               const guint8 *nal_header,
+                                               const guint8 *data, guint size) {
+  GstBuffer *nal;
+  GstMapInfo map;
+
+  nal = gst_buffer_new_allocate(NULL, 6, NULL);
+  gst_buffer_map(nal, &map, GST_MAP_WRITE);
+  GST_WRITE_UINT32_BE(map.data, size + 2);
+  map.data[4] = nal_header[0];
+  map.data[5] = nal_header[1];
+  gst_buffer_unmap(nal, &map);
+
+  if (size > 0)
+    nal = gst_buffer_append(
+        nal, gst_rtp_buffer_get_payload_subbuffer(
+                 rtp, data - (const guint8 *)gst_rtp_buffer_get_payload(rtp),
+                 size));
+
+  return nal;
 }
 
 static GstBuffer *gst_rtp_atlas_depay_process(GstRTPBaseDepayload *depayload,
                                               GstRTPBuffer *rtp) {
   GstRtpAtlasDepay *rtpatlasdepay;
+  GstRtpAtlasDepayAtlas *atlas;
+  GstRtpAtlasDepayFu *fu;
   GstBuffer *outbuf = NULL;
   guint8 nal_unit_type;
+  guint32 ssrc;
+  guint16 seqnum;
 
   rtpatlasdepay = GST_RTP_ATLAS_DEPAY(depayload);
 
   GST_DEBUG_OBJECT(rtpatlasdepay, "gst_rtp_atlas_depay_process");
 
-  /* flush remaining data on discont */
+  /* in MRST the base class sees the packets as one stream */
+  if (rtpatlasdepay->mrst) {
+    ssrc = rtpatlasdepay->packet_ssrc;
+    seqnum = rtpatlasdepay->packet_seqnum;
+  } else {
+    ssrc = gst_rtp_buffer_get_ssrc(rtp);
+    seqnum = gst_rtp_buffer_get_seq(rtp);
+  }
+
+  gst_rtp_atlas_depay_select_packet_atlas(rtpatlasdepay, rtp);
+  gst_rtp_atlas_depay_select_packet_fu(rtpatlasdepay, ssrc);
+  atlas = rtpatlasdepay->current_atlas;
+  fu = atlas->fu;
+
+  /* flush remaining data on discont, packets were lost unless the truncated
+   * Fragmentation Unit could be forwarded */
   if (GST_BUFFER_IS_DISCONT(rtp->buffer)) {
-    gst_adapter_clear(rtpatlasdepay->adapter);
-    rtpatlasdepay->wait_start = TRUE;
-    rtpatlasdepay->current_fu_type = 0;
-    rtpatlasdepay->last_fu_seqnum = 0;
+    if (!gst_rtp_atlas_depay_lost_fragmentation_unit(rtpatlasdepay))
+      gst_rtp_atlas_depay_request_keyframe(rtpatlasdepay);
+    fu->wait_start = TRUE;
+    fu->last_seqnum = 0;
+    if (rtpatlasdepay->wait_for_keyframe && !atlas->waiting_for_keyframe) {
+      GST_DEBUG_OBJECT(rtpatlasdepay, "discont, waiting for IRAP");
+      gst_adapter_clear(atlas->atlas_frame_adapter);
+      atlas->atlas_frame_start = FALSE;
+      atlas->last_keyframe = FALSE;
+      atlas->waiting_for_keyframe = TRUE;
+    }
   }
 
   {
@@ -843,8 +2805,11 @@ static GstBuffer *gst_rtp_atlas_depay_process(GstRTPBaseDepayload *depayload,
     GstClockTime timestamp;
     gboolean marker;
     guint8 nal_layer_id, nal_temporal_id_plus1;
-    guint8 S, E;
+    guint8 S, E, fu_type;
     guint16 nal_header;
+    guint16 don = 0;
+    guint16 tile_id = 0;
+    guint fields_size;
     timestamp = GST_BUFFER_PTS(rtp->buffer);
 
     payload_len = gst_rtp_buffer_get_payload_len(rtp);
@@ -855,6 +2820,8 @@ static GstBuffer *gst_rtp_atlas_depay_process(GstRTPBaseDepayload *depayload,
 
     if (payload_len == 0)
       goto empty_packet;
+    if (payload_len < 2)
+      goto short_packet;
 
     /* +---------------+---------------+
      * |0|1|2|3|4|5|6|7|0|1|2|3|4|5|6|7|
@@ -869,7 +2836,7 @@ static GstBuffer *gst_rtp_atlas_depay_process(GstRTPBaseDepayload *depayload,
     nal_layer_id = ((payload[0] & 0x01) << 5) |
                    (payload[1] >> 3); /* should be zero for now but this could
                                          change in future HEVC extensions */
-    nal_temporal_id_plus1 = payload[1] & 0x03;
+    nal_temporal_id_plus1 = payload[1] & 0x07;
 
     /* At least two byte header with type */
     header_len = 2;
@@ -878,23 +2845,22 @@ static GstBuffer *gst_rtp_atlas_depay_process(GstRTPBaseDepayload *depayload,
                      "NAL header nal_unit_type %d, nal_temporal_id_plus1 %d",
                      nal_unit_type, nal_temporal_id_plus1);
 
-    GST_FIXME_OBJECT(rtpatlasdepay, "Assuming DONL field is not present");
-
-    /* FIXME - assuming DONL field is not present for now */
-    /*(tx-mode == "SRST" sprop-max-don-diff = 0 */
-
-    /* FIXME - assuming v3c-tile-id field is not present for now */
-    /*v3c-tile-id-pres = 0 */
+    /* DONL/DOND fields are present when signalled in caps, tx-mode == "MRST"
+     * or sprop-max-don-diff > 0, the v3c-tile-id field follows DONL when
+     * v3c-tile-id-pres is 1 */
+    fields_size = (rtpatlasdepay->donl_present ? 2 : 0) +
+                  (rtpatlasdepay->tile_id_pres ? 2 : 0);
 
     /* If FU unit was being processed, but the current nal is of a different
      * type.  Assume that the remote payloader is buggy (didn't set the end bit
      * when the FU ended) and send out what we gathered thusfar */
-    if (G_UNLIKELY(rtpatlasdepay->current_fu_type != 0 &&
-                   nal_unit_type != rtpatlasdepay->current_fu_type))
-      gst_rtp_atlas_finish_fragmentation_unit(rtpatlasdepay);
+    if (G_UNLIKELY(fu->type != 0 && nal_unit_type != fu->type))
+      gst_rtp_atlas_finish_fragmentation_unit(rtpatlasdepay, FALSE);
 
     switch (nal_unit_type) {
     case AP_NUT: {
+      gboolean first_unit = TRUE;
+
       GST_DEBUG_OBJECT(rtpatlasdepay, "Processing aggregation packet");
 
       /* Aggregation packet (section 5.5.3) */
@@ -926,38 +2892,84 @@ static GstBuffer *gst_rtp_atlas_depay_process(GstRTPBaseDepayload *depayload,
       payload += header_len;
       payload_len -= header_len;
 
-      rtpatlasdepay->wait_start = FALSE;
+      fu->wait_start = FALSE;
+
+      if (rtpatlasdepay->donl_present) {
+        if (payload_len < 2)
+          goto short_packet;
+        /* DONL before the first aggregation unit */
+        don = (payload[0] << 8) | payload[1];
+        payload += 2;
+        payload_len -= 2;
+      }
 
       while (payload_len > 2) {
         gboolean last = FALSE;
 
+        if (rtpatlasdepay->donl_present && !first_unit) {
+          /* DOND before the following aggregation units */
+          if (payload_len <= 3)
+            break;
+          don += payload[0] + 1;
+          payload += 1;
+          payload_len -= 1;
+        }
+
+        if (rtpatlasdepay->tile_id_pres) {
+          if (payload_len <= 4)
+            break;
+          tile_id = (payload[0] << 8) | payload[1];
+          payload += 2;
+          payload_len -= 2;
+        }
+
         nalu_size = (payload[0] << 8) | payload[1];
 
         /* don't include nalu_size two bytes from the packet */
         if (nalu_size > (payload_len - 2))
           nalu_size = payload_len - 2;
 
+        if (nalu_size < 2 ||
+            !gst_rtp_atlas_depay_nal_wanted(rtpatlasdepay,
+                                            (payload[2] >> 1) & 0x3f,
+                                            payload[3] & 0x07, tile_id)) {
+          payload += 2 + nalu_size;
+          payload_len -= 2 + nalu_size;
+          first_unit = FALSE;
+          if (marker && payload_len <= 2)
+            gst_rtp_atlas_depay_marker_dropped(rtpatlasdepay);
+          continue;
+        }
+
         /* but reserve 4 bytes for the nalu_size value */
         outsize = nalu_size + 4;
-        outbuf = gst_buffer_new_and_alloc(outsize);
-
-        gst_buffer_map(outbuf, &map, GST_MAP_WRITE);
-        GST_WRITE_UINT32_BE(map.data, nalu_size);
 
         /* strip NALU size */
         payload += 2;
         payload_len -= 2;
 
-        memcpy(map.data + 4, payload, nalu_size);
-        gst_buffer_unmap(outbuf, &map);
+        if (rtpatlasdepay->recording_mode) {
+          outbuf = gst_rtp_atlas_depay_wrap_nal(rtp, payload, payload + 2,
+                                                nalu_size - 2);
+        } else {
+          outbuf = gst_buffer_new_and_alloc(outsize);
 
-        gst_rtp_copy_video_meta(rtpatlasdepay, outbuf, rtp->buffer);
+          gst_buffer_map(outbuf, &map, GST_MAP_WRITE);
+          GST_WRITE_UINT32_BE(map.data, nalu_size);
+          memcpy(map.data + 4, payload, nalu_size);
+          gst_buffer_unmap(outbuf, &map);
+
+          gst_rtp_copy_video_meta(rtpatlasdepay, outbuf, rtp->buffer);
+        }
+        if (rtpatlasdepay->tile_id_pres)
+          gst_buffer_add_atlas_tile_meta(outbuf, tile_id, 0, outsize);
 
         if (payload_len - nalu_size <= 2)
           last = TRUE;
 
-        gst_rtp_atlas_depay_handle_nal(rtpatlasdepay, outbuf, timestamp,
-                                       marker && last);
+        gst_rtp_atlas_depay_queue_nal(rtpatlasdepay, outbuf, don, timestamp,
+                                      marker && last);
+        first_unit = FALSE;
 
         payload += nalu_size;
         payload_len -= nalu_size;
@@ -988,83 +3000,110 @@ static GstBuffer *gst_rtp_atlas_depay_process(GstRTPBaseDepayload *depayload,
       payload += header_len;
       payload_len -= header_len;
 
+      if (payload_len < 1)
+        goto short_packet;
+
       /* processing FU header */
       S = (payload[0] & 0x80) == 0x80;
       E = (payload[0] & 0x40) == 0x40;
+      fu_type = payload[0] & 0x3f;
 
       GST_DEBUG_OBJECT(rtpatlasdepay,
                        "FU header with S %d, E %d, nal_unit_type %d", S, E,
                        payload[0] & 0x3f);
 
-      if (rtpatlasdepay->wait_start && !S)
+      if (fu->wait_start && !S)
         goto waiting_start;
 
       if (S) {
 
         GST_DEBUG_OBJECT(rtpatlasdepay, "Start of Fragmentation Unit");
 
+        /* DONL and v3c-tile-id follow the FU header of the first fragment */
+        if (fields_size) {
+          if (payload_len < 2 + fields_size)
+            goto short_packet;
+          if (rtpatlasdepay->donl_present)
+            don = (payload[1] << 8) | payload[2];
+          if (rtpatlasdepay->tile_id_pres)
+            tile_id = (payload[fields_size - 1] << 8) | payload[fields_size];
+          payload += fields_size;
+          payload_len -= fields_size;
+        }
+
         /* If a new FU unit started, while still processing an older one.
          * Assume that the remote payloader is buggy (doesn't set the end
          * bit) and send out what we've gathered thusfar */
-        if (G_UNLIKELY(rtpatlasdepay->current_fu_type != 0))
-          gst_rtp_atlas_finish_fragmentation_unit(rtpatlasdepay);
+        if (G_UNLIKELY(fu->type != 0))
+          gst_rtp_atlas_finish_fragmentation_unit(rtpatlasdepay, FALSE);
+
+        fu->drop =
+            !gst_rtp_atlas_depay_nal_wanted(rtpatlasdepay, fu_type,
+                                            nal_temporal_id_plus1, tile_id);
+        if (fu->drop) {
+          fu->wait_start = FALSE;
+          if (E) {
+            fu->drop = FALSE;
+            if (marker)
+              gst_rtp_atlas_depay_marker_dropped(rtpatlasdepay);
+          }
+          return NULL;
+        }
 
-        rtpatlasdepay->current_fu_type = nal_unit_type;
-        rtpatlasdepay->fu_timestamp = timestamp;
-        rtpatlasdepay->last_fu_seqnum = gst_rtp_buffer_get_seq(rtp);
+        fu->type = nal_unit_type;
+        fu->don = don;
+        fu->tile_id = tile_id;
+        fu->timestamp = timestamp;
+        fu->last_seqnum = seqnum;
 
-        rtpatlasdepay->wait_start = FALSE;
+        fu->wait_start = FALSE;
 
         /* reconstruct NAL header */
-        nal_header = ((payload[0] & 0x3f) << 9) | (nal_layer_id << 3) |
+        nal_header = (fu_type << 9) | (nal_layer_id << 3) |
                      nal_temporal_id_plus1;
 
-        /* go back one byte so we can copy the payload + two bytes more in the
-         * front, the extra two bytes will be overwritten by the nal_header
-         */
-        payload -= 1;
-        payload_len += 1;
-
-        nalu_size = payload_len;
-        outsize = nalu_size + 4;
-        outbuf = gst_buffer_new_and_alloc(outsize);
-
-        gst_buffer_map(outbuf, &map, GST_MAP_WRITE);
-        // dummy value that will be overiten later on by the real size
-        GST_WRITE_UINT32_BE(map.data, 0xffffffff);
-
-        memcpy(map.data + 4, payload, nalu_size);
-        map.data[4] = nal_header >> 8;
-        map.data[5] = nal_header & 0xff;
-        gst_buffer_unmap(outbuf, &map);
-
-        gst_rtp_copy_video_meta(rtpatlasdepay, outbuf, rtp->buffer);
+        /* the NAL unit data follows the FU header and the fields */
+        gst_rtp_atlas_depay_start_fragmentation_unit(
+            rtpatlasdepay, fu_type, nal_header, payload + 1, payload_len - 1);
 
-        GST_DEBUG_OBJECT(rtpatlasdepay, "queueing %d bytes", outsize);
+        gst_rtp_copy_video_meta(rtpatlasdepay, fu->buffer,
+                                rtp->buffer);
 
-        /* and assemble in the adapter */
-        gst_adapter_push(rtpatlasdepay->adapter, outbuf);
+        GST_DEBUG_OBJECT(rtpatlasdepay, "queueing %d bytes", payload_len - 1);
       } else {
-        if (rtpatlasdepay->current_fu_type == 0) {
+        if (fu->drop) {
+          /* rest of a Fragmentation Unit of a tile that is not selected */
+          if (E) {
+            fu->drop = FALSE;
+            if (marker)
+              gst_rtp_atlas_depay_marker_dropped(rtpatlasdepay);
+          }
+          return NULL;
+        }
+        if (fu->type == 0) {
           /* previous FU packet missing start bit? */
           GST_WARNING_OBJECT(rtpatlasdepay, "missing FU start bit on an "
                                             "earlier packet. Dropping.");
-          gst_adapter_clear(rtpatlasdepay->adapter);
+          gst_clear_buffer(&fu->buffer);
+          gst_rtp_atlas_depay_request_keyframe(rtpatlasdepay);
           return NULL;
         }
-        if (gst_rtp_buffer_compare_seqnum(rtpatlasdepay->last_fu_seqnum,
-                                          gst_rtp_buffer_get_seq(rtp)) != 1) {
+        if (gst_rtp_buffer_compare_seqnum(fu->last_seqnum, seqnum) != 1) {
           /* jump in sequence numbers within an FU is cause for discarding */
           GST_WARNING_OBJECT(
               rtpatlasdepay,
               "Jump in sequence numbers from "
               "%u to %u within Fragmentation Unit. Data was lost, dropping "
               "stored.",
-              rtpatlasdepay->last_fu_seqnum, gst_rtp_buffer_get_seq(rtp));
-          gst_adapter_clear(rtpatlasdepay->adapter);
+              fu->last_seqnum, seqnum);
+          /* the following fragments of the lost NAL unit are skipped */
+          if (gst_rtp_atlas_depay_lost_fragmentation_unit(rtpatlasdepay))
+            fu->wait_start = TRUE;
+          else
+            gst_rtp_atlas_depay_request_keyframe(rtpatlasdepay);
           return NULL;
         }
-        rtpatlasdepay->last_fu_seqnum = gst_rtp_buffer_get_seq(rtp);
+        fu->last_seqnum = seqnum;
 
         GST_DEBUG_OBJECT(rtpatlasdepay, "Following part of Fragmentation Unit");
 
@@ -1072,30 +3111,25 @@ static GstBuffer *gst_rtp_atlas_depay_process(GstRTPBaseDepayload *depayload,
         payload += 1;
         payload_len -= 1;
 
-        outsize = payload_len;
-        outbuf = gst_buffer_new_and_alloc(outsize);
-        gst_buffer_fill(outbuf, 0, payload, outsize);
-
-        gst_rtp_copy_video_meta(rtpatlasdepay, outbuf, rtp->buffer);
-
-        GST_DEBUG_OBJECT(rtpatlasdepay, "queueing %d bytes", outsize);
+        GST_DEBUG_OBJECT(rtpatlasdepay, "queueing %d bytes", payload_len);
 
-        /* and assemble in the adapter */
-        gst_adapter_push(rtpatlasdepay->adapter, outbuf);
+        /* and copy it in place in the reassembly buffer */
+        gst_rtp_atlas_depay_append_fragment(rtpatlasdepay, payload,
+                                            payload_len);
       }
 
       outbuf = NULL;
-      rtpatlasdepay->fu_marker = marker;
+      fu->marker = marker;
 
-      /* if NAL unit ends, flush the adapter */
+      /* if NAL unit ends, output the reassembly buffer */
       if (E) {
-        gst_rtp_atlas_finish_fragmentation_unit(rtpatlasdepay);
+        gst_rtp_atlas_finish_fragmentation_unit(rtpatlasdepay, FALSE);
         GST_DEBUG_OBJECT(rtpatlasdepay, "End of Fragmentation Unit");
       }
       break;
     }
     default: {
-      rtpatlasdepay->wait_start = FALSE;
+      fu->wait_start = FALSE;
       /* 5.5.2. Single NAL unit packet*/
       /* the entire payload is the output buffer */
 
@@ -1115,18 +3149,45 @@ static GstBuffer *gst_rtp_atlas_depay_process(GstRTPBaseDepayload *depayload,
       +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
       */
 
-      nalu_size = payload_len;
+      if (fields_size) {
+        if (payload_len < 2 + fields_size)
+          goto short_packet;
+        if (rtpatlasdepay->donl_present)
+          don = (payload[2] << 8) | payload[3];
+        if (rtpatlasdepay->tile_id_pres)
+          tile_id = (payload[fields_size] << 8) | payload[fields_size + 1];
+      }
+
+      if (!gst_rtp_atlas_depay_nal_wanted(rtpatlasdepay, nal_unit_type,
+                                          nal_temporal_id_plus1, tile_id)) {
+        if (marker)
+          gst_rtp_atlas_depay_marker_dropped(rtpatlasdepay);
+        return NULL;
+      }
+
+      nalu_size = payload_len - fields_size;
       outsize = nalu_size + 4;
-      outbuf = gst_buffer_new_and_alloc(outsize);
 
-      gst_buffer_map(outbuf, &map, GST_MAP_WRITE);
-      GST_WRITE_UINT32_BE(map.data, nalu_size);
-      memcpy(map.data + 4, payload, nalu_size);
-      gst_buffer_unmap(outbuf, &map);
+      if (rtpatlasdepay->recording_mode) {
+        outbuf = gst_rtp_atlas_depay_wrap_nal(
+            rtp, payload, payload + 2 + fields_size, nalu_size - 2);
+      } else {
+        outbuf = gst_buffer_new_and_alloc(outsize);
+
+        gst_buffer_map(outbuf, &map, GST_MAP_WRITE);
+        GST_WRITE_UINT32_BE(map.data, nalu_size);
+        /* NAL unit header, then the data after DONL and v3c-tile-id */
+        memcpy(map.data + 4, payload, 2);
+        memcpy(map.data + 6, payload + 2 + fields_size, nalu_size - 2);
+        gst_buffer_unmap(outbuf, &map);
 
-      gst_rtp_copy_video_meta(rtpatlasdepay, outbuf, rtp->buffer);
+        gst_rtp_copy_video_meta(rtpatlasdepay, outbuf, rtp->buffer);
+      }
+      if (rtpatlasdepay->tile_id_pres)
+        gst_buffer_add_atlas_tile_meta(outbuf, tile_id, 0, outsize);
 
-      gst_rtp_atlas_depay_handle_nal(rtpatlasdepay, outbuf, timestamp, marker);
+      gst_rtp_atlas_depay_queue_nal(rtpatlasdepay, outbuf, don, timestamp,
+                                    marker);
       break;
     }
     }
@@ -1142,6 +3203,50 @@ waiting_start : {
   GST_DEBUG_OBJECT(rtpatlasdepay, "waiting for start");
   return NULL;
 }
+short_packet : {
+  GST_WARNING_OBJECT(rtpatlasdepay, "packet too short for its payload "
+                                    "header, DONL or v3c-tile-id field");
+  return NULL;
+}
+}
+
+/* the base class only forwards events on the always src pad */
+static gboolean gst_rtp_atlas_depay_forward_atlas_event(GstElement *element,
+                                                        GstPad *pad,
+                                                        gpointer user_data) {
+  GstEvent *event = GST_EVENT_CAST(user_data);
+  GstRtpAtlasDepayAtlas *atlas;
+
+  if (pad == GST_RTP_BASE_DEPAYLOAD_SRCPAD(element))
+    return TRUE;
+
+  atlas = gst_pad_get_element_private(pad);
+
+  switch (GST_EVENT_TYPE(event)) {
+  case GST_EVENT_FLUSH_START:
+    if (atlas->queue)
+      gst_data_queue_set_flushing(atlas->queue, TRUE);
+    gst_pad_push_event(pad, gst_event_ref(event));
+    if (atlas->queue)
+      gst_pad_pause_task(pad);
+    break;
+  case GST_EVENT_FLUSH_STOP:
+    gst_pad_push_event(pad, gst_event_ref(event));
+    gst_event_replace(&atlas->segment, NULL);
+    if (atlas->queue) {
+      gst_data_queue_flush(atlas->queue);
+      gst_data_queue_set_flushing(atlas->queue, FALSE);
+      gst_pad_start_task(pad, (GstTaskFunction)gst_rtp_atlas_depay_atlas_loop,
+                         pad, NULL);
+    }
+    break;
+  default:
+    gst_rtp_atlas_depay_atlas_output(pad,
+                                     GST_MINI_OBJECT_CAST(gst_event_ref(event)));
+    break;
+  }
+
+  return TRUE;
 }
 
 static gboolean gst_rtp_atlas_depay_handle_event(GstRTPBaseDepayload *depay,
@@ -1150,12 +3255,28 @@ static gboolean gst_rtp_atlas_depay_handle_event(GstRTPBaseDepayload *depay,
 
   rtpatlasdepay = GST_RTP_ATLAS_DEPAY(depay);
 
+  /* packets held in the reorder window precede the event */
+  if (GST_EVENT_IS_SERIALIZED(event) &&
+      GST_EVENT_TYPE(event) != GST_EVENT_FLUSH_STOP)
+    gst_rtp_atlas_depay_reorder_release(rtpatlasdepay, TRUE, 0);
+
   switch (GST_EVENT_TYPE(event)) {
+  case GST_EVENT_FLUSH_START:
+    gst_element_foreach_src_pad(GST_ELEMENT_CAST(depay),
+                                gst_rtp_atlas_depay_forward_atlas_event, event);
+    break;
   case GST_EVENT_FLUSH_STOP:
     gst_rtp_atlas_depay_reset(rtpatlasdepay, FALSE);
+    gst_element_foreach_src_pad(GST_ELEMENT_CAST(depay),
+                                gst_rtp_atlas_depay_forward_atlas_event, event);
     break;
   case GST_EVENT_EOS:
     gst_rtp_atlas_depay_drain(rtpatlasdepay);
+    gst_element_foreach_src_pad(GST_ELEMENT_CAST(depay),
+                                gst_rtp_atlas_depay_forward_atlas_event, event);
+    break;
+  case GST_EVENT_CUSTOM_DOWNSTREAM:
+    gst_rtp_atlas_depay_handle_tile_selection(rtpatlasdepay, event);
     break;
   default:
     break;
@@ -1180,6 +3301,10 @@ gst_rtp_atlas_depay_change_state(GstElement *element,
   case GST_STATE_CHANGE_READY_TO_PAUSED:
     gst_rtp_atlas_depay_reset(rtpatlasdepay, TRUE);
     break;
+  case GST_STATE_CHANGE_PAUSED_TO_READY:
+    gst_element_foreach_src_pad(element, gst_rtp_atlas_depay_flush_worker,
+                                NULL);
+    break;
   default:
     break;
   }
@@ -1189,6 +3314,7 @@ gst_rtp_atlas_depay_change_state(GstElement *element,
   switch (transition) {
   case GST_STATE_CHANGE_PAUSED_TO_READY:
     gst_rtp_atlas_depay_reset(rtpatlasdepay, TRUE);
+    gst_rtp_atlas_depay_remove_atlases(rtpatlasdepay);
     break;
   case GST_STATE_CHANGE_READY_TO_NULL:
     break;
@@ -1198,6 +3324,122 @@ gst_rtp_atlas_depay_change_state(GstElement *element,
   return ret;
 }
 
+static void gst_rtp_atlas_depay_set_property(GObject *object, guint prop_id,
+                                             const GValue *value,
+                                             GParamSpec *pspec) {
+  GstRtpAtlasDepay *rtpatlasdepay;
+
+  rtpatlasdepay = GST_RTP_ATLAS_DEPAY(object);
+
+  switch (prop_id) {
+  case PROP_WAIT_FOR_KEYFRAME:
+    rtpatlasdepay->wait_for_keyframe = g_value_get_boolean(value);
+    break;
+  case PROP_REQUEST_KEYFRAME:
+    rtpatlasdepay->request_keyframe = g_value_get_boolean(value);
+    break;
+  case PROP_REQUEST_KEYFRAME_INTERVAL:
+    rtpatlasdepay->request_keyframe_interval = g_value_get_uint(value);
+    break;
+  case PROP_TILE_IDS:
+    gst_rtp_atlas_depay_set_tile_ids(rtpatlasdepay, value);
+    break;
+  case PROP_MAX_TEMPORAL_ID:
+    rtpatlasdepay->max_temporal_id = g_value_get_uint(value);
+    break;
+  case PROP_WORKER_THREADS:
+    rtpatlasdepay->worker_threads = g_value_get_boolean(value);
+    break;
+  case PROP_WORKER_QUEUE_SIZE:
+    rtpatlasdepay->worker_queue_size = g_value_get_uint(value);
+    break;
+  case PROP_FORWARD_INCOMPLETE_NALS:
+    rtpatlasdepay->forward_incomplete_nals = g_value_get_boolean(value);
+    break;
+  case PROP_REORDER_WINDOW:
+    rtpatlasdepay->reorder_window = g_value_get_uint(value);
+    break;
+  case PROP_REORDER_WINDOW_TIME:
+    rtpatlasdepay->reorder_window_time = g_value_get_uint(value);
+    break;
+  case PROP_NAL_LENGTH_SIZE:
+    rtpatlasdepay->nal_length_size = g_value_get_uint(value);
+    break;
+  case PROP_RECORDING_MODE:
+    rtpatlasdepay->recording_mode = g_value_get_boolean(value);
+    break;
+  case PROP_ATLAS_ID:
+    rtpatlasdepay->atlas_id = g_value_get_int(value);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+    break;
+  }
+}
+
+static void gst_rtp_atlas_depay_get_property(GObject *object, guint prop_id,
+                                             GValue *value, GParamSpec *pspec) {
+  GstRtpAtlasDepay *rtpatlasdepay;
+
+  rtpatlasdepay = GST_RTP_ATLAS_DEPAY(object);
+
+  switch (prop_id) {
+  case PROP_WAIT_FOR_KEYFRAME:
+    g_value_set_boolean(value, rtpatlasdepay->wait_for_keyframe);
+    break;
+  case PROP_REQUEST_KEYFRAME:
+    g_value_set_boolean(value, rtpatlasdepay->request_keyframe);
+    break;
+  case PROP_REQUEST_KEYFRAME_INTERVAL:
+    g_value_set_uint(value, rtpatlasdepay->request_keyframe_interval);
+    break;
+  case PROP_TILE_IDS: {
+    guint i;
+
+    GST_OBJECT_LOCK(rtpatlasdepay);
+    for (i = 0; i < rtpatlasdepay->tile_ids->len; i++) {
+      GValue v = G_VALUE_INIT;
+
+      g_value_init(&v, G_TYPE_UINT);
+      g_value_set_uint(&v, g_array_index(rtpatlasdepay->tile_ids, guint16, i));
+      gst_value_array_append_and_take_value(value, &v);
+    }
+    GST_OBJECT_UNLOCK(rtpatlasdepay);
+    break;
+  }
+  case PROP_MAX_TEMPORAL_ID:
+    g_value_set_uint(value, rtpatlasdepay->max_temporal_id);
+    break;
+  case PROP_WORKER_THREADS:
+    g_value_set_boolean(value, rtpatlasdepay->worker_threads);
+    break;
+  case PROP_WORKER_QUEUE_SIZE:
+    g_value_set_uint(value, rtpatlasdepay->worker_queue_size);
+    break;
+  case PROP_FORWARD_INCOMPLETE_NALS:
+    g_value_set_boolean(value, rtpatlasdepay->forward_incomplete_nals);
+    break;
+  case PROP_REORDER_WINDOW:
+    g_value_set_uint(value, rtpatlasdepay->reorder_window);
+    break;
+  case PROP_REORDER_WINDOW_TIME:
+    g_value_set_uint(value, rtpatlasdepay->reorder_window_time);
+    break;
+  case PROP_NAL_LENGTH_SIZE:
+    g_value_set_uint(value, rtpatlasdepay->nal_length_size);
+    break;
+  case PROP_RECORDING_MODE:
+    g_value_set_boolean(value, rtpatlasdepay->recording_mode);
+    break;
+  case PROP_ATLAS_ID:
+    g_value_set_int(value, rtpatlasdepay->atlas_id);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+    break;
+  }
+}
+
 gboolean gst_rtp_atlas_depay_plugin_init(GstPlugin *plugin) {
   return gst_element_register(plugin, "rtpatlasdepay", GST_RANK_SECONDARY,
                               GST_TYPE_RTP_ATLAS_DEPAY);
@@ -34,6 +34,7 @@
 
 #include "utils.h"
 #include <gst/base/gstadapter.h>
+#include <gst/base/gstdataqueue.h>
 #include <gst/gst.h>
 #include <gst/rtp/gstrtpbasedepayload.h>
 
@@ -50,6 +51,8 @@ G_BEGIN_DECLS
 #define GST_IS_RTP_ATLAS_DEPAY_CLASS(klass)                                    \
   (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_RTP_ATLAS_DEPAY))
 typedef struct _GstRtpAtlasDepay GstRtpAtlasDepay;
+
+#define GST_RTP_ATLAS_MAX_SETUP_UNIT_ARRAYS 9
 typedef struct _GstRtpAtlasDepayClass GstRtpAtlasDepayClass;
 
 typedef enum {
@@ -57,37 +60,179 @@ typedef enum {
   GST_ATLAS_STREAM_FORMAT_V3CG
 } GstAtlasStreamFormat;
 
-struct _GstRtpAtlasDepay {
-  GstRTPBaseDepayload depayload;
+/* Fragmentation Unit reassembly of one RTP stream of an atlas. A session
+ * in tx-mode MRST has one per SSRC, so that the FUs of the RTP streams can
+ * be interleaved */
+typedef struct {
+  guint32 ssrc;
+  /* fragments are skipped until the start of the next FU */
+  gboolean wait_start;
+  /* NAL unit type of the FU payload header, 0 when no FU is open */
+  guint8 type;
+  guint16 last_seqnum;
+  GstClockTime timestamp;
+  gboolean marker;
+  guint16 don;
+  guint16 tile_id;
+  gboolean drop;
 
-  const gchar *stream_format;
-  GstAtlasStreamFormat output_format;
+  /* NAL unit reassembled in place behind its 4 bytes length prefix, size
+   * bytes are filled. The buffer is allocated from a running average of
+   * the NAL unit sizes per type and grows geometrically */
+  GstBuffer *buffer;
+  gsize size;
+} GstRtpAtlasDepayFu;
 
+/* State of one atlas of the session. The atlas of the caps is pushed on
+ * the always src pad, the other ones on a src_%u pad each */
+typedef struct {
+  guint8 atlas_id;
+  /* pad the atlas is pushed on */
+  GstPad *srcpad;
   GstBuffer *vuh;
-  GstBuffer *vps;
   GstBuffer *codec_data;
-  GstAdapter *adapter;
-  gboolean wait_start;
+
+  /* drop NAL units that cannot be decoded until an IRAP, and the RASL
+   * atlas frames of the CRA or GCRA the output started at */
+  gboolean waiting_for_keyframe;
+  gboolean skip_rasl;
 
   /* NAL Aggregation Units*/
   GstAdapter *atlas_frame_adapter;
   gboolean atlas_frame_start;
   GstClockTime last_ts;
   gboolean last_keyframe;
+  /* an access unit was dropped, the next one pushed is DISCONT */
+  gboolean discont;
+
+  /* NAL Fragmentation Units, fu is the state of the RTP stream of the
+   * packet being handled, the first one of fus outside MRST */
+  GPtrArray *fus;
+  GstRtpAtlasDepayFu *fu;
 
-  /* NAL Fragmentation Units */
-  guint8 current_fu_type;
-  guint16 last_fu_seqnum;
-  GstClockTime fu_timestamp;
-  gboolean fu_marker;
+  /* temporal sub-layer switching state of max-temporal-id */
+  guint temporal_id_limit;
 
   GPtrArray *asps;
   GPtrArray *afps;
   GPtrArray *aaps;
+  /* prefix and suffix SEI received out-of-band */
+  GPtrArray *sei;
   gboolean new_codec_data;
 
+  /* V3CDecoderConfigurationRecord kept serialized per part, only the parts
+   * marked in v3cdcr_dirty are rebuilt on update */
+  GstBuffer *v3cdcr;
+  GstBuffer *v3cdcr_vps;
+  GstBuffer *v3cdcr_arrays[GST_RTP_ATLAS_MAX_SETUP_UNIT_ARRAYS];
+  guint32 v3cdcr_array_hash[GST_RTP_ATLAS_MAX_SETUP_UNIT_ARRAYS];
+  guint32 v3cdcr_vps_hash;
+  guint64 v3cdcr_dirty;
+  /* hash of the content of the caps sent last, confirmed on src_caps */
+  guint32 src_caps_hash;
+  GstCaps *src_caps;
+
   GstAllocator *allocator;
   GstAllocationParams params;
+
+  /* access units and serialized events waiting for the worker of a src_%u
+   * pad when worker-threads is set, and the last segment sent on it */
+  GstDataQueue *queue;
+  GstEvent *segment;
+} GstRtpAtlasDepayAtlas;
+
+struct _GstRtpAtlasDepay {
+  GstRTPBaseDepayload depayload;
+
+  const gchar *stream_format;
+  GstAtlasStreamFormat output_format;
+
+  GstBuffer *vps;
+
+  /* drop NAL units that cannot be decoded until an IRAP */
+  gboolean wait_for_keyframe;
+
+  /* upstream GstForceKeyUnit on unrecoverable loss, rate-limited */
+  gboolean request_keyframe;
+  guint request_keyframe_interval;
+  gint64 last_keyframe_request;
+
+  /* running average of the reassembled NAL unit sizes per type */
+  guint fu_size_estimate[64];
+
+  /* DONL/DOND present (tx-mode MRST or sprop-max-don-diff > 0), NAL units
+   * are de-interleaved by decoding order number before AU assembly */
+  gboolean donl_present;
+  guint max_don_diff;
+  GArray *don_queue;
+  gint64 last_abs_don;
+  gint64 last_out_abs_don;
+  gboolean have_don;
+
+  /* v3c-tile-id field present, exposed as GstAtlasTileMeta on the AU */
+  gboolean tile_id_pres;
+  /* wanted tile ids, empty for all; ACL NAL units of other tiles are
+   * dropped before assembly. Protected by the object lock */
+  GArray *tile_ids;
+
+  /* NAL units of higher temporal sub-layers are dropped */
+  guint max_temporal_id;
+
+  /* CASPS and CAF_IDR of the common atlas data, from
+   * v3c-common-atlas-data or the last ones received in-band, shared by
+   * all atlases */
+  GPtrArray *cad;
+
+  /* id of the atlas_id RTP header extension from the extmap of the caps, 0
+   * when the session carries a single atlas. The atlas of v3c-unit-header,
+   * or of the atlas-id property without it, is default_atlas on the always
+   * src pad, the others are in atlases. current_atlas is the one of the
+   * packet or NAL unit being handled */
+  guint atlas_id_ext_id;
+  gint atlas_id;
+  gboolean have_default_atlas_id;
+  guint8 default_atlas_id;
+  GstRtpAtlasDepayAtlas *default_atlas;
+  GPtrArray *atlases;
+  GstRtpAtlasDepayAtlas *current_atlas;
+
+  /* src_%u pads pushed from a thread of their own, through a queue of at
+   * most worker_queue_size access units */
+  gboolean worker_threads;
+  guint worker_queue_size;
+
+  /* truncated Fragmentation Units are forwarded with the F bit set */
+  gboolean forward_incomplete_nals;
+
+  /* RTP packets are put back in sequence number order in front of the base
+   * class, holding at most reorder_window packets for at most
+   * reorder_window_time milliseconds */
+  guint reorder_window;
+  guint reorder_window_time;
+  GArray *reorder_queue;
+  guint16 next_seqnum;
+  gboolean have_next_seqnum;
+  GstPadChainFunction base_chain;
+  GstPadChainListFunction base_chain_list;
+
+  /* tx-mode MRST: the RTP streams of the session have a sequence number
+   * space each, checked per SSRC in mrst_streams. The base class sees the
+   * packets as one continuous stream of mrst_ssrc, the SSRC and sequence
+   * number of the packet being handled are in packet_ssrc and
+   * packet_seqnum */
+  gboolean mrst;
+  GArray *mrst_streams;
+  guint32 mrst_ssrc;
+  guint16 mrst_seqnum;
+  guint32 packet_ssrc;
+  guint16 packet_seqnum;
+
+  /* size of the NAL unit length prefix of the output, shared by all
+   * atlases */
+  guint nal_length_size;
+
+  /* access units for a muxer, chaining the memory of the RTP packets */
+  gboolean recording_mode;
 };
 
 struct _GstRtpAtlasDepayClass {
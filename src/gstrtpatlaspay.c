@@ -42,8 +42,10 @@
 
 #include "gstrtpatlasdepay.h"
 
+#include "gstatlasmeta.h"
 #include "gstbuffermemory.h"
 #include "gstrtpatlaspay.h"
+#include "gstrtpatlassdp.h"
 #include "gstrtputils.h"
 #include "utils.h"
 
@@ -76,6 +78,27 @@ static GType gst_rtp_atlas_aggregate_mode_get_type(void) {
   return type;
 }
 
+#define GST_TYPE_RTP_ATLAS_TX_MODE (gst_rtp_atlas_tx_mode_get_type())
+
+static GType gst_rtp_atlas_tx_mode_get_type(void) {
+  static GType type = 0;
+  static const GEnumValue values[] = {
+      {GST_RTP_ATLAS_TX_MODE_SRST, "Single RTP stream on a single session",
+       "SRST"},
+      {GST_RTP_ATLAS_TX_MODE_MRST, "Multiple RTP streams, DONL is present",
+       "MRST"},
+      {0, NULL, NULL},
+  };
+
+  if (!type) {
+    type = g_enum_register_static("GstRtpAtlasTxMode", values);
+  }
+  return type;
+}
+
+#define GST_RTP_ATLAS_PAY_HAS_DONL(p)                                          \
+  ((p)->tx_mode == GST_RTP_ATLAS_TX_MODE_MRST || (p)->max_don_diff > 0)
+
 /* From ISO/IEC 23090-10
 * When the V3C bitstream contains a single atlas,
   a V3C atlas track with sample entry 'v3c1' or 'v3cg' shall be used.
@@ -93,6 +116,13 @@ static GstStaticPadTemplate gst_rtp_atlas_pay_sink_template =
         /* vuh_data = (string) ANY,*/
     );
 
+/* one more atlas of the same V3C bitstream per request pad */
+static GstStaticPadTemplate gst_rtp_atlas_pay_atlas_sink_template =
+    GST_STATIC_PAD_TEMPLATE(
+        "sink_%u", GST_PAD_SINK, GST_PAD_REQUEST,
+        GST_STATIC_CAPS("video/x-atlas, stream-format = (string) { v3cg, v3ag },"
+                        "alignment = (string)au; "));
+
 static GstStaticPadTemplate gst_rtp_atlas_pay_src_template =
     GST_STATIC_PAD_TEMPLATE(
         "src", GST_PAD_SRC, GST_PAD_ALWAYS,
@@ -122,12 +152,32 @@ static GstStaticPadTemplate gst_rtp_atlas_pay_src_template =
     );
 
 #define DEFAULT_CONFIG_INTERVAL 0
+#define DEFAULT_ADAPTIVE_CONFIG_INTERVAL FALSE
+#define DEFAULT_CONFIG_INTERVAL_MIN 250
+#define DEFAULT_CONFIG_INTERVAL_MAX 10000
 #define DEFAULT_AGGREGATE_MODE GST_RTP_ATLAS_AGGREGATE_NONE
+#define DEFAULT_TX_MODE GST_RTP_ATLAS_TX_MODE_SRST
+#define DEFAULT_MAX_DON_DIFF 0
+#define DEFAULT_TILE_ID_PRES FALSE
+#define DEFAULT_MAX_TEMPORAL_ID 6
+#define DEFAULT_ATLAS_ID_EXT_ID 0
+#define DEFAULT_PROTECT_KEY_UNITS FALSE
 
 enum {
   PROP_0,
   PROP_CONFIG_INTERVAL,
+  PROP_CONFIG_INTERVAL_MS,
+  PROP_ADAPTIVE_CONFIG_INTERVAL,
+  PROP_CONFIG_INTERVAL_MIN_MS,
+  PROP_CONFIG_INTERVAL_MAX_MS,
   PROP_AGGREGATE_MODE,
+  PROP_TX_MODE,
+  PROP_MAX_DON_DIFF,
+  PROP_TILE_ID_PRES,
+  PROP_MAX_TEMPORAL_ID,
+  PROP_ATLAS_ID_EXT_ID,
+  PROP_SDP_FMTP,
+  PROP_PROTECT_KEY_UNITS,
 };
 
 static void gst_rtp_atlas_pay_finalize(GObject *object);
@@ -140,22 +190,35 @@ static void gst_rtp_atlas_pay_get_property(GObject *object, guint prop_id,
 
 static GstCaps *gst_rtp_atlas_pay_getcaps(GstRTPBasePayload *payload,
                                           GstPad *pad, GstCaps *filter);
+static GstPad *gst_rtp_atlas_pay_request_new_pad(GstElement *element,
+                                                 GstPadTemplate *templ,
+                                                 const gchar *name,
+                                                 const GstCaps *caps);
+static void gst_rtp_atlas_pay_release_pad(GstElement *element, GstPad *pad);
 static gboolean gst_rtp_atlas_pay_setcaps(GstRTPBasePayload *basepayload,
                                           GstCaps *caps);
 static GstFlowReturn gst_rtp_atlas_pay_handle_buffer(GstRTPBasePayload *pad,
                                                      GstBuffer *buffer);
 static gboolean gst_rtp_atlas_pay_sink_event(GstRTPBasePayload *payload,
                                              GstEvent *event);
+static gboolean gst_rtp_atlas_pay_src_event(GstRTPBasePayload *payload,
+                                            GstEvent *event);
 static GstStateChangeReturn
 gst_rtp_atlas_pay_change_state(GstElement *element, GstStateChange transition);
 static gboolean gst_rtp_atlas_pay_src_query(GstPad *pad, GstObject *parent,
                                             GstQuery *query);
 
 static void gst_rtp_atlas_pay_reset_bundle(GstRtpAtlasPay *rtpatlaspay);
+static GstRtpAtlasPayAtlas *
+gst_rtp_atlas_pay_atlas_new(GstRtpAtlasPay *rtpatlaspay);
+static void gst_rtp_atlas_pay_atlas_free(GstRtpAtlasPayAtlas *atlas);
 
 #define gst_rtp_atlas_pay_parent_class parent_class
 G_DEFINE_TYPE(GstRtpAtlasPay, gst_rtp_atlas_pay, GST_TYPE_RTP_BASE_PAYLOAD);
 
+/* qdata of the parameter set buffers holding their base64 encoding */
+static GQuark base64_quark;
+
 static void gst_rtp_atlas_pay_class_init(GstRtpAtlasPayClass *klass) {
   GObjectClass *gobject_class;
   GstElementClass *gstelement_class;
@@ -176,6 +239,42 @@ static void gst_rtp_atlas_pay_class_init(GstRtpAtlasPayClass *klass) {
                        -1, 3600, DEFAULT_CONFIG_INTERVAL,
                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_CONFIG_INTERVAL_MS,
+      g_param_spec_int("config-interval-ms", "ASPS AFPS AAPS Send Interval ms",
+                       "Send ASPS, AFPS and AAPS Insertion Interval in "
+                       "milliseconds, same as config-interval with a finer "
+                       "granularity (0 = disabled, -1 = send with every IDR "
+                       "frame)",
+                       -1, 3600000, DEFAULT_CONFIG_INTERVAL,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_ADAPTIVE_CONFIG_INTERVAL,
+      g_param_spec_boolean(
+          "adaptive-config-interval", "Adaptive config interval",
+          "Replace config-interval by an interval halved at each re-send "
+          "after GstForceKeyUnit requests and doubled at each re-send "
+          "without, between config-interval-min-ms and config-interval-max-ms",
+          DEFAULT_ADAPTIVE_CONFIG_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_CONFIG_INTERVAL_MIN_MS,
+      g_param_spec_int("config-interval-min-ms", "Minimum config interval",
+                       "Shortest adaptive ASPS, AFPS and AAPS Insertion "
+                       "Interval in milliseconds",
+                       1, 3600000, DEFAULT_CONFIG_INTERVAL_MIN,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_CONFIG_INTERVAL_MAX_MS,
+      g_param_spec_int("config-interval-max-ms", "Maximum config interval",
+                       "Longest adaptive ASPS, AFPS and AAPS Insertion "
+                       "Interval in milliseconds, and the initial one",
+                       1, 3600000, DEFAULT_CONFIG_INTERVAL_MAX,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property(
       G_OBJECT_CLASS(klass), PROP_AGGREGATE_MODE,
       g_param_spec_enum(
@@ -184,12 +283,76 @@ static void gst_rtp_atlas_pay_class_init(GstRtpAtlasPayClass *klass) {
           GST_TYPE_RTP_ATLAS_AGGREGATE_MODE, DEFAULT_AGGREGATE_MODE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_TX_MODE,
+      g_param_spec_enum(
+          "tx-mode", "Transmission mode",
+          "Signalled tx-mode, DONL fields are written in MRST mode",
+          GST_TYPE_RTP_ATLAS_TX_MODE, DEFAULT_TX_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_MAX_DON_DIFF,
+      g_param_spec_uint(
+          "sprop-max-don-diff", "Maximum DON difference",
+          "Signalled sprop-max-don-diff, DONL fields are written when "
+          "greater than 0",
+          0, 32767, DEFAULT_MAX_DON_DIFF,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_TILE_ID_PRES,
+      g_param_spec_boolean(
+          "v3c-tile-id-pres", "v3c-tile-id present",
+          "Write the v3c-tile-id field, taken from the GstAtlasTileMeta of "
+          "the NAL unit",
+          DEFAULT_TILE_ID_PRES, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_MAX_TEMPORAL_ID,
+      g_param_spec_uint(
+          "max-temporal-id", "Maximum temporal id",
+          "Drop NAL units of higher temporal sub-layers, a raised value "
+          "applies from the next IRAP, TSA or STSA",
+          0, 6, DEFAULT_MAX_TEMPORAL_ID,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_ATLAS_ID_EXT_ID,
+      g_param_spec_uint(
+          "atlas-id-ext-id", "Atlas id extension id",
+          "ID of the one-byte RTP header extension carrying the atlas_id of "
+          "each packet, sink_%u pads are only available when it is set "
+          "(0 = disabled)",
+          0, 14, DEFAULT_ATLAS_ID_EXT_ID,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_SDP_FMTP,
+      g_param_spec_string(
+          "sdp-fmtp", "SDP fmtp",
+          "Value of the SDP a=fmtp line for the V3C optional parameters of "
+          "the current SRC caps, NULL before negotiation",
+          NULL, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_PROTECT_KEY_UNITS,
+      g_param_spec_boolean(
+          "protect-key-units", "Protect key units",
+          "Flag the packets of parameter sets and IRAP access units "
+          "non-droppable, for rtpulpfecenc to protect them with its "
+          "percentage-important overhead",
+          DEFAULT_PROTECT_KEY_UNITS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   gobject_class->finalize = gst_rtp_atlas_pay_finalize;
 
   gst_element_class_add_static_pad_template(gstelement_class,
                                             &gst_rtp_atlas_pay_src_template);
   gst_element_class_add_static_pad_template(gstelement_class,
                                             &gst_rtp_atlas_pay_sink_template);
+  gst_element_class_add_static_pad_template(
+      gstelement_class, &gst_rtp_atlas_pay_atlas_sink_template);
 
   gst_element_class_set_static_metadata(
       gstelement_class, "RTP Atlas payloader", "Codec/Payloader/Network/RTP",
@@ -198,42 +361,90 @@ static void gst_rtp_atlas_pay_class_init(GstRtpAtlasPayClass *klass) {
 
   gstelement_class->change_state =
       GST_DEBUG_FUNCPTR(gst_rtp_atlas_pay_change_state);
+  gstelement_class->request_new_pad =
+      GST_DEBUG_FUNCPTR(gst_rtp_atlas_pay_request_new_pad);
+  gstelement_class->release_pad =
+      GST_DEBUG_FUNCPTR(gst_rtp_atlas_pay_release_pad);
 
   gstrtpbasepayload_class->get_caps = gst_rtp_atlas_pay_getcaps;
   gstrtpbasepayload_class->set_caps = gst_rtp_atlas_pay_setcaps;
   gstrtpbasepayload_class->handle_buffer = gst_rtp_atlas_pay_handle_buffer;
   gstrtpbasepayload_class->sink_event = gst_rtp_atlas_pay_sink_event;
+  gstrtpbasepayload_class->src_event = gst_rtp_atlas_pay_src_event;
 
   GST_DEBUG_CATEGORY_INIT(rtpatlaspay_debug, "rtpatlaspay", 0,
                           "ATLAS RTP Payloader");
 
+  base64_quark = g_quark_from_static_string("GstRtpAtlasPayBase64");
+
   gst_type_mark_as_plugin_api(GST_TYPE_RTP_ATLAS_AGGREGATE_MODE, 0);
+  gst_type_mark_as_plugin_api(GST_TYPE_RTP_ATLAS_TX_MODE, 0);
 }
 
 static void gst_rtp_atlas_pay_init(GstRtpAtlasPay *rtpatlaspay) {
   rtpatlaspay->queue = g_array_new(FALSE, FALSE, sizeof(guint));
   rtpatlaspay->vps =
       g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
-  rtpatlaspay->asps =
+  rtpatlaspay->cad =
       g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
-  rtpatlaspay->afps =
-      g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
-  rtpatlaspay->aaps =
-      g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
-  rtpatlaspay->last_asps_afps_aaps = -1;
   rtpatlaspay->asps_afps_aaps_interval = DEFAULT_CONFIG_INTERVAL;
+  rtpatlaspay->adaptive_config_interval = DEFAULT_ADAPTIVE_CONFIG_INTERVAL;
+  rtpatlaspay->config_interval_min = DEFAULT_CONFIG_INTERVAL_MIN;
+  rtpatlaspay->config_interval_max = DEFAULT_CONFIG_INTERVAL_MAX;
+  rtpatlaspay->adaptive_interval = DEFAULT_CONFIG_INTERVAL_MAX;
   rtpatlaspay->aggregate_mode = DEFAULT_AGGREGATE_MODE;
+  rtpatlaspay->tx_mode = DEFAULT_TX_MODE;
+  rtpatlaspay->max_don_diff = DEFAULT_MAX_DON_DIFF;
+  rtpatlaspay->tile_id_pres = DEFAULT_TILE_ID_PRES;
+  rtpatlaspay->max_temporal_id = DEFAULT_MAX_TEMPORAL_ID;
+  rtpatlaspay->atlas_id_ext_id = DEFAULT_ATLAS_ID_EXT_ID;
+  rtpatlaspay->protect_key_units = DEFAULT_PROTECT_KEY_UNITS;
+  g_mutex_init(&rtpatlaspay->mux_lock);
+
+  rtpatlaspay->default_atlas = gst_rtp_atlas_pay_atlas_new(rtpatlaspay);
+  rtpatlaspay->current_atlas = rtpatlaspay->default_atlas;
 
   gst_pad_set_query_function(GST_RTP_BASE_PAYLOAD_SRCPAD(rtpatlaspay),
                              gst_rtp_atlas_pay_src_query);
 }
 
+static GstRtpAtlasPayAtlas *
+gst_rtp_atlas_pay_atlas_new(GstRtpAtlasPay *rtpatlaspay) {
+  GstRtpAtlasPayAtlas *atlas = g_new0(GstRtpAtlasPayAtlas, 1);
+
+  atlas->asps = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  atlas->afps = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  atlas->aaps = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  atlas->sei = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  atlas->last_asps_afps_aaps = -1;
+  atlas->temporal_id_limit = rtpatlaspay->max_temporal_id;
+
+  return atlas;
+}
+
+static void gst_rtp_atlas_pay_atlas_free(GstRtpAtlasPayAtlas *atlas) {
+  g_ptr_array_free(atlas->asps, TRUE);
+  g_ptr_array_free(atlas->afps, TRUE);
+  g_ptr_array_free(atlas->aaps, TRUE);
+  g_ptr_array_free(atlas->sei, TRUE);
+  gst_clear_buffer(&atlas->held_nal);
+  g_free(atlas);
+}
+
+/* VPS and common atlas data are shared by the atlases of the session and
+ * only cleared with the atlas of the sink pad */
 static void
 gst_rtp_atlas_pay_clear_asps_afps_aaps(GstRtpAtlasPay *rtpatlaspay) {
-  g_ptr_array_set_size(rtpatlaspay->vps, 0);
-  g_ptr_array_set_size(rtpatlaspay->asps, 0);
-  g_ptr_array_set_size(rtpatlaspay->afps, 0);
-  g_ptr_array_set_size(rtpatlaspay->aaps, 0);
+  GstRtpAtlasPayAtlas *atlas = rtpatlaspay->current_atlas;
+
+  if (atlas == rtpatlaspay->default_atlas) {
+    g_ptr_array_set_size(rtpatlaspay->vps, 0);
+    g_ptr_array_set_size(rtpatlaspay->cad, 0);
+  }
+  g_ptr_array_set_size(atlas->asps, 0);
+  g_ptr_array_set_size(atlas->afps, 0);
+  g_ptr_array_set_size(atlas->aaps, 0);
+  g_ptr_array_set_size(atlas->sei, 0);
 }
 
 static void gst_rtp_atlas_pay_finalize(GObject *object) {
@@ -243,12 +454,16 @@ static void gst_rtp_atlas_pay_finalize(GObject *object) {
 
   g_array_free(rtpatlaspay->queue, TRUE);
 
-  g_ptr_array_free(rtpatlaspay->afps, TRUE);
-  g_ptr_array_free(rtpatlaspay->aaps, TRUE);
-  g_ptr_array_free(rtpatlaspay->asps, TRUE);
+  gst_rtp_atlas_pay_atlas_free(rtpatlaspay->default_atlas);
+  g_ptr_array_free(rtpatlaspay->cad, TRUE);
   g_ptr_array_free(rtpatlaspay->vps, TRUE);
 
+  if (rtpatlaspay->outcaps_fields)
+    gst_structure_free(rtpatlaspay->outcaps_fields);
+  g_free(rtpatlaspay->sdp_fmtp_parameters);
+
   gst_rtp_atlas_pay_reset_bundle(rtpatlaspay);
+  g_mutex_clear(&rtpatlaspay->mux_lock);
 
   G_OBJECT_CLASS(parent_class)->finalize(object);
 }
@@ -266,14 +481,15 @@ static gboolean gst_rtp_atlas_pay_src_query(GstPad *pad, GstObject *parent,
     if (!retval)
       return retval;
 
-    if (rtpatlaspay->stream_format == GST_ATLAS_STREAM_FORMAT_UNKNOWN ||
-        rtpatlaspay->alignment == GST_ATLAS_ALIGNMENT_UNKNOWN)
+    if (rtpatlaspay->default_atlas->stream_format ==
+            GST_ATLAS_STREAM_FORMAT_UNKNOWN ||
+        rtpatlaspay->default_atlas->alignment == GST_ATLAS_ALIGNMENT_UNKNOWN)
       return FALSE;
 
     gst_query_parse_latency(query, &live, &min_latency, &max_latency);
 
     if (rtpatlaspay->aggregate_mode == GST_RTP_ATLAS_AGGREGATE_MAX &&
-        rtpatlaspay->alignment != GST_ATLAS_ALIGNMENT_AU &&
+        rtpatlaspay->default_atlas->alignment != GST_ATLAS_ALIGNMENT_AU &&
         rtpatlaspay->fps_num) {
       GstClockTime one_frame = gst_util_uint64_scale_int(
           GST_SECOND, rtpatlaspay->fps_denum, rtpatlaspay->fps_num);
@@ -339,125 +555,254 @@ done:
   return caps;
 }
 
+/* base64 of a parameter set, kept on the buffer so that renegotiation does
+ * not encode the same set again */
+static const gchar *gst_rtp_atlas_pay_get_base64(GstBuffer *buffer) {
+  gchar *base64;
+  GstMapInfo map;
+
+  base64 = gst_mini_object_get_qdata(GST_MINI_OBJECT_CAST(buffer),
+                                     base64_quark);
+  if (base64)
+    return base64;
+
+  gst_buffer_map(buffer, &map, GST_MAP_READ);
+  base64 = g_base64_encode(map.data, map.size);
+  gst_buffer_unmap(buffer, &map);
+
+  gst_mini_object_set_qdata(GST_MINI_OBJECT_CAST(buffer), base64_quark, base64,
+                            g_free);
+
+  return base64;
+}
+
+/* appends the NAL units as a comma separated list of base64 strings,
+ * returns the number of units appended */
+static guint gst_rtp_atlas_pay_append_base64(GString *string,
+                                             GPtrArray *units) {
+  guint i;
+
+  for (i = 0; i < units->len; i++) {
+    if (string->len)
+      g_string_append_c(string, ',');
+    g_string_append(string, gst_rtp_atlas_pay_get_base64(
+                                GST_BUFFER_CAST(g_ptr_array_index(units, i))));
+  }
+
+  return units->len;
+}
+
+/* Sets the SRC caps with the optional parameters in fields, taking them,
+ * unless they are the ones of the current caps */
 static gboolean
-gst_rtp_atlas_pay_setcaps_optional_parameters(GstRTPBasePayload *basepayload) {
+gst_rtp_atlas_pay_set_outcaps_fields(GstRTPBasePayload *basepayload,
+                                     GstStructure *fields) {
   GstRtpAtlasPay *payloader = GST_RTP_ATLAS_PAY(basepayload);
-  gchar *set;
-  GString *atlas_data_string = g_string_new("");
-  GString *vps_string = g_string_new("");
-  GString *vuh_string = g_string_new("");
-  guint count = 0;
-  guint8 v3c_parameter_set_id = 0;
-  guint8 atlas_id = 0;
-  guint8 unit_type = 0;
   gboolean res;
-  GstMapInfo map;
-  guint i;
 
-  if (payloader->vps->len == 0) {
+  if (payloader->outcaps_fields &&
+      gst_structure_is_equal(fields, payloader->outcaps_fields) &&
+      gst_pad_has_current_caps(GST_RTP_BASE_PAYLOAD_SRCPAD(basepayload))) {
+    GST_LOG_OBJECT(payloader, "optional parameters unchanged");
+    gst_structure_free(fields);
+    return TRUE;
+  }
+
+  if (gst_structure_n_fields(fields) == 0)
     res = gst_rtp_base_payload_set_outcaps(basepayload, NULL);
-    g_string_free(vps_string, TRUE);
-    return res;
+  else
+    res = gst_rtp_base_payload_set_outcaps_structure(basepayload, fields);
+
+  GST_OBJECT_LOCK(payloader);
+  if (payloader->outcaps_fields)
+    gst_structure_free(payloader->outcaps_fields);
+  payloader->outcaps_fields = fields;
+  if (!res) {
+    gst_structure_free(payloader->outcaps_fields);
+    payloader->outcaps_fields = NULL;
   }
+  g_clear_pointer(&payloader->sdp_fmtp_parameters, g_free);
+  GST_OBJECT_UNLOCK(payloader);
 
-  GstBuffer *vps_buffer = GST_BUFFER_CAST(g_ptr_array_index(payloader->vps, 0));
+  return res;
+}
 
-  gst_buffer_map(vps_buffer, &map, GST_MAP_READ);
-  set = g_base64_encode(map.data, map.size);
-  gst_buffer_unmap(vps_buffer, &map);
-  g_string_append_printf(vps_string, "%s", set);
-  g_free(set);
+/* The atlas specific parameters are the ones of the atlas of the sink pad,
+ * the receiver gets the atlases of the request pads from their in-band
+ * parameter sets */
+static gboolean
+gst_rtp_atlas_pay_setcaps_optional_parameters(GstRTPBasePayload *basepayload) {
+  GstRtpAtlasPay *payloader = GST_RTP_ATLAS_PAY(basepayload);
+  GstRtpAtlasPayAtlas *atlas = payloader->default_atlas;
+  GstStructure *fields;
+  GString *string;
+  GstBuffer *vps_buffer;
+
+  fields = gst_structure_new_empty("application/x-rtp");
+
+  /* session parameters, they describe the packets sent before the VPS and
+   * the atlas are known too */
+  if (payloader->tx_mode == GST_RTP_ATLAS_TX_MODE_MRST)
+    gst_structure_set(fields, "tx-mode", G_TYPE_STRING, "MRST", NULL);
+  if (payloader->max_don_diff > 0)
+    gst_structure_set(fields, "sprop-max-don-diff", G_TYPE_INT,
+                      (gint)payloader->max_don_diff, NULL);
+  if (payloader->tile_id_pres)
+    gst_structure_set(fields, "v3c-tile-id-pres", G_TYPE_INT, 1, NULL);
+  if (payloader->atlas_id_ext_id) {
+    gchar *extmap = g_strdup_printf("extmap-%u", payloader->atlas_id_ext_id);
+
+    gst_structure_set(fields, extmap, G_TYPE_STRING,
+                      GST_RTP_ATLAS_ID_EXTMAP_URI, NULL);
+    g_free(extmap);
+  }
 
-  guint8 ptl_tier_flag = gst_vps_data_get_ptl_tier_flag(vps_buffer);
-  guint8 ptl_codec_idc = gst_vps_data_get_ptl_codec_idc(vps_buffer);
-  guint8 ptl_toolset_idc = gst_vps_data_get_ptl_toolset_idc(vps_buffer);
-  guint8 ptl_rec_idc = gst_vps_data_get_ptl_rec_idc(vps_buffer);
-  guint8 ptl_level_idc = gst_vps_data_get_ptl_level_idc(vps_buffer);
+  if (payloader->vps->len == 0 || atlas->vuh == NULL)
+    return gst_rtp_atlas_pay_set_outcaps_fields(basepayload, fields);
 
-  res = gst_rtp_base_payload_set_outcaps(basepayload,  NULL);
+  vps_buffer = GST_BUFFER_CAST(g_ptr_array_index(payloader->vps, 0));
 
-  for (i = 0; i < payloader->asps->len; i++) {
-    GstBuffer *asps_buf =
-        GST_BUFFER_CAST(g_ptr_array_index(payloader->asps, i));
+  gst_structure_set(fields, "v3c-parameter-set", G_TYPE_STRING,
+                    gst_rtp_atlas_pay_get_base64(vps_buffer), NULL);
 
-    gst_buffer_map(asps_buf, &map, GST_MAP_READ);
-    set = g_base64_encode(map.data, map.size);
-    gst_buffer_unmap(asps_buf, &map);
+  gst_structure_set(fields, "v3c-unit-header", G_TYPE_STRING,
+                    gst_rtp_atlas_pay_get_base64(atlas->vuh),
+                    "v3c-atlas-id", G_TYPE_INT,
+                    gst_vuh_data_get_atlas_id(atlas->vuh), NULL);
 
-    g_string_append_printf(atlas_data_string, "%s%s", i ? "," : "", set);
-    g_free(set);
-    count++;
-  }
-  for (i = 0; i < payloader->afps->len; i++) {
-    GstBuffer *afps_buf =
-        GST_BUFFER_CAST(g_ptr_array_index(payloader->afps, i));
+  gst_structure_set(
+      fields, "v3c-vps-id", G_TYPE_INT,
+      gst_vuh_data_get_v3c_parameter_set_id(atlas->vuh), "v3c-unit-type",
+      G_TYPE_INT, gst_vuh_data_get_unit_type(atlas->vuh),
+      "v3c-ptl-tier-flag", G_TYPE_INT,
+      gst_vps_data_get_ptl_tier_flag(vps_buffer), "v3c-ptl-codec-idc",
+      G_TYPE_INT, gst_vps_data_get_ptl_codec_idc(vps_buffer),
+      "v3c-ptl-toolset-idc", G_TYPE_INT,
+      gst_vps_data_get_ptl_toolset_idc(vps_buffer), "v3c-ptl-rec-idc",
+      G_TYPE_INT, gst_vps_data_get_ptl_rec_idc(vps_buffer),
+      "v3c-ptl-level-idc", G_TYPE_INT,
+      gst_vps_data_get_ptl_level_idc(vps_buffer), NULL);
+
+  string = g_string_new(NULL);
+
+  if (gst_rtp_atlas_pay_append_base64(string, atlas->asps) +
+      gst_rtp_atlas_pay_append_base64(string, atlas->afps) +
+      gst_rtp_atlas_pay_append_base64(string, atlas->aaps))
+    gst_structure_set(fields, "v3c-atlas-data", G_TYPE_STRING, string->str,
+                      NULL);
+
+  g_string_truncate(string, 0);
+  if (gst_rtp_atlas_pay_append_base64(string, atlas->sei))
+    gst_structure_set(fields, "v3c-sei", G_TYPE_STRING, string->str, NULL);
 
-    gst_buffer_map(afps_buf, &map, GST_MAP_READ);
-    set = g_base64_encode(map.data, map.size);
-    gst_buffer_unmap(afps_buf, &map);
+  g_string_truncate(string, 0);
+  if (gst_rtp_atlas_pay_append_base64(string, payloader->cad))
+    gst_structure_set(fields, "v3c-common-atlas-data", G_TYPE_STRING,
+                      string->str, NULL);
 
-    g_string_append_printf(atlas_data_string, "%s%s", i ? "," : "", set);
-    g_free(set);
-    count++;
+  g_string_free(string, TRUE);
+
+  return gst_rtp_atlas_pay_set_outcaps_fields(basepayload, fields);
+}
+
+/* sorts the setup units of the codec_data into the parameter set, SEI
+ * and common atlas data arrays, the ones of other types are not signalled.
+ * Only CASPS and CAF_IDR are common atlas data that can be signalled, a
+ * CAF_TRAIL depends on the common atlas frames before it */
+static gboolean gst_rtp_atlas_pay_parse_setup_units(GstRtpAtlasPay *rtpatlaspay,
+                                                    GstBuffer *codec_data,
+                                                    GPtrArray *cad) {
+  GstRtpAtlasPayAtlas *atlas = rtpatlaspay->current_atlas;
+  GPtrArray *units;
+  guint i;
+
+  units = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+  if (!gst_codec_data_get_setup_units(codec_data, units)) {
+    g_ptr_array_free(units, TRUE);
+    return FALSE;
   }
-  for (i = 0; i < payloader->aaps->len; i++) {
-    GstBuffer *aaps_buf =
-        GST_BUFFER_CAST(g_ptr_array_index(payloader->aaps, i));
 
-    gst_buffer_map(aaps_buf, &map, GST_MAP_READ);
-    set = g_base64_encode(map.data, map.size);
-    gst_buffer_unmap(aaps_buf, &map);
+  for (i = 0; i < units->len; i++) {
+    GstBuffer *unit = g_ptr_array_index(units, i);
+    GPtrArray *array;
+    guint8 header;
+    guint8 nal_type;
+
+    gst_buffer_extract(unit, 0, &header, 1);
+    nal_type = (header >> 1) & 0x3f;
 
-    g_string_append_printf(atlas_data_string, "%s%s", i ? "," : "", set);
-    g_free(set);
-    count++;
+    switch (nal_type) {
+    case GST_ATLAS_NAL_ASPS:
+      array = atlas->asps;
+      break;
+    case GST_ATLAS_NAL_AFPS:
+      array = atlas->afps;
+      break;
+    case GST_ATLAS_NAL_AAPS:
+      array = atlas->aaps;
+      break;
+    case GST_ATLAS_NAL_PREFIX_NSEI:
+    case GST_ATLAS_NAL_PREFIX_ESEI:
+    case GST_ATLAS_NAL_SUFFIX_NSEI:
+    case GST_ATLAS_NAL_SUFFIX_ESEI:
+      array = atlas->sei;
+      break;
+    case GST_ATLAS_NAL_CASPS:
+    case GST_ATLAS_NAL_CAF_IDR:
+      array = cad;
+      break;
+    default:
+      GST_WARNING_OBJECT(rtpatlaspay, "ignoring setup unit of type %u in "
+                         "codec_data", nal_type);
+      continue;
+    }
+
+    GST_DEBUG_OBJECT(rtpatlaspay, "setup unit of type %u and size %"
+                     G_GSIZE_FORMAT " from codec_data", nal_type,
+                     gst_buffer_get_size(unit));
+    g_ptr_array_add(array, gst_buffer_ref(unit));
   }
 
-  gst_buffer_map(payloader->vuh, &map, GST_MAP_READ);
-
-  set = g_base64_encode(map.data, map.size);
-  g_string_append_printf(vuh_string, "%s", set);
-
-  v3c_parameter_set_id = gst_vuh_data_get_v3c_parameter_set_id(payloader->vuh);
-  atlas_id = gst_vuh_data_get_atlas_id(payloader->vuh);
-  unit_type = gst_vuh_data_get_unit_type(payloader->vuh);
-
-  if (G_LIKELY(count)) {
-    res = gst_rtp_base_payload_set_outcaps(
-        basepayload, "v3c-atlas-data", G_TYPE_STRING, atlas_data_string->str,
-        "v3c-parameter-set", G_TYPE_STRING, vps_string->str, "v3c-vps-id",
-        G_TYPE_INT, v3c_parameter_set_id, "v3c-atlas-id", G_TYPE_INT, atlas_id,
-        "v3c-unit-type", G_TYPE_INT, unit_type, "v3c-unit-header",
-        G_TYPE_STRING, vuh_string->str, "v3c-ptl-tier-flag", G_TYPE_INT,
-        ptl_tier_flag, "v3c-ptl-codec-idc", G_TYPE_INT, ptl_codec_idc,
-        "v3c-ptl-toolset-idc", G_TYPE_INT, ptl_toolset_idc, "v3c-ptl-rec-idc",
-        G_TYPE_INT, ptl_rec_idc, "v3c-ptl-level-idc", G_TYPE_INT, ptl_level_idc,
-        NULL);
-  } else {
-    res = gst_rtp_base_payload_set_outcaps(
-        basepayload, "v3c-parameter-set", G_TYPE_STRING, vps_string->str,
-        "v3c-vps-id", G_TYPE_INT, v3c_parameter_set_id, "v3c-atlas-id",
-        G_TYPE_INT, atlas_id, "v3c-unit-type", G_TYPE_INT, unit_type,
-        "v3c-unit-header", G_TYPE_STRING, vuh_string->str, "v3c-ptl-tier-flag",
-        G_TYPE_INT, ptl_tier_flag, "v3c-ptl-codec-idc", G_TYPE_INT,
-        ptl_codec_idc, "v3c-ptl-toolset-idc", G_TYPE_INT, ptl_toolset_idc,
-        "v3c-ptl-rec-idc", G_TYPE_INT, ptl_rec_idc, "v3c-ptl-level-idc",
-        G_TYPE_INT, ptl_level_idc, NULL);
+  g_ptr_array_free(units, TRUE);
+  return TRUE;
+}
+
+/* The VPS or common atlas data of a request pad atlas are the ones of the
+ * session, they are taken when the session has none yet */
+static gboolean gst_rtp_atlas_pay_merge_shared_units(GPtrArray *shared,
+                                                     GPtrArray *units) {
+  GstMapInfo map;
+  gboolean equal = TRUE;
+  guint i;
+
+  if (shared->len == 0) {
+    for (i = 0; i < units->len; i++)
+      g_ptr_array_add(shared, gst_buffer_ref(g_ptr_array_index(units, i)));
+    return TRUE;
   }
 
-  g_free(set);
-  g_string_free(vuh_string, TRUE);
-  gst_buffer_unmap(payloader->vuh, &map);
+  if (shared->len != units->len)
+    return FALSE;
 
-  g_string_free(atlas_data_string, TRUE);
-  g_string_free(vps_string, TRUE);
+  for (i = 0; equal && i < units->len; i++) {
+    GstBuffer *unit = g_ptr_array_index(units, i);
+    GstBuffer *shared_unit = g_ptr_array_index(shared, i);
 
-  return res;
+    if (gst_buffer_get_size(unit) != gst_buffer_get_size(shared_unit))
+      return FALSE;
+
+    gst_buffer_map(unit, &map, GST_MAP_READ);
+    equal = gst_buffer_memcmp(shared_unit, 0, map.data, map.size) == 0;
+    gst_buffer_unmap(unit, &map);
+  }
+
+  return equal;
 }
 
-static gboolean gst_rtp_atlas_pay_setcaps(GstRTPBasePayload *basepayload,
-                                          GstCaps *caps) {
+static gboolean gst_rtp_atlas_pay_set_atlas_caps(GstRTPBasePayload *basepayload,
+                                                 GstCaps *caps) {
   GstRtpAtlasPay *rtpatlaspay = NULL;
+  GstRtpAtlasPayAtlas *atlas = NULL;
   GstStructure *str = NULL;
   const GValue *value = NULL;
   GstMapInfo map;
@@ -466,24 +811,25 @@ static gboolean gst_rtp_atlas_pay_setcaps(GstRTPBasePayload *basepayload,
   const gchar *stream_format = NULL;
 
   rtpatlaspay = GST_RTP_ATLAS_PAY(basepayload);
+  atlas = rtpatlaspay->current_atlas;
 
   str = gst_caps_get_structure(caps, 0);
 
   gst_rtp_base_payload_set_options(basepayload, "application", TRUE, "v3c",
                                    90000);
 
-  rtpatlaspay->alignment = GST_ATLAS_ALIGNMENT_UNKNOWN;
+  atlas->alignment = GST_ATLAS_ALIGNMENT_UNKNOWN;
   alignment = gst_structure_get_string(str, "alignment");
   if (alignment) {
     if (g_str_equal(alignment, "au"))
-      rtpatlaspay->alignment = GST_ATLAS_ALIGNMENT_AU;
+      atlas->alignment = GST_ATLAS_ALIGNMENT_AU;
   }
 
-  rtpatlaspay->stream_format = GST_ATLAS_PAY_STREAM_FORMAT_UNKNOWN;
+  atlas->stream_format = GST_ATLAS_PAY_STREAM_FORMAT_UNKNOWN;
   stream_format = gst_structure_get_string(str, "stream-format");
   if (stream_format) {
     if (g_str_equal(stream_format, "v3cg"))
-      rtpatlaspay->stream_format = GST_ATLAS_PAY_STREAM_FORMAT_V3CG;
+      atlas->stream_format = GST_ATLAS_PAY_STREAM_FORMAT_V3CG;
   }
 
   if (!gst_structure_get_fraction(str, "framerate", &rtpatlaspay->fps_num,
@@ -508,29 +854,52 @@ static gboolean gst_rtp_atlas_pay_setcaps(GstRTPBasePayload *basepayload,
 
     unit_size_precision_bytes_minus1 =
         gst_codec_data_get_unit_size_precision_bytes_minus1(buffer);
-    rtpatlaspay->nal_length_size = unit_size_precision_bytes_minus1 + 1;
+    atlas->nal_length_size = unit_size_precision_bytes_minus1 + 1;
     GST_DEBUG_OBJECT(rtpatlaspay, "nal length %u",
-                     rtpatlaspay->nal_length_size);
+                     atlas->nal_length_size);
+
+    gst_rtp_atlas_pay_clear_asps_afps_aaps(rtpatlaspay);
+
+    GPtrArray *vps = rtpatlaspay->vps;
+    GPtrArray *cad = rtpatlaspay->cad;
+    if (atlas != rtpatlaspay->default_atlas) {
+      vps = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+      cad = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+    }
 
     GstBuffer *vps_buffer = gst_codec_data_get_vps_unit(buffer);
     if (vps_buffer)
-      g_ptr_array_add(rtpatlaspay->vps, vps_buffer);
+      g_ptr_array_add(vps, vps_buffer);
 
     gst_buffer_unmap(buffer, &map);
+
+    gboolean res = gst_rtp_atlas_pay_parse_setup_units(rtpatlaspay, buffer, cad);
+    if (atlas != rtpatlaspay->default_atlas) {
+      if (res && (!gst_rtp_atlas_pay_merge_shared_units(rtpatlaspay->vps, vps) ||
+                  !gst_rtp_atlas_pay_merge_shared_units(rtpatlaspay->cad, cad))) {
+        GST_ERROR_OBJECT(rtpatlaspay, "VPS or common atlas data in codec_data "
+                         "differ from the ones of the session");
+        res = FALSE;
+      }
+      g_ptr_array_free(vps, TRUE);
+      g_ptr_array_free(cad, TRUE);
+    }
+    if (!res)
+      return FALSE;
   } else {
     goto no_codec_data;
   }
 
   if ((value = gst_structure_get_value(str, "vuh_data"))) {
-    rtpatlaspay->vuh = gst_value_get_buffer(value);
-    gst_buffer_map(rtpatlaspay->vuh, &map, GST_MAP_READ);
+    atlas->vuh = gst_value_get_buffer(value);
+    gst_buffer_map(atlas->vuh, &map, GST_MAP_READ);
     /* get info from the vuh_data,
    i.e. v3c_unit_header from ISO/IEC 23090-5*/
     if (map.size != 4) {
-      gst_buffer_unmap(rtpatlaspay->vuh, &map);
+      gst_buffer_unmap(atlas->vuh, &map);
       goto vuhd_wrong_size;
     }
-    gst_buffer_unmap(rtpatlaspay->vuh, &map);
+    gst_buffer_unmap(atlas->vuh, &map);
 
   } else {
     goto no_vuh_data;
@@ -576,7 +945,8 @@ gst_rtp_atlas_pay_payload_nal(GstRTPBasePayload *basepayload,
 static GstFlowReturn
 gst_rtp_atlas_pay_payload_nal_single(GstRTPBasePayload *basepayload,
                                      GstBuffer *paybuf, GstClockTime dts,
-                                     GstClockTime pts, gboolean marker);
+                                     GstClockTime pts, gboolean marker,
+                                     gboolean protect);
 static GstFlowReturn gst_rtp_atlas_pay_payload_nal_fragment(
     GstRTPBasePayload *basepayload, GstBuffer *paybuf, GstClockTime dts,
     GstClockTime pts, gboolean marker, guint mtu, guint8 nal_type,
@@ -585,51 +955,69 @@ static GstFlowReturn gst_rtp_atlas_pay_payload_nal_bundle(
     GstRTPBasePayload *basepayload, GstBuffer *paybuf, GstClockTime dts,
     GstClockTime pts, gboolean marker, guint8 nal_type,
     const guint8 *nal_header, int size);
+static GstFlowReturn gst_rtp_atlas_pay_send_bundle(GstRtpAtlasPay *rtpatlaspay,
+                                                   gboolean marker);
+
+/* A key unit requested since the last re-send means receivers join or lose
+ * data, the next re-sends come sooner. Without requests the interval grows
+ * back towards config-interval-max-ms */
+static void gst_rtp_atlas_pay_adapt_config_interval(GstRtpAtlasPay *rtpatlaspay) {
+  gint requests;
+
+  if (!rtpatlaspay->adaptive_config_interval)
+    return;
+
+  requests = g_atomic_int_get(&rtpatlaspay->key_unit_requests);
+  g_atomic_int_add(&rtpatlaspay->key_unit_requests, -requests);
+  if (requests > 0)
+    rtpatlaspay->adaptive_interval = MAX(rtpatlaspay->adaptive_interval / 2,
+                                         rtpatlaspay->config_interval_min);
+  else
+    rtpatlaspay->adaptive_interval = MIN(rtpatlaspay->adaptive_interval * 2,
+                                         rtpatlaspay->config_interval_max);
+
+  GST_DEBUG_OBJECT(rtpatlaspay, "%d key unit requests, config interval %d ms",
+                   requests, rtpatlaspay->adaptive_interval);
+}
 
+/* Bundles the ASPS, AFPS and AAPS in front of the NAL unit being payloaded,
+ * which is bundled after them, so that they share its AP when they fit */
 static GstFlowReturn
 gst_rtp_atlas_pay_send_asps_afps_aaps(GstRTPBasePayload *basepayload,
                                       GstRtpAtlasPay *rtpatlaspay,
                                       GstClockTime dts, GstClockTime pts) {
+  GstRtpAtlasPayAtlas *atlas = rtpatlaspay->current_atlas;
+  GPtrArray *sets[] = {atlas->asps, atlas->afps, atlas->aaps};
   GstFlowReturn ret = GST_FLOW_OK;
-  gboolean sent_all_asps_afps_aaps = TRUE;
-  guint i;
-  GPtrArray *bufs;
-
-  bufs = g_ptr_array_new();
-
-  for (i = 0; i < rtpatlaspay->asps->len; i++) {
-    GstBuffer *asps_buf =
-        GST_BUFFER_CAST(g_ptr_array_index(rtpatlaspay->asps, i));
+  guint i, j;
 
-    GST_DEBUG_OBJECT(rtpatlaspay, "inserting ASPS in the stream");
-    g_ptr_array_add(bufs, gst_buffer_ref(asps_buf));
-  }
-  for (i = 0; i < rtpatlaspay->afps->len; i++) {
-    GstBuffer *afps_buf =
-        GST_BUFFER_CAST(g_ptr_array_index(rtpatlaspay->afps, i));
+  for (i = 0; ret == GST_FLOW_OK && i < G_N_ELEMENTS(sets); i++) {
+    for (j = 0; ret == GST_FLOW_OK && j < sets[i]->len; j++) {
+      GstBuffer *ps_buf = GST_BUFFER_CAST(g_ptr_array_index(sets[i], j));
+      guint8 nal_header[2];
+      guint8 nal_type;
 
-    GST_DEBUG_OBJECT(rtpatlaspay, "inserting AFPS in the stream");
-    g_ptr_array_add(bufs, gst_buffer_ref(afps_buf));
-  }
-  for (i = 0; i < rtpatlaspay->aaps->len; i++) {
-    GstBuffer *aaps_buf =
-        GST_BUFFER_CAST(g_ptr_array_index(rtpatlaspay->aaps, i));
+      gst_buffer_extract(ps_buf, 0, nal_header, 2);
+      nal_type = (nal_header[0] >> 1) & 0x3f;
 
-    GST_DEBUG_OBJECT(rtpatlaspay, "inserting AAPS in the stream");
-    g_ptr_array_add(bufs, gst_buffer_ref(aaps_buf));
+      GST_DEBUG_OBJECT(rtpatlaspay, "inserting parameter set %u in the stream",
+                       nal_type);
+      rtpatlaspay->nal_don = rtpatlaspay->don++;
+      ret = gst_rtp_atlas_pay_payload_nal_bundle(
+          basepayload, gst_buffer_ref(ps_buf), dts, pts, FALSE, nal_type,
+          nal_header, gst_buffer_get_size(ps_buf));
+    }
   }
 
-  ret = gst_rtp_atlas_pay_payload_nal(basepayload, bufs, dts, pts);
   if (ret != GST_FLOW_OK) {
     /* not critical but warn */
     GST_WARNING_OBJECT(basepayload, "failed pushing ASPS/AFPS/AAPS");
-
-    sent_all_asps_afps_aaps = FALSE;
+  } else if (pts != -1) {
+    atlas->last_asps_afps_aaps = gst_segment_to_running_time(
+        &basepayload->segment, GST_FORMAT_TIME, pts);
   }
 
-  if (pts != -1 && sent_all_asps_afps_aaps)
-    rtpatlaspay->last_asps_afps_aaps = gst_segment_to_running_time(
-        &basepayload->segment, GST_FORMAT_TIME, pts);
+  gst_rtp_atlas_pay_adapt_config_interval(rtpatlaspay);
 
   return ret;
 }
@@ -640,18 +1028,80 @@ static void gst_rtp_atlas_pay_reset_bundle(GstRtpAtlasPay *rtpatlaspay) {
   rtpatlaspay->bundle_contains_acl_or_suffix = FALSE;
 }
 
+/* size of the RTP header extension with the atlas_id: 4 bytes extension
+ * header and the one-byte element padded to 4 bytes */
+static guint gst_rtp_atlas_pay_atlas_id_ext_size(GstRtpAtlasPay *rtpatlaspay) {
+  return rtpatlaspay->atlas_id_ext_id ? 8 : 0;
+}
+
+/* the packet is allocated with gst_rtp_atlas_pay_atlas_id_ext_size() bytes
+ * of payload more, which the extension takes over */
+static void gst_rtp_atlas_pay_add_atlas_id_ext(GstRtpAtlasPay *rtpatlaspay,
+                                               GstRTPBuffer *rtp) {
+  GstRtpAtlasPayAtlas *atlas;
+  guint8 atlas_id;
+
+  if (!rtpatlaspay->atlas_id_ext_id)
+    return;
+
+  atlas = rtpatlaspay->current_atlas;
+  atlas_id = atlas->vuh ? gst_vuh_data_get_atlas_id(atlas->vuh) : 0;
+  gst_rtp_buffer_add_extension_onebyte_header(
+      rtp, rtpatlaspay->atlas_id_ext_id, &atlas_id, 1);
+}
+
+/* with protect-key-units, packets carrying a parameter set or a NAL unit of
+ * an IRAP access unit are flagged GST_BUFFER_FLAG_NON_DROPPABLE */
+static gboolean gst_rtp_atlas_pay_is_protected(GstRtpAtlasPay *rtpatlaspay,
+                                               guint8 nal_type) {
+  if (!rtpatlaspay->protect_key_units)
+    return FALSE;
+
+  return rtpatlaspay->key_au || nal_type == GST_ATLAS_NAL_ASPS ||
+         nal_type == GST_ATLAS_NAL_AFPS || nal_type == GST_ATLAS_NAL_AAPS ||
+         nal_type == GST_ATLAS_NAL_CASPS || nal_type == GST_ATLAS_NAL_CAF_IDR;
+}
+
+static gboolean gst_rtp_atlas_pay_is_signalled_cad(GstRtpAtlasPay *rtpatlaspay,
+                                                   GstBuffer *nal) {
+  gsize size = gst_buffer_get_size(nal);
+  GstMapInfo map;
+  gboolean found = FALSE;
+  guint i;
+
+  for (i = 0; !found && i < rtpatlaspay->cad->len; i++) {
+    GstBuffer *unit = g_ptr_array_index(rtpatlaspay->cad, i);
+
+    if (gst_buffer_get_size(unit) != size)
+      continue;
+
+    gst_buffer_map(unit, &map, GST_MAP_READ);
+    found = gst_buffer_memcmp(nal, 0, map.data, map.size) == 0;
+    gst_buffer_unmap(unit, &map);
+  }
+
+  return found;
+}
+
 static GstFlowReturn
 gst_rtp_atlas_pay_payload_nal(GstRTPBasePayload *basepayload,
                               GPtrArray *paybufs, GstClockTime dts,
                               GstClockTime pts) {
   GstRtpAtlasPay *rtpatlaspay;
+  GstRtpAtlasPayAtlas *atlas;
   guint mtu;
   GstFlowReturn ret;
   gint i;
-  gboolean sent_ps;
+  gboolean sent_ps, piggyback;
+  gint interval;
 
   rtpatlaspay = GST_RTP_ATLAS_PAY(basepayload);
-  mtu = GST_RTP_BASE_PAYLOAD_MTU(rtpatlaspay);
+  atlas = rtpatlaspay->current_atlas;
+  mtu = GST_RTP_BASE_PAYLOAD_MTU(rtpatlaspay) -
+        gst_rtp_atlas_pay_atlas_id_ext_size(rtpatlaspay);
+  interval = rtpatlaspay->adaptive_config_interval
+                 ? rtpatlaspay->adaptive_interval
+                 : rtpatlaspay->asps_afps_aaps_interval;
 
   /* should set src caps before pushing stuff,
    * and if we did not see enough ASPS/AFPS/AAPS, that may not be the case */
@@ -659,6 +1109,17 @@ gst_rtp_atlas_pay_payload_nal(GstRTPBasePayload *basepayload,
           !gst_pad_has_current_caps(GST_RTP_BASE_PAYLOAD_SRCPAD(basepayload))))
     gst_rtp_atlas_pay_setcaps_optional_parameters(basepayload);
 
+  /* all NAL units of an access unit with an IRAP are protected */
+  rtpatlaspay->key_au = FALSE;
+  for (i = 0; rtpatlaspay->protect_key_units && i < paybufs->len; i++) {
+    guint8 nal_header[1];
+
+    gst_buffer_extract(g_ptr_array_index(paybufs, i), 0, nal_header, 1);
+    if (((nal_header[0] >> 1) & 0x3f) >= GST_ATLAS_NAL_BLA_W_LP &&
+        ((nal_header[0] >> 1) & 0x3f) <= GST_ATLAS_NAL_RSV_IRAP_ACL_29)
+      rtpatlaspay->key_au = TRUE;
+  }
+
   ret = GST_FLOW_OK;
   sent_ps = FALSE;
   for (i = 0; i < paybufs->len; i++) {
@@ -688,7 +1149,19 @@ gst_rtp_atlas_pay_payload_nal(GstRTPBasePayload *basepayload,
                      " pts=%" GST_TIME_FORMAT,
                      size, nal_type, GST_TIME_ARGS(pts));
 
+    /* a static CASPS is signalled once in v3c-common-atlas-data, identical
+     * in-band copies are not sent. A CAF_IDR is a common atlas frame of the
+     * access unit, it stays in-band */
+    if (nal_type == GST_ATLAS_NAL_CASPS &&
+        gst_rtp_atlas_pay_is_signalled_cad(rtpatlaspay, paybuf)) {
+      GST_LOG_OBJECT(rtpatlaspay, "dropping in-band CASPS, signalled "
+                     "out-of-band");
+      gst_buffer_unref(paybuf);
+      continue;
+    }
+
     send_ps = FALSE;
+    piggyback = FALSE;
 
     /* check if we need to emit an ASPS/AFPS/AAPS now */
     if ((nal_type == GST_ATLAS_NAL_TRAIL_N) ||
@@ -705,8 +1178,8 @@ gst_rtp_atlas_pay_payload_nal(GstRTPBasePayload *basepayload,
         (nal_type == GST_ATLAS_NAL_IDR_W_RADL) ||
         (nal_type == GST_ATLAS_NAL_IDR_N_LP) ||
         (nal_type == GST_ATLAS_NAL_CRA)) {
-      if (rtpatlaspay->asps_afps_aaps_interval > 0) {
-        if (rtpatlaspay->last_asps_afps_aaps != -1) {
+      if (interval > 0) {
+        if (atlas->last_asps_afps_aaps != -1) {
           guint64 diff;
           GstClockTime running_time = gst_segment_to_running_time(
               &basepayload->segment, GST_FORMAT_TIME, pts);
@@ -715,11 +1188,11 @@ gst_rtp_atlas_pay_payload_nal(GstRTPBasePayload *basepayload,
                          "now %" GST_TIME_FORMAT
                          ", last ASPS/AFPS/AAPS %" GST_TIME_FORMAT,
                          GST_TIME_ARGS(running_time),
-                         GST_TIME_ARGS(rtpatlaspay->last_asps_afps_aaps));
+                         GST_TIME_ARGS(atlas->last_asps_afps_aaps));
 
           /* calculate diff between last ASPS/AFPS in milliseconds */
-          if (running_time > rtpatlaspay->last_asps_afps_aaps)
-            diff = running_time - rtpatlaspay->last_asps_afps_aaps;
+          if (running_time > atlas->last_asps_afps_aaps)
+            diff = running_time - atlas->last_asps_afps_aaps;
           else
             diff = 0;
 
@@ -729,8 +1202,7 @@ gst_rtp_atlas_pay_payload_nal(GstRTPBasePayload *basepayload,
               GST_TIME_ARGS(diff));
 
           /* bigger than interval, queue ASPS/AFPS */
-          if (GST_TIME_AS_SECONDS(diff) >=
-              rtpatlaspay->asps_afps_aaps_interval) {
+          if (diff >= interval * GST_MSECOND) {
             GST_DEBUG_OBJECT(rtpatlaspay, "time to send ASPS/AFPS/AAPS");
             send_ps = TRUE;
           }
@@ -740,7 +1212,7 @@ gst_rtp_atlas_pay_payload_nal(GstRTPBasePayload *basepayload,
                            "no previous ASPS/AFPS/AAPS time, send now");
           send_ps = TRUE;
         }
-      } else if (rtpatlaspay->asps_afps_aaps_interval == -1 &&
+      } else if (interval == -1 &&
                  (nal_type == GST_ATLAS_NAL_IDR_W_RADL ||
                   nal_type == GST_ATLAS_NAL_IDR_N_LP)) {
         /* send ASPS/AFPS/AAPS before every IDR frame */
@@ -748,10 +1220,11 @@ gst_rtp_atlas_pay_payload_nal(GstRTPBasePayload *basepayload,
       }
     }
 
-    if (!sent_ps && (send_ps || rtpatlaspay->send_asps_afps_aaps)) {
+    if (!sent_ps && (send_ps || atlas->send_asps_afps_aaps)) {
       /* we need to send ASPS/AFPS now first. */
-      rtpatlaspay->send_asps_afps_aaps = FALSE;
+      atlas->send_asps_afps_aaps = FALSE;
       sent_ps = TRUE;
+      piggyback = TRUE;
       GST_DEBUG_OBJECT(rtpatlaspay,
                        "sending ASPS/AFPS/AAPS before current atlas frame");
       ret = gst_rtp_atlas_pay_send_asps_afps_aaps(basepayload, rtpatlaspay, dts,
@@ -762,13 +1235,23 @@ gst_rtp_atlas_pay_payload_nal(GstRTPBasePayload *basepayload,
       }
     }
 
-    if (rtpatlaspay->aggregate_mode != GST_RTP_ATLAS_AGGREGATE_NONE)
+    /* NAL units are payloaded in decoding order */
+    rtpatlaspay->nal_don = rtpatlaspay->don++;
+
+    if (rtpatlaspay->aggregate_mode != GST_RTP_ATLAS_AGGREGATE_NONE ||
+        piggyback)
       ret = gst_rtp_atlas_pay_payload_nal_bundle(
           basepayload, paybuf, dts, pts, marker, nal_type, nal_header, size);
     else
       ret = gst_rtp_atlas_pay_payload_nal_fragment(basepayload, paybuf, dts,
                                                    pts, marker, mtu, nal_type,
                                                    nal_header, size);
+
+    /* without aggregation only the parameter sets share the AP of the NAL
+     * unit they were sent for */
+    if (piggyback && ret == GST_FLOW_OK &&
+        rtpatlaspay->aggregate_mode == GST_RTP_ATLAS_AGGREGATE_NONE)
+      ret = gst_rtp_atlas_pay_send_bundle(rtpatlaspay, FALSE);
   }
 
   g_ptr_array_free(paybufs, TRUE);
@@ -776,10 +1259,55 @@ gst_rtp_atlas_pay_payload_nal(GstRTPBasePayload *basepayload,
   return ret;
 }
 
+/* size of the conditional DONL and v3c-tile-id fields of a packet */
+static guint gst_rtp_atlas_pay_header_fields_size(GstRtpAtlasPay *rtpatlaspay) {
+  return (GST_RTP_ATLAS_PAY_HAS_DONL(rtpatlaspay) ? 2 : 0) +
+         (rtpatlaspay->tile_id_pres ? 2 : 0);
+}
+
+static guint16 gst_rtp_atlas_pay_get_tile_id(GstBuffer *nal) {
+  GstAtlasTileMeta *meta = gst_buffer_get_atlas_tile_meta(nal);
+
+  return meta ? meta->tile_id : 0;
+}
+
+/* Returns the NAL unit with the DONL and v3c-tile-id fields inserted after
+ * its header, takes ownership of nal */
+static GstBuffer *
+gst_rtp_atlas_pay_insert_header_fields(GstRtpAtlasPay *rtpatlaspay,
+                                       GstBuffer *nal, guint16 don) {
+  GstBuffer *outbuf;
+  GstMemory *fields;
+  GstMapInfo map;
+  guint8 *data;
+
+  outbuf = gst_buffer_copy_region(nal, GST_BUFFER_COPY_ALL, 0, 2);
+
+  fields = gst_allocator_alloc(
+      NULL, gst_rtp_atlas_pay_header_fields_size(rtpatlaspay), NULL);
+  gst_memory_map(fields, &map, GST_MAP_WRITE);
+  data = map.data;
+  if (GST_RTP_ATLAS_PAY_HAS_DONL(rtpatlaspay)) {
+    GST_WRITE_UINT16_BE(data, don);
+    data += 2;
+  }
+  if (rtpatlaspay->tile_id_pres)
+    GST_WRITE_UINT16_BE(data, gst_rtp_atlas_pay_get_tile_id(nal));
+  gst_memory_unmap(fields, &map);
+  gst_buffer_append_memory(outbuf, fields);
+
+  gst_buffer_copy_into(outbuf, nal, GST_BUFFER_COPY_MEMORY, 2, -1);
+  gst_buffer_unref(nal);
+
+  return outbuf;
+}
+
 static GstFlowReturn
 gst_rtp_atlas_pay_payload_nal_single(GstRTPBasePayload *basepayload,
                                      GstBuffer *paybuf, GstClockTime dts,
-                                     GstClockTime pts, gboolean marker) {
+                                     GstClockTime pts, gboolean marker,
+                                     gboolean protect) {
+  GstRtpAtlasPay *rtpatlaspay = GST_RTP_ATLAS_PAY(basepayload);
   GstBufferList *outlist;
   GstBuffer *outbuf;
   GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
@@ -787,9 +1315,11 @@ gst_rtp_atlas_pay_payload_nal_single(GstRTPBasePayload *basepayload,
   /* use buffer lists
    * create buffer without payload containing only the RTP header
    * (memory block at index 0) */
-  outbuf = gst_rtp_buffer_new_allocate(0, 0, 0);
+  outbuf = gst_rtp_buffer_new_allocate(
+      gst_rtp_atlas_pay_atlas_id_ext_size(rtpatlaspay), 0, 0);
 
   gst_rtp_buffer_map(outbuf, GST_MAP_WRITE, &rtp);
+  gst_rtp_atlas_pay_add_atlas_id_ext(rtpatlaspay, &rtp);
 
   /* Mark the end of a frame */
   gst_rtp_buffer_set_marker(&rtp, marker);
@@ -798,6 +1328,9 @@ gst_rtp_atlas_pay_payload_nal_single(GstRTPBasePayload *basepayload,
   GST_BUFFER_PTS(outbuf) = pts;
   GST_BUFFER_DTS(outbuf) = dts;
 
+  if (protect)
+    GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_NON_DROPPABLE);
+
   /* insert payload memory block */
   gst_rtp_copy_video_meta(basepayload, outbuf, paybuf);
   outbuf = gst_buffer_append(outbuf, paybuf);
@@ -825,13 +1358,21 @@ static GstFlowReturn gst_rtp_atlas_pay_payload_nal_fragment(
   GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
   guint8 *payload;
 
-  if (gst_rtp_buffer_calc_packet_len(size, 0, 0) < mtu) {
+  guint fields_size;
+
+  fields_size = gst_rtp_atlas_pay_header_fields_size(rtpatlaspay);
+
+  if (gst_rtp_buffer_calc_packet_len(size + fields_size, 0, 0) < mtu) {
     GST_DEBUG_OBJECT(rtpatlaspay,
                      "NAL Unit fit in one packet datasize=%d mtu=%d", size,
                      mtu);
+    if (fields_size)
+      paybuf = gst_rtp_atlas_pay_insert_header_fields(rtpatlaspay, paybuf,
+                                                      rtpatlaspay->nal_don);
     /* will fit in one packet */
-    return gst_rtp_atlas_pay_payload_nal_single(basepayload, paybuf, dts, pts,
-                                                marker);
+    return gst_rtp_atlas_pay_payload_nal_single(
+        basepayload, paybuf, dts, pts, marker,
+        gst_rtp_atlas_pay_is_protected(rtpatlaspay, nal_type));
   }
 
   GST_DEBUG_OBJECT(basepayload,
@@ -841,8 +1382,10 @@ static GstFlowReturn gst_rtp_atlas_pay_payload_nal_fragment(
   GST_DEBUG_OBJECT(basepayload, "Using FU fragmentation for data size=%d",
                    size - 2);
 
-  /* We keep 3 bytes for RTP payload header (NUT=57) and FU Header */
-  max_fragment_size = gst_rtp_buffer_calc_payload_len(mtu - 3, 0, 0);
+  /* We keep 3 bytes for RTP payload header (NUT=57) and FU Header, and the
+   * DONL and v3c-tile-id fields if present */
+  max_fragment_size =
+      gst_rtp_buffer_calc_payload_len(mtu - 3 - fields_size, 0, 0);
 
   outlist = gst_buffer_list_new();
 
@@ -864,12 +1407,18 @@ static GstFlowReturn gst_rtp_atlas_pay_payload_nal_fragment(
     /* use buffer lists
      * create buffer without payload containing only the RTP header
      * (memory block at index 0), and with space for PayloadHdr and FU header */
-    outbuf = gst_rtp_buffer_new_allocate(3, 0, 0);
+    outbuf = gst_rtp_buffer_new_allocate(
+        (first_fragment ? 3 + fields_size : 3) +
+            gst_rtp_atlas_pay_atlas_id_ext_size(rtpatlaspay),
+        0, 0);
 
     gst_rtp_buffer_map(outbuf, GST_MAP_WRITE, &rtp);
+    gst_rtp_atlas_pay_add_atlas_id_ext(rtpatlaspay, &rtp);
 
     GST_BUFFER_DTS(outbuf) = dts;
     GST_BUFFER_PTS(outbuf) = pts;
+    if (gst_rtp_atlas_pay_is_protected(rtpatlaspay, nal_type))
+      GST_BUFFER_FLAG_SET(outbuf, GST_BUFFER_FLAG_NON_DROPPABLE);
     payload = gst_rtp_buffer_get_payload(&rtp);
 
     /* RTP payload header (type = FU_NUT (57)) */
@@ -884,6 +1433,13 @@ static GstFlowReturn gst_rtp_atlas_pay_payload_nal_fragment(
     payload[2] =
         (first_fragment << 7) | (last_fragment << 6) | (nal_type & 0x3f);
 
+    /* DONL and v3c-tile-id are only present in the first fragment */
+    if (first_fragment && GST_RTP_ATLAS_PAY_HAS_DONL(rtpatlaspay))
+      GST_WRITE_UINT16_BE(payload + 3, rtpatlaspay->nal_don);
+    if (first_fragment && rtpatlaspay->tile_id_pres)
+      GST_WRITE_UINT16_BE(payload + 3 + fields_size - 2,
+                          gst_rtp_atlas_pay_get_tile_id(paybuf));
+
     gst_rtp_buffer_unmap(&rtp);
 
     /* insert payload memory block */
@@ -907,6 +1463,7 @@ static GstFlowReturn gst_rtp_atlas_pay_send_bundle(GstRtpAtlasPay *rtpatlaspay,
   guint length, bundle_size;
   GstBuffer *first, *outbuf;
   GstClockTime dts, pts;
+  gboolean protect = FALSE;
 
   bundle_size = rtpatlaspay->bundle_size;
 
@@ -924,8 +1481,17 @@ static GstFlowReturn gst_rtp_atlas_pay_send_bundle(GstRtpAtlasPay *rtpatlaspay,
   pts = GST_BUFFER_PTS(first);
 
   if (length == 1) {
+    guint8 nal_header[2];
+
+    gst_buffer_extract(first, 0, &nal_header, sizeof nal_header);
+    protect = gst_rtp_atlas_pay_is_protected(rtpatlaspay,
+                                             (nal_header[0] >> 1) & 0x3f);
+
     /* Push unaggregated NALU */
     outbuf = gst_buffer_ref(first);
+    if (gst_rtp_atlas_pay_header_fields_size(rtpatlaspay))
+      outbuf = gst_rtp_atlas_pay_insert_header_fields(rtpatlaspay, outbuf,
+                                                      GST_BUFFER_OFFSET(first));
 
     GST_DEBUG_OBJECT(rtpatlaspay, "sending NAL Unit unaggregated: datasize=%u",
                      bundle_size - 2);
@@ -934,6 +1500,7 @@ static GstFlowReturn gst_rtp_atlas_pay_send_bundle(GstRtpAtlasPay *rtpatlaspay,
     guint i;
     guint8 layer_id = 0xFF;
     guint8 temporal_id = 0xFF;
+    guint16 prev_don = 0;
 
     outbuf = gst_buffer_new_allocate(NULL, sizeof ap_header, NULL);
 
@@ -951,6 +1518,9 @@ static GstFlowReturn gst_rtp_atlas_pay_send_bundle(GstRtpAtlasPay *rtpatlaspay,
       if ((nal_header[0] & 0x80))
         ap_header[0] |= 0x80;
 
+      protect |= gst_rtp_atlas_pay_is_protected(rtpatlaspay,
+                                                (nal_header[0] >> 1) & 0x3f);
+
       /* Select lowest layer_id & temporal_id */
       nal_layer_id =
           ((nal_header[0] & 0x01) << 5) | ((nal_header[1] >> 3) & 0x1F);
@@ -958,6 +1528,31 @@ static GstFlowReturn gst_rtp_atlas_pay_send_bundle(GstRtpAtlasPay *rtpatlaspay,
       layer_id = MIN(layer_id, nal_layer_id);
       temporal_id = MIN(temporal_id, nal_temporal_id);
 
+      /* DONL before the first aggregation unit, DOND before the others */
+      if (GST_RTP_ATLAS_PAY_HAS_DONL(rtpatlaspay)) {
+        GstMemory *don_field;
+        guint16 don = GST_BUFFER_OFFSET(buf);
+
+        don_field = gst_allocator_alloc(NULL, i == 0 ? 2 : 1, NULL);
+        gst_memory_map(don_field, &map, GST_MAP_WRITE);
+        if (i == 0)
+          GST_WRITE_UINT16_BE(map.data, don);
+        else
+          map.data[0] = (guint16)(don - prev_don - 1) & 0xff;
+        gst_memory_unmap(don_field, &map);
+        gst_buffer_append_memory(outbuf, don_field);
+        prev_don = don;
+      }
+
+      if (rtpatlaspay->tile_id_pres) {
+        GstMemory *tile_id_field = gst_allocator_alloc(NULL, 2, NULL);
+
+        gst_memory_map(tile_id_field, &map, GST_MAP_WRITE);
+        GST_WRITE_UINT16_BE(map.data, gst_rtp_atlas_pay_get_tile_id(buf));
+        gst_memory_unmap(tile_id_field, &map);
+        gst_buffer_append_memory(outbuf, tile_id_field);
+      }
+
       /* append NALU size */
       size_header = gst_allocator_alloc(NULL, 2, NULL);
       gst_memory_map(size_header, &map, GST_MAP_WRITE);
@@ -981,7 +1576,7 @@ static GstFlowReturn gst_rtp_atlas_pay_send_bundle(GstRtpAtlasPay *rtpatlaspay,
 
   gst_rtp_atlas_pay_reset_bundle(rtpatlaspay);
   return gst_rtp_atlas_pay_payload_nal_single(basepayload, outbuf, dts, pts,
-                                              marker);
+                                              marker, protect);
 }
 
 static gboolean gst_rtp_atlas_pay_payload_nal_bundle(
@@ -996,8 +1591,11 @@ static gboolean gst_rtp_atlas_pay_payload_nal_bundle(
   guint mtu;
 
   rtpatlaspay = GST_RTP_ATLAS_PAY(basepayload);
-  mtu = GST_RTP_BASE_PAYLOAD_MTU(rtpatlaspay);
-  pay_size = 2 + gst_buffer_get_size(paybuf);
+  mtu = GST_RTP_BASE_PAYLOAD_MTU(rtpatlaspay) -
+        gst_rtp_atlas_pay_atlas_id_ext_size(rtpatlaspay);
+  /* NALU size and, conservatively, a DONL and v3c-tile-id field */
+  pay_size = 2 + gst_buffer_get_size(paybuf) +
+             gst_rtp_atlas_pay_header_fields_size(rtpatlaspay);
   bundle = rtpatlaspay->bundle;
   start_of_au = FALSE;
 
@@ -1068,13 +1666,16 @@ static gboolean gst_rtp_atlas_pay_payload_nal_bundle(
   paybuf = gst_buffer_make_writable(paybuf);
   GST_BUFFER_PTS(paybuf) = pts;
   GST_BUFFER_DTS(paybuf) = dts;
+  GST_BUFFER_OFFSET(paybuf) = rtpatlaspay->nal_don;
 
   gst_buffer_list_add(bundle, gst_buffer_ref(paybuf));
   rtpatlaspay->bundle_size += pay_size;
   ret = GST_FLOW_OK;
 
-  /* in atlas, all ACL NAL units are < 35 */
-  if (nal_type < 35 || nal_type == GST_ATLAS_NAL_EOS ||
+  /* in atlas, all ACL NAL units are < 35, a common atlas frame is a
+   * single CAF NAL unit */
+  if (nal_type < 35 || nal_type == GST_ATLAS_NAL_CAF_IDR ||
+      nal_type == GST_ATLAS_NAL_CAF_TRAIL || nal_type == GST_ATLAS_NAL_EOS ||
       nal_type == GST_ATLAS_NAL_EOB || nal_type == GST_ATLAS_NAL_SUFFIX_NSEI ||
       nal_type == GST_ATLAS_NAL_SUFFIX_ESEI ){
         rtpatlaspay->bundle_contains_acl_or_suffix = TRUE;
@@ -1090,21 +1691,47 @@ out:
   return ret;
 }
 
+/* Sends the NAL unit held back with alignment=nal, with the marker when the
+ * access unit ends with it */
 static GstFlowReturn
-gst_rtp_atlas_pay_handle_buffer(GstRTPBasePayload *basepayload,
-                                GstBuffer *buffer) {
+gst_rtp_atlas_pay_send_held_nal(GstRTPBasePayload *basepayload,
+                                gboolean marker) {
+  GstRtpAtlasPayAtlas *atlas = GST_RTP_ATLAS_PAY(basepayload)->current_atlas;
+  GPtrArray *paybufs;
+  GstBuffer *paybuf;
+
+  if (atlas->held_nal == NULL)
+    return GST_FLOW_OK;
+
+  paybuf = g_steal_pointer(&atlas->held_nal);
+  if (marker)
+    GST_BUFFER_FLAG_SET(paybuf, GST_BUFFER_FLAG_MARKER);
+  paybufs = g_ptr_array_new();
+  g_ptr_array_add(paybufs, paybuf);
+
+  return gst_rtp_atlas_pay_payload_nal(basepayload, paybufs,
+                                       atlas->held_dts,
+                                       atlas->held_pts);
+}
+
+static GstFlowReturn
+gst_rtp_atlas_pay_handle_atlas_buffer(GstRTPBasePayload *basepayload,
+                                      GstBuffer *buffer) {
   GstRtpAtlasPay *rtpatlaspay;
+  GstRtpAtlasPayAtlas *atlas;
   GstFlowReturn ret;
   guint nal_len;
   GstClockTime dts, pts;
   GstBuffer *paybuf = NULL;
   gboolean marker = FALSE;
+  gboolean marker_dropped = FALSE;
   gboolean discont = FALSE;
 
   if (buffer == NULL)
     return GST_FLOW_OK;
 
   rtpatlaspay = GST_RTP_ATLAS_PAY(basepayload);
+  atlas = rtpatlaspay->current_atlas;
 
   ret = GST_FLOW_OK;
 
@@ -1116,7 +1743,7 @@ gst_rtp_atlas_pay_handle_buffer(GstRTPBasePayload *basepayload,
   GPtrArray *paybufs;
 
   paybufs = g_ptr_array_new();
-  nal_length_size = rtpatlaspay->nal_length_size;
+  nal_length_size = atlas->nal_length_size;
 
   gst_buffer_memory_map(buffer, &memory);
   remaining_buffer_size = gst_buffer_get_size(buffer);
@@ -1147,16 +1774,61 @@ gst_rtp_atlas_pay_handle_buffer(GstRTPBasePayload *basepayload,
       GST_DEBUG_OBJECT(basepayload, "got incomplete NAL of size %u", nal_len);
     }
 
+    /* temporal sub-layer thinning, the marker moves to the last NAL unit
+     * that is kept */
+    if (nal_len >= 2) {
+      guint8 nal_header[2];
+
+      gst_buffer_extract(buffer, offset, nal_header, 2);
+      if (!gst_atlas_nal_temporal_id_allowed(
+              (nal_header[0] >> 1) & 0x3f, nal_header[1] & 0x07,
+              rtpatlaspay->max_temporal_id,
+              &atlas->temporal_id_limit)) {
+        GST_LOG_OBJECT(basepayload, "dropping NAL of temporal id %u",
+                       (nal_header[1] & 0x07) - 1);
+        if (remaining_buffer_size - nal_len <= nal_length_size &&
+            (atlas->alignment == GST_ATLAS_ALIGNMENT_AU || marker)) {
+          if (paybufs->len > 0)
+            GST_BUFFER_FLAG_SET(
+                GST_BUFFER_CAST(g_ptr_array_index(paybufs, paybufs->len - 1)),
+                GST_BUFFER_FLAG_MARKER);
+          else
+            marker_dropped = TRUE;
+        }
+        if (!gst_buffer_memory_advance_bytes(&memory, nal_len))
+          break;
+        offset += nal_len;
+        remaining_buffer_size -= nal_len;
+        continue;
+      }
+    }
+
     paybuf =
         gst_buffer_copy_region(buffer, GST_BUFFER_COPY_ALL, offset, nal_len);
     g_ptr_array_add(paybufs, paybuf);
 
+    /* tile metas locate the length prefixed NAL unit in the AU */
+    if (rtpatlaspay->tile_id_pres) {
+      gpointer state = NULL;
+      GstMeta *meta;
+
+      while ((meta = gst_buffer_iterate_meta_filtered(
+                  buffer, &state, GST_ATLAS_TILE_META_API_TYPE))) {
+        GstAtlasTileMeta *tmeta = (GstAtlasTileMeta *)meta;
+
+        if (tmeta->offset == offset - nal_length_size) {
+          gst_buffer_add_atlas_tile_meta(paybuf, tmeta->tile_id, 0, nal_len);
+          break;
+        }
+      }
+    }
+
     /* If we're at the end of the buffer, then we're at the end of the
      * access unit
      */
     GST_BUFFER_FLAG_UNSET(paybuf, GST_BUFFER_FLAG_MARKER);
     if (remaining_buffer_size - nal_len <= nal_length_size) {
-      if (rtpatlaspay->alignment == GST_ATLAS_ALIGNMENT_AU || marker)
+      if (atlas->alignment == GST_ATLAS_ALIGNMENT_AU || marker)
         GST_BUFFER_FLAG_SET(paybuf, GST_BUFFER_FLAG_MARKER);
     }
 
@@ -1176,7 +1848,32 @@ gst_rtp_atlas_pay_handle_buffer(GstRTPBasePayload *basepayload,
     remaining_buffer_size -= nal_len;
   }
 
-  ret = gst_rtp_atlas_pay_payload_nal(basepayload, paybufs, dts, pts);
+  /* the NAL unit held back from the previous buffer precedes these ones,
+   * it ends the access unit when the one carrying the marker was dropped */
+  if (atlas->held_nal && (paybufs->len > 0 || marker_dropped))
+    ret = gst_rtp_atlas_pay_send_held_nal(basepayload, marker_dropped);
+  else if (marker_dropped && rtpatlaspay->bundle_size > 0)
+    ret = gst_rtp_atlas_pay_send_bundle(rtpatlaspay, TRUE);
+
+  if (ret == GST_FLOW_OK &&
+      atlas->alignment != GST_ATLAS_ALIGNMENT_AU &&
+      rtpatlaspay->max_temporal_id < DEFAULT_MAX_TEMPORAL_ID &&
+      paybufs->len > 0 &&
+      !GST_BUFFER_FLAG_IS_SET(
+          GST_BUFFER_CAST(g_ptr_array_index(paybufs, paybufs->len - 1)),
+          GST_BUFFER_FLAG_MARKER)) {
+    atlas->held_nal =
+        g_ptr_array_remove_index(paybufs, paybufs->len - 1);
+    atlas->held_pts = pts;
+    atlas->held_dts = dts;
+  }
+
+  if (ret == GST_FLOW_OK) {
+    ret = gst_rtp_atlas_pay_payload_nal(basepayload, paybufs, dts, pts);
+  } else {
+    g_ptr_array_set_free_func(paybufs, (GDestroyNotify)gst_buffer_unref);
+    g_ptr_array_free(paybufs, TRUE);
+  }
 
   gst_buffer_memory_unmap(&memory);
   gst_buffer_unref(buffer);
@@ -1192,16 +1889,280 @@ gst_rtp_atlas_pay_handle_buffer(GstRTPBasePayload *basepayload,
   return ret;
 }
 
+static GstFlowReturn
+gst_rtp_atlas_pay_handle_buffer(GstRTPBasePayload *basepayload,
+                                GstBuffer *buffer) {
+  GstRtpAtlasPay *rtpatlaspay = GST_RTP_ATLAS_PAY(basepayload);
+  GstFlowReturn ret;
+
+  g_mutex_lock(&rtpatlaspay->mux_lock);
+  ret = gst_rtp_atlas_pay_handle_atlas_buffer(basepayload, buffer);
+  g_mutex_unlock(&rtpatlaspay->mux_lock);
+
+  return ret;
+}
+
+static gboolean gst_rtp_atlas_pay_setcaps(GstRTPBasePayload *basepayload,
+                                          GstCaps *caps) {
+  GstRtpAtlasPay *rtpatlaspay = GST_RTP_ATLAS_PAY(basepayload);
+  gboolean res;
+
+  g_mutex_lock(&rtpatlaspay->mux_lock);
+  res = gst_rtp_atlas_pay_set_atlas_caps(basepayload, caps);
+  g_mutex_unlock(&rtpatlaspay->mux_lock);
+
+  return res;
+}
+
+/* Makes atlas the current one. An aggregation packet in progress belongs
+ * to the previous atlas and is sent first. Called with the mux lock */
+static GstFlowReturn gst_rtp_atlas_pay_select_atlas(GstRtpAtlasPay *rtpatlaspay,
+                                                    GstRtpAtlasPayAtlas *atlas) {
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (rtpatlaspay->current_atlas == atlas)
+    return GST_FLOW_OK;
+
+  if (rtpatlaspay->bundle_size > 0)
+    ret = gst_rtp_atlas_pay_send_bundle(rtpatlaspay, FALSE);
+  rtpatlaspay->current_atlas = atlas;
+
+  return ret;
+}
+
+static GstFlowReturn gst_rtp_atlas_pay_atlas_chain(GstPad *pad,
+                                                   GstObject *parent,
+                                                   GstBuffer *buffer) {
+  GstRtpAtlasPay *rtpatlaspay = GST_RTP_ATLAS_PAY(parent);
+  GstRtpAtlasPayAtlas *atlas = gst_pad_get_element_private(pad);
+  GstFlowReturn ret;
+
+  g_mutex_lock(&rtpatlaspay->mux_lock);
+  if (G_UNLIKELY(atlas->vuh == NULL)) {
+    g_mutex_unlock(&rtpatlaspay->mux_lock);
+    gst_buffer_unref(buffer);
+    GST_ELEMENT_ERROR(rtpatlaspay, CORE, NEGOTIATION, (NULL),
+                      ("no caps on pad %s", GST_PAD_NAME(pad)));
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  ret = gst_rtp_atlas_pay_select_atlas(rtpatlaspay, atlas);
+  if (ret == GST_FLOW_OK)
+    ret = gst_rtp_atlas_pay_handle_atlas_buffer(
+        GST_RTP_BASE_PAYLOAD(rtpatlaspay), buffer);
+  else
+    gst_buffer_unref(buffer);
+  /* restore the atlas of the sink pad */
+  if (gst_rtp_atlas_pay_select_atlas(rtpatlaspay, rtpatlaspay->default_atlas) !=
+          GST_FLOW_OK &&
+      ret == GST_FLOW_OK)
+    ret = GST_FLOW_ERROR;
+  g_mutex_unlock(&rtpatlaspay->mux_lock);
+
+  return ret;
+}
+
+/* Called with the mux lock */
+static gboolean gst_rtp_atlas_pay_all_eos(GstRtpAtlasPay *rtpatlaspay) {
+  return rtpatlaspay->default_atlas->eos &&
+         rtpatlaspay->n_atlas_eos == rtpatlaspay->n_atlas_pads;
+}
+
+/* Called with the mux lock */
+static void gst_rtp_atlas_pay_reset_eos(GstRtpAtlasPay *rtpatlaspay) {
+  GList *l;
+
+  GST_OBJECT_LOCK(rtpatlaspay);
+  for (l = GST_ELEMENT(rtpatlaspay)->sinkpads; l; l = l->next) {
+    GstRtpAtlasPayAtlas *atlas;
+
+    if (l->data == GST_RTP_BASE_PAYLOAD_SINKPAD(rtpatlaspay))
+      continue;
+    atlas = gst_pad_get_element_private(GST_PAD(l->data));
+    atlas->eos = FALSE;
+  }
+  GST_OBJECT_UNLOCK(rtpatlaspay);
+
+  rtpatlaspay->n_atlas_eos = 0;
+  rtpatlaspay->default_atlas->eos = FALSE;
+}
+
+/* stream-start and segment of the session are the ones of the sink pad,
+ * request pads provide the caps of their atlas. EOS is forwarded by the
+ * last sink pad to get it, flushes only reset the atlas of the pad */
+static gboolean gst_rtp_atlas_pay_atlas_event(GstPad *pad, GstObject *parent,
+                                              GstEvent *event) {
+  GstRtpAtlasPay *rtpatlaspay = GST_RTP_ATLAS_PAY(parent);
+  GstRtpAtlasPayAtlas *atlas = gst_pad_get_element_private(pad);
+  gboolean res = TRUE;
+  gboolean forward = FALSE;
+
+  g_mutex_lock(&rtpatlaspay->mux_lock);
+  switch (GST_EVENT_TYPE(event)) {
+  case GST_EVENT_STREAM_START:
+  case GST_EVENT_SEGMENT:
+  case GST_EVENT_FLUSH_START:
+    break;
+  case GST_EVENT_FLUSH_STOP:
+    gst_clear_buffer(&atlas->held_nal);
+    if (atlas->eos) {
+      atlas->eos = FALSE;
+      rtpatlaspay->n_atlas_eos--;
+    }
+    break;
+  case GST_EVENT_EOS: {
+    GstFlowReturn ret;
+
+    ret = gst_rtp_atlas_pay_select_atlas(rtpatlaspay, atlas);
+    if (ret == GST_FLOW_OK)
+      ret = gst_rtp_atlas_pay_send_held_nal(GST_RTP_BASE_PAYLOAD(rtpatlaspay),
+                                            TRUE);
+    if (gst_rtp_atlas_pay_select_atlas(rtpatlaspay,
+                                       rtpatlaspay->default_atlas) !=
+        GST_FLOW_OK)
+      ret = GST_FLOW_ERROR;
+    res = ret == GST_FLOW_OK;
+
+    if (!atlas->eos) {
+      atlas->eos = TRUE;
+      rtpatlaspay->n_atlas_eos++;
+    }
+    forward = gst_rtp_atlas_pay_all_eos(rtpatlaspay);
+    break;
+  }
+  case GST_EVENT_CAPS: {
+    GstCaps *caps;
+
+    gst_event_parse_caps(event, &caps);
+    res = gst_rtp_atlas_pay_select_atlas(rtpatlaspay, atlas) == GST_FLOW_OK;
+    if (res)
+      res = gst_rtp_atlas_pay_set_atlas_caps(GST_RTP_BASE_PAYLOAD(rtpatlaspay),
+                                             caps);
+    if (gst_rtp_atlas_pay_select_atlas(rtpatlaspay,
+                                       rtpatlaspay->default_atlas) !=
+        GST_FLOW_OK)
+      res = FALSE;
+    /* the atlas is not signalled in the SRC caps, its parameter sets go
+     * in-band before its first NAL unit */
+    if (res)
+      atlas->send_asps_afps_aaps = TRUE;
+    break;
+  }
+  case GST_EVENT_CUSTOM_DOWNSTREAM: {
+    const GstStructure *s = gst_event_get_structure(event);
+    gboolean all_headers;
+
+    if (gst_structure_has_name(s, "GstForceKeyUnit") &&
+        gst_structure_get_boolean(s, "all-headers", &all_headers) &&
+        all_headers) {
+      atlas->send_asps_afps_aaps = TRUE;
+      g_atomic_int_inc(&rtpatlaspay->key_unit_requests);
+    } else {
+      res = FALSE;
+    }
+    break;
+  }
+  default:
+    GST_DEBUG_OBJECT(pad, "dropping %" GST_PTR_FORMAT, event);
+    res = FALSE;
+    break;
+  }
+  g_mutex_unlock(&rtpatlaspay->mux_lock);
+
+  if (forward) {
+    GST_DEBUG_OBJECT(rtpatlaspay, "all sink pads are EOS");
+    return gst_pad_push_event(GST_RTP_BASE_PAYLOAD_SRCPAD(rtpatlaspay),
+                              event) &&
+           res;
+  }
+
+  gst_event_unref(event);
+
+  return res;
+}
+
+static GstPad *gst_rtp_atlas_pay_request_new_pad(GstElement *element,
+                                                 GstPadTemplate *templ,
+                                                 const gchar *name,
+                                                 const GstCaps *caps) {
+  GstRtpAtlasPay *rtpatlaspay = GST_RTP_ATLAS_PAY(element);
+  GstRtpAtlasPayAtlas *atlas;
+  GstPad *pad;
+  gchar *pad_name;
+
+  /* without the atlas_id in each packet the receiver cannot tell the
+   * atlases of the session apart */
+  if (rtpatlaspay->atlas_id_ext_id == 0) {
+    GST_ERROR_OBJECT(rtpatlaspay, "atlas-id-ext-id must be set to add "
+                     "atlases through sink_%%u pads");
+    return NULL;
+  }
+
+  g_mutex_lock(&rtpatlaspay->mux_lock);
+  if (name)
+    pad_name = g_strdup(name);
+  else
+    pad_name = g_strdup_printf("sink_%u", rtpatlaspay->next_atlas_pad++);
+  rtpatlaspay->n_atlas_pads++;
+  g_mutex_unlock(&rtpatlaspay->mux_lock);
+
+  atlas = gst_rtp_atlas_pay_atlas_new(rtpatlaspay);
+
+  pad = gst_pad_new_from_template(templ, pad_name);
+  g_free(pad_name);
+  gst_pad_set_element_private(pad, atlas);
+  gst_pad_set_chain_function(pad,
+                             GST_DEBUG_FUNCPTR(gst_rtp_atlas_pay_atlas_chain));
+  gst_pad_set_event_function(pad,
+                             GST_DEBUG_FUNCPTR(gst_rtp_atlas_pay_atlas_event));
+
+  gst_pad_set_active(pad, TRUE);
+  gst_element_add_pad(element, pad);
+
+  GST_DEBUG_OBJECT(rtpatlaspay, "added atlas pad %s", GST_PAD_NAME(pad));
+
+  return pad;
+}
+
+static void gst_rtp_atlas_pay_release_pad(GstElement *element, GstPad *pad) {
+  GstRtpAtlasPay *rtpatlaspay = GST_RTP_ATLAS_PAY(element);
+  GstRtpAtlasPayAtlas *atlas = gst_pad_get_element_private(pad);
+  gboolean forward;
+
+  GST_DEBUG_OBJECT(rtpatlaspay, "releasing atlas pad %s", GST_PAD_NAME(pad));
+
+  gst_pad_set_active(pad, FALSE);
+  gst_element_remove_pad(element, pad);
+
+  g_mutex_lock(&rtpatlaspay->mux_lock);
+  rtpatlaspay->n_atlas_pads--;
+  if (atlas->eos)
+    rtpatlaspay->n_atlas_eos--;
+  /* the released pad was the last one EOS was waiting for */
+  forward = !atlas->eos && gst_rtp_atlas_pay_all_eos(rtpatlaspay);
+  g_mutex_unlock(&rtpatlaspay->mux_lock);
+
+  if (forward)
+    gst_pad_push_event(GST_RTP_BASE_PAYLOAD_SRCPAD(rtpatlaspay),
+                       gst_event_new_eos());
+
+  gst_rtp_atlas_pay_atlas_free(atlas);
+}
+
 static gboolean gst_rtp_atlas_pay_sink_event(GstRTPBasePayload *payload,
                                              GstEvent *event) {
   gboolean res;
   const GstStructure *s;
   GstRtpAtlasPay *rtpatlaspay = GST_RTP_ATLAS_PAY(payload);
   GstFlowReturn ret = GST_FLOW_OK;
+  gboolean forward = TRUE;
 
+  g_mutex_lock(&rtpatlaspay->mux_lock);
   switch (GST_EVENT_TYPE(event)) {
   case GST_EVENT_FLUSH_STOP:
     gst_rtp_atlas_pay_reset_bundle(rtpatlaspay);
+    gst_clear_buffer(&rtpatlaspay->default_atlas->held_nal);
+    rtpatlaspay->default_atlas->eos = FALSE;
     break;
   case GST_EVENT_CUSTOM_DOWNSTREAM:
     s = gst_event_get_structure(event);
@@ -1209,17 +2170,24 @@ static gboolean gst_rtp_atlas_pay_sink_event(GstRTPBasePayload *payload,
       gboolean resend_codec_data;
 
       if (gst_structure_get_boolean(s, "all-headers", &resend_codec_data) &&
-          resend_codec_data)
-        rtpatlaspay->send_asps_afps_aaps = TRUE;
+          resend_codec_data) {
+        rtpatlaspay->default_atlas->send_asps_afps_aaps = TRUE;
+        g_atomic_int_inc(&rtpatlaspay->key_unit_requests);
+      }
     }
     break;
   case GST_EVENT_EOS: {
     /* call handle_buffer with NULL to flush last NAL from adapter
      * in byte-stream mode
      */
-    gst_rtp_atlas_pay_handle_buffer(payload, NULL);
-    ret = gst_rtp_atlas_pay_send_bundle(rtpatlaspay, TRUE);
-
+    gst_rtp_atlas_pay_handle_atlas_buffer(payload, NULL);
+    ret = gst_rtp_atlas_pay_send_held_nal(payload, TRUE);
+    if (ret == GST_FLOW_OK)
+      ret = gst_rtp_atlas_pay_send_bundle(rtpatlaspay, TRUE);
+
+    /* request pads still streaming send EOS when they are done */
+    rtpatlaspay->default_atlas->eos = TRUE;
+    forward = gst_rtp_atlas_pay_all_eos(rtpatlaspay);
     break;
   }
   case GST_EVENT_STREAM_START:
@@ -1230,15 +2198,41 @@ static gboolean gst_rtp_atlas_pay_sink_event(GstRTPBasePayload *payload,
   default:
     break;
   }
+  g_mutex_unlock(&rtpatlaspay->mux_lock);
 
-  if (ret != GST_FLOW_OK)
+  if (ret != GST_FLOW_OK) {
+    gst_event_unref(event);
     return FALSE;
+  }
+
+  if (!forward) {
+    GST_DEBUG_OBJECT(rtpatlaspay, "waiting for EOS on the request pads");
+    gst_event_unref(event);
+    return TRUE;
+  }
 
   res = GST_RTP_BASE_PAYLOAD_CLASS(parent_class)->sink_event(payload, event);
 
   return res;
 }
 
+/* GstForceKeyUnit from downstream, e.g. rtpbin on RTCP PLI or FIR, drives
+ * adaptive-config-interval. The event is checked by hand as the plugin does
+ * not link to gstreamer-video */
+static gboolean gst_rtp_atlas_pay_src_event(GstRTPBasePayload *payload,
+                                            GstEvent *event) {
+  GstRtpAtlasPay *rtpatlaspay = GST_RTP_ATLAS_PAY(payload);
+
+  if (GST_EVENT_TYPE(event) == GST_EVENT_CUSTOM_UPSTREAM &&
+      gst_structure_has_name(gst_event_get_structure(event),
+                             "GstForceKeyUnit")) {
+    GST_DEBUG_OBJECT(rtpatlaspay, "key unit requested from downstream");
+    g_atomic_int_inc(&rtpatlaspay->key_unit_requests);
+  }
+
+  return GST_RTP_BASE_PAYLOAD_CLASS(parent_class)->src_event(payload, event);
+}
+
 static GstStateChangeReturn
 gst_rtp_atlas_pay_change_state(GstElement *element, GstStateChange transition) {
   GstStateChangeReturn ret;
@@ -1246,8 +2240,16 @@ gst_rtp_atlas_pay_change_state(GstElement *element, GstStateChange transition) {
 
   switch (transition) {
   case GST_STATE_CHANGE_READY_TO_PAUSED:
-    rtpatlaspay->send_asps_afps_aaps = FALSE;
+    rtpatlaspay->default_atlas->send_asps_afps_aaps = FALSE;
+    rtpatlaspay->adaptive_interval = rtpatlaspay->config_interval_max;
+    g_atomic_int_set(&rtpatlaspay->key_unit_requests, 0);
     gst_rtp_atlas_pay_reset_bundle(rtpatlaspay);
+    gst_clear_buffer(&rtpatlaspay->default_atlas->held_nal);
+    rtpatlaspay->default_atlas->temporal_id_limit =
+        rtpatlaspay->max_temporal_id;
+    g_mutex_lock(&rtpatlaspay->mux_lock);
+    gst_rtp_atlas_pay_reset_eos(rtpatlaspay);
+    g_mutex_unlock(&rtpatlaspay->mux_lock);
     break;
   default:
     break;
@@ -1257,7 +2259,7 @@ gst_rtp_atlas_pay_change_state(GstElement *element, GstStateChange transition) {
 
   switch (transition) {
   case GST_STATE_CHANGE_PAUSED_TO_READY:
-    rtpatlaspay->last_asps_afps_aaps = -1;
+    rtpatlaspay->default_atlas->last_asps_afps_aaps = -1;
     gst_rtp_atlas_pay_clear_asps_afps_aaps(rtpatlaspay);
     break;
   default:
@@ -1276,11 +2278,48 @@ static void gst_rtp_atlas_pay_set_property(GObject *object, guint prop_id,
 
   switch (prop_id) {
   case PROP_CONFIG_INTERVAL:
+    /* kept in milliseconds, -1 and 0 have the same meaning in both */
+    rtpatlaspay->asps_afps_aaps_interval = g_value_get_int(value);
+    if (rtpatlaspay->asps_afps_aaps_interval > 0)
+      rtpatlaspay->asps_afps_aaps_interval *= 1000;
+    break;
+  case PROP_CONFIG_INTERVAL_MS:
     rtpatlaspay->asps_afps_aaps_interval = g_value_get_int(value);
     break;
+  case PROP_ADAPTIVE_CONFIG_INTERVAL:
+    rtpatlaspay->adaptive_config_interval = g_value_get_boolean(value);
+    break;
+  case PROP_CONFIG_INTERVAL_MIN_MS:
+    rtpatlaspay->config_interval_min = g_value_get_int(value);
+    rtpatlaspay->adaptive_interval = MAX(rtpatlaspay->adaptive_interval,
+                                         rtpatlaspay->config_interval_min);
+    break;
+  case PROP_CONFIG_INTERVAL_MAX_MS:
+    rtpatlaspay->config_interval_max = g_value_get_int(value);
+    rtpatlaspay->adaptive_interval = MIN(rtpatlaspay->adaptive_interval,
+                                         rtpatlaspay->config_interval_max);
+    break;
   case PROP_AGGREGATE_MODE:
     rtpatlaspay->aggregate_mode = g_value_get_enum(value);
     break;
+  case PROP_TX_MODE:
+    rtpatlaspay->tx_mode = g_value_get_enum(value);
+    break;
+  case PROP_MAX_DON_DIFF:
+    rtpatlaspay->max_don_diff = g_value_get_uint(value);
+    break;
+  case PROP_TILE_ID_PRES:
+    rtpatlaspay->tile_id_pres = g_value_get_boolean(value);
+    break;
+  case PROP_MAX_TEMPORAL_ID:
+    rtpatlaspay->max_temporal_id = g_value_get_uint(value);
+    break;
+  case PROP_ATLAS_ID_EXT_ID:
+    rtpatlaspay->atlas_id_ext_id = g_value_get_uint(value);
+    break;
+  case PROP_PROTECT_KEY_UNITS:
+    rtpatlaspay->protect_key_units = g_value_get_boolean(value);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     break;
@@ -1295,11 +2334,71 @@ static void gst_rtp_atlas_pay_get_property(GObject *object, guint prop_id,
 
   switch (prop_id) {
   case PROP_CONFIG_INTERVAL:
+    if (rtpatlaspay->asps_afps_aaps_interval > 0)
+      g_value_set_int(value, rtpatlaspay->asps_afps_aaps_interval / 1000);
+    else
+      g_value_set_int(value, rtpatlaspay->asps_afps_aaps_interval);
+    break;
+  case PROP_CONFIG_INTERVAL_MS:
     g_value_set_int(value, rtpatlaspay->asps_afps_aaps_interval);
     break;
+  case PROP_ADAPTIVE_CONFIG_INTERVAL:
+    g_value_set_boolean(value, rtpatlaspay->adaptive_config_interval);
+    break;
+  case PROP_CONFIG_INTERVAL_MIN_MS:
+    g_value_set_int(value, rtpatlaspay->config_interval_min);
+    break;
+  case PROP_CONFIG_INTERVAL_MAX_MS:
+    g_value_set_int(value, rtpatlaspay->config_interval_max);
+    break;
   case PROP_AGGREGATE_MODE:
     g_value_set_enum(value, rtpatlaspay->aggregate_mode);
     break;
+  case PROP_TX_MODE:
+    g_value_set_enum(value, rtpatlaspay->tx_mode);
+    break;
+  case PROP_MAX_DON_DIFF:
+    g_value_set_uint(value, rtpatlaspay->max_don_diff);
+    break;
+  case PROP_TILE_ID_PRES:
+    g_value_set_boolean(value, rtpatlaspay->tile_id_pres);
+    break;
+  case PROP_MAX_TEMPORAL_ID:
+    g_value_set_uint(value, rtpatlaspay->max_temporal_id);
+    break;
+  case PROP_ATLAS_ID_EXT_ID:
+    g_value_set_uint(value, rtpatlaspay->atlas_id_ext_id);
+    break;
+  case PROP_PROTECT_KEY_UNITS:
+    g_value_set_boolean(value, rtpatlaspay->protect_key_units);
+    break;
+  case PROP_SDP_FMTP: {
+    GstCaps *caps =
+        gst_pad_get_current_caps(GST_RTP_BASE_PAYLOAD_SRCPAD(rtpatlaspay));
+    gchar *fmtp = NULL;
+    gint payload = 96;
+
+    /* the parameters are kept until the optional parameters of the SRC caps
+     * change, the payload type is taken from the current caps */
+    if (caps) {
+      gst_structure_get_int(gst_caps_get_structure(caps, 0), "payload",
+                            &payload);
+      GST_OBJECT_LOCK(rtpatlaspay);
+      if (rtpatlaspay->sdp_fmtp_parameters == NULL &&
+          rtpatlaspay->outcaps_fields)
+        rtpatlaspay->sdp_fmtp_parameters =
+            gst_rtp_atlas_structure_to_fmtp_parameters(
+                rtpatlaspay->outcaps_fields);
+      if (rtpatlaspay->sdp_fmtp_parameters)
+        fmtp = g_strdup_printf("%d %s", payload,
+                               rtpatlaspay->sdp_fmtp_parameters);
+      GST_OBJECT_UNLOCK(rtpatlaspay);
+    }
+
+    g_value_take_string(value, fmtp);
+    gst_clear_caps(&caps);
+    break;
+  }
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
     break;
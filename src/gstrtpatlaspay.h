@@ -62,33 +62,107 @@ typedef enum {
   GST_RTP_ATLAS_AGGREGATE_MAX,
 } GstRTPAtlasAggregateMode;
 
+typedef enum {
+  GST_RTP_ATLAS_TX_MODE_SRST,
+  GST_RTP_ATLAS_TX_MODE_MRST,
+} GstRTPAtlasTxMode;
+
 typedef enum {
   GST_ATLAS_PAY_STREAM_FORMAT_UNKNOWN,
   GST_ATLAS_PAY_STREAM_FORMAT_V3CG
 } GstAtlasPayStreamFormat;
 
+/* State of one atlas of the session, the one of the always sink pad or of a
+ * sink_%u request pad */
+typedef struct {
+  GPtrArray *asps, *afps, *aaps;
+  /* prefix and suffix SEI found in the codec_data setup unit arrays */
+  GPtrArray *sei;
+  GstBuffer *vuh;
+  GstAtlasPayStreamFormat stream_format;
+  GstAtlasAlignment alignment;
+  guint8 nal_length_size;
+  gboolean send_asps_afps_aaps;
+  GstClockTime last_asps_afps_aaps;
+
+  /* With alignment=nal the last NAL unit kept is held back until the next
+   * buffer, so that it can take the marker of a dropped NAL unit */
+  guint temporal_id_limit;
+  GstBuffer *held_nal;
+  GstClockTime held_pts, held_dts;
+
+  gboolean eos;
+} GstRtpAtlasPayAtlas;
+
 struct _GstRtpAtlasPay {
   GstRTPBasePayload payload;
 
-  GPtrArray *vps, *asps, *afps, *aaps;
-  GstBuffer *vuh;
+  /* the atlas of the sink pad, and the one whose buffer or caps is being
+   * handled */
+  GstRtpAtlasPayAtlas *default_atlas;
+  GstRtpAtlasPayAtlas *current_atlas;
+
+  /* VPS and CASPS and CAF of the codec_data, shared by the atlases. The
+   * common atlas data is signalled in v3c-common-atlas-data and not
+   * repeated in-band */
+  GPtrArray *vps;
+  GPtrArray *cad;
+  /* optional parameters of the current SRC caps, set_outcaps is skipped
+   * while they do not change */
+  GstStructure *outcaps_fields;
+  /* a=fmtp parameters of outcaps_fields for sdp-fmtp, built on the first
+   * read after they changed. Protected by the object lock, as is the
+   * outcaps_fields pointer */
+  gchar *sdp_fmtp_parameters;
 
-  GstAtlasPayStreamFormat stream_format;
-  GstAtlasAlignment alignment;
   gint fps_num;
   gint fps_denum;
-  guint8 nal_length_size;
   GArray *queue;
 
+  /* in milliseconds, 0 = disabled, -1 = with every IDR */
   gint asps_afps_aaps_interval;
-  gboolean send_asps_afps_aaps;
-  GstClockTime last_asps_afps_aaps;
+
+  /* with adaptive-config-interval, the interval in milliseconds is halved
+   * after key unit requests and doubled without, between the min and max.
+   * key_unit_requests is updated atomically */
+  gboolean adaptive_config_interval;
+  gint config_interval_min;
+  gint config_interval_max;
+  gint adaptive_interval;
+  gint key_unit_requests;
+
+  /* flag packets of parameter sets and IRAP access units non-droppable,
+   * key_au is set while the NAL units of an IRAP access unit are payloaded */
+  gboolean protect_key_units;
+  gboolean key_au;
 
   /* aggregate buffers with AP */
   GstBufferList *bundle;
   guint bundle_size;
   gboolean bundle_contains_acl_or_suffix;
   GstRTPAtlasAggregateMode aggregate_mode;
+
+  /* decoding order number, DONL/DOND are written when tx-mode is MRST or
+   * sprop-max-don-diff is greater than 0 */
+  GstRTPAtlasTxMode tx_mode;
+  guint max_don_diff;
+  guint16 don;
+  guint16 nal_don;
+
+  /* 16 bit v3c-tile-id after DONL, taken from GstAtlasTileMeta */
+  gboolean tile_id_pres;
+
+  /* NAL units of higher temporal sub-layers are not sent */
+  guint max_temporal_id;
+
+  /* atlases of sink_%u request pads share this RTP session, mux_lock
+   * serializes their streaming threads with the one of the sink pad.
+   * EOS is sent once all sink pads are EOS */
+  GMutex mux_lock;
+  guint n_atlas_pads;
+  guint n_atlas_eos;
+  guint next_atlas_pad;
+  guint atlas_id_ext_id;
 };
 
 struct _GstRtpAtlasPayClass {
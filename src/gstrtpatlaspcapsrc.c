@@ -0,0 +1,686 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstrtpatlaspcapsrc.h"
+#include "gstrtpatlassdp.h"
+
+GST_DEBUG_CATEGORY_STATIC(rtpatlaspcapsrc_debug);
+#define GST_CAT_DEFAULT (rtpatlaspcapsrc_debug)
+
+#define DEFAULT_LOCATION NULL
+#define DEFAULT_SDP_LOCATION NULL
+#define DEFAULT_PORT 0
+#define DEFAULT_SPEED 1.0
+
+#define PCAP_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LOOP 108
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define IP_PROTOCOL_UDP 17
+
+enum {
+  PROP_0,
+  PROP_LOCATION,
+  PROP_SDP_LOCATION,
+  PROP_CAPS,
+  PROP_PORT,
+  PROP_SPEED,
+};
+
+static GstStaticPadTemplate gst_rtp_atlas_pcap_src_template =
+    GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS,
+                            GST_STATIC_CAPS("application/x-rtp"));
+
+static void gst_rtp_atlas_pcap_src_finalize(GObject *object);
+static void gst_rtp_atlas_pcap_src_set_property(GObject *object,
+                                                guint prop_id,
+                                                const GValue *value,
+                                                GParamSpec *pspec);
+static void gst_rtp_atlas_pcap_src_get_property(GObject *object,
+                                                guint prop_id, GValue *value,
+                                                GParamSpec *pspec);
+
+static gboolean gst_rtp_atlas_pcap_src_start(GstBaseSrc *basesrc);
+static gboolean gst_rtp_atlas_pcap_src_stop(GstBaseSrc *basesrc);
+static GstCaps *gst_rtp_atlas_pcap_src_get_caps(GstBaseSrc *basesrc,
+                                                GstCaps *filter);
+static gboolean gst_rtp_atlas_pcap_src_is_seekable(GstBaseSrc *basesrc);
+static gboolean gst_rtp_atlas_pcap_src_unlock(GstBaseSrc *basesrc);
+static gboolean gst_rtp_atlas_pcap_src_unlock_stop(GstBaseSrc *basesrc);
+static GstFlowReturn gst_rtp_atlas_pcap_src_create(GstPushSrc *pushsrc,
+                                                   GstBuffer **buf);
+
+#define gst_rtp_atlas_pcap_src_parent_class parent_class
+G_DEFINE_TYPE(GstRtpAtlasPcapSrc, gst_rtp_atlas_pcap_src, GST_TYPE_PUSH_SRC);
+
+static void gst_rtp_atlas_pcap_src_class_init(GstRtpAtlasPcapSrcClass *klass) {
+  GObjectClass *gobject_class;
+  GstElementClass *gstelement_class;
+  GstBaseSrcClass *gstbasesrc_class;
+  GstPushSrcClass *gstpushsrc_class;
+
+  gobject_class = (GObjectClass *)klass;
+  gstelement_class = (GstElementClass *)klass;
+  gstbasesrc_class = (GstBaseSrcClass *)klass;
+  gstpushsrc_class = (GstPushSrcClass *)klass;
+
+  gobject_class->set_property = gst_rtp_atlas_pcap_src_set_property;
+  gobject_class->get_property = gst_rtp_atlas_pcap_src_get_property;
+  gobject_class->finalize = gst_rtp_atlas_pcap_src_finalize;
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_LOCATION,
+      g_param_spec_string("location", "Location",
+                          "Path of the pcap capture file to replay",
+                          DEFAULT_LOCATION,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+                              GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_SDP_LOCATION,
+      g_param_spec_string(
+          "sdp-location", "SDP location",
+          "Path of the SDP file of the session, the caps are made from its "
+          "first V3C payload type",
+          DEFAULT_SDP_LOCATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_CAPS,
+      g_param_spec_boxed("caps", "Caps",
+                         "Caps of the RTP packets, used instead of "
+                         "sdp-location when set",
+                         GST_TYPE_CAPS,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+                             GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_PORT,
+      g_param_spec_uint("port", "Port",
+                        "UDP destination port of the packets to replay "
+                        "(0 = all)",
+                        0, G_MAXUINT16, DEFAULT_PORT,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+                            GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property(
+      G_OBJECT_CLASS(klass), PROP_SPEED,
+      g_param_spec_double(
+          "speed", "Speed",
+          "Replay speed relative to the capture timing, e.g. 2.0 for twice "
+          "as fast (0 = as fast as possible, not live)",
+          0.0, 1000.0, DEFAULT_SPEED,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+              GST_PARAM_MUTABLE_READY));
+
+  gst_element_class_add_static_pad_template(gstelement_class,
+                                            &gst_rtp_atlas_pcap_src_template);
+
+  gst_element_class_set_static_metadata(
+      gstelement_class, "RTP Atlas capture replay source",
+      "Source/Network/RTP",
+      "Replays the V3C atlas RTP packets of a memory-mapped pcap capture",
+      "Lukasz Kondrad <lukasz.kondrad@nokia.com>");
+
+  gstbasesrc_class->start = GST_DEBUG_FUNCPTR(gst_rtp_atlas_pcap_src_start);
+  gstbasesrc_class->stop = GST_DEBUG_FUNCPTR(gst_rtp_atlas_pcap_src_stop);
+  gstbasesrc_class->get_caps =
+      GST_DEBUG_FUNCPTR(gst_rtp_atlas_pcap_src_get_caps);
+  gstbasesrc_class->is_seekable =
+      GST_DEBUG_FUNCPTR(gst_rtp_atlas_pcap_src_is_seekable);
+  gstbasesrc_class->unlock = GST_DEBUG_FUNCPTR(gst_rtp_atlas_pcap_src_unlock);
+  gstbasesrc_class->unlock_stop =
+      GST_DEBUG_FUNCPTR(gst_rtp_atlas_pcap_src_unlock_stop);
+  gstpushsrc_class->create = GST_DEBUG_FUNCPTR(gst_rtp_atlas_pcap_src_create);
+
+  GST_DEBUG_CATEGORY_INIT(rtpatlaspcapsrc_debug, "rtpatlaspcapsrc", 0,
+                          "ATLAS RTP capture replay source");
+}
+
+static void gst_rtp_atlas_pcap_src_init(GstRtpAtlasPcapSrc *src) {
+  src->location = g_strdup(DEFAULT_LOCATION);
+  src->sdp_location = g_strdup(DEFAULT_SDP_LOCATION);
+  src->port = DEFAULT_PORT;
+  src->speed = DEFAULT_SPEED;
+  src->first_ts = GST_CLOCK_TIME_NONE;
+
+  /* packets are timed from the capture, the clock is waited when live */
+  gst_base_src_set_format(GST_BASE_SRC(src), GST_FORMAT_TIME);
+  gst_base_src_set_live(GST_BASE_SRC(src), DEFAULT_SPEED > 0.0);
+}
+
+static void gst_rtp_atlas_pcap_src_finalize(GObject *object) {
+  GstRtpAtlasPcapSrc *src = GST_RTP_ATLAS_PCAP_SRC(object);
+
+  g_free(src->location);
+  g_free(src->sdp_location);
+  gst_clear_caps(&src->caps);
+
+  G_OBJECT_CLASS(parent_class)->finalize(object);
+}
+
+static guint32 gst_rtp_atlas_pcap_src_read_uint32(GstRtpAtlasPcapSrc *src,
+                                                  const guint8 *data) {
+  return src->big_endian ? GST_READ_UINT32_BE(data) : GST_READ_UINT32_LE(data);
+}
+
+static gboolean gst_rtp_atlas_pcap_src_start(GstBaseSrc *basesrc) {
+  GstRtpAtlasPcapSrc *src = GST_RTP_ATLAS_PCAP_SRC(basesrc);
+  GstCaps *caps = NULL;
+  GError *err = NULL;
+
+  if (src->location == NULL) {
+    GST_ELEMENT_ERROR(src, RESOURCE, NOT_FOUND,
+                      ("No capture file location specified"), (NULL));
+    return FALSE;
+  }
+
+  src->file = g_mapped_file_new(src->location, FALSE, &err);
+  if (src->file == NULL) {
+    GST_ELEMENT_ERROR(src, RESOURCE, OPEN_READ,
+                      ("Could not map capture file \"%s\"", src->location),
+                      ("%s", err->message));
+    g_clear_error(&err);
+    return FALSE;
+  }
+  src->data = (const guint8 *)g_mapped_file_get_contents(src->file);
+  src->size = g_mapped_file_get_length(src->file);
+
+  if (src->size < PCAP_HEADER_SIZE)
+    goto not_pcap;
+
+  /* byte order of the capturing host, microsecond or nanosecond times */
+  switch (GST_READ_UINT32_LE(src->data)) {
+  case 0xa1b2c3d4:
+    src->big_endian = FALSE;
+    src->nanosecond = FALSE;
+    break;
+  case 0xa1b23c4d:
+    src->big_endian = FALSE;
+    src->nanosecond = TRUE;
+    break;
+  case 0xd4c3b2a1:
+    src->big_endian = TRUE;
+    src->nanosecond = FALSE;
+    break;
+  case 0x4d3cb2a1:
+    src->big_endian = TRUE;
+    src->nanosecond = TRUE;
+    break;
+  default:
+    goto not_pcap;
+  }
+
+  /* the upper bits hold the FCS length */
+  src->linktype =
+      gst_rtp_atlas_pcap_src_read_uint32(src, src->data + 20) & 0x0fffffff;
+  switch (src->linktype) {
+  case LINKTYPE_NULL:
+  case LINKTYPE_ETHERNET:
+  case LINKTYPE_RAW:
+  case LINKTYPE_LOOP:
+  case LINKTYPE_LINUX_SLL:
+  case LINKTYPE_IPV4:
+  case LINKTYPE_IPV6:
+  case LINKTYPE_LINUX_SLL2:
+    break;
+  default:
+    GST_ELEMENT_ERROR(src, STREAM, WRONG_TYPE,
+                      ("Unsupported link type %u of capture file \"%s\"",
+                       src->linktype, src->location),
+                      (NULL));
+    goto error;
+  }
+
+  /* packets share this memory, the file stays mapped while any of them is
+   * alive */
+  src->memory = gst_memory_new_wrapped(
+      GST_MEMORY_FLAG_READONLY, (gpointer)src->data, src->size, 0, src->size,
+      g_mapped_file_ref(src->file), (GDestroyNotify)g_mapped_file_unref);
+  src->offset = PCAP_HEADER_SIZE;
+  src->first_ts = GST_CLOCK_TIME_NONE;
+  src->packets = 0;
+  src->skipped = 0;
+
+  GST_OBJECT_LOCK(src);
+  if (src->caps)
+    caps = gst_caps_ref(src->caps);
+  GST_OBJECT_UNLOCK(src);
+
+  if (caps == NULL && src->sdp_location) {
+    gchar *sdp;
+
+    if (!g_file_get_contents(src->sdp_location, &sdp, NULL, &err)) {
+      GST_ELEMENT_ERROR(src, RESOURCE, OPEN_READ,
+                        ("Could not read SDP file \"%s\"", src->sdp_location),
+                        ("%s", err->message));
+      g_clear_error(&err);
+      goto error;
+    }
+    caps = gst_rtp_atlas_sdp_to_caps(sdp);
+    g_free(sdp);
+
+    if (caps == NULL) {
+      GST_ELEMENT_ERROR(src, STREAM, WRONG_TYPE,
+                        ("No V3C payload type in SDP file \"%s\"",
+                         src->sdp_location),
+                        (NULL));
+      goto error;
+    }
+  }
+
+  if (caps == NULL)
+    caps = gst_caps_new_simple("application/x-rtp", "media", G_TYPE_STRING,
+                               "application", "clock-rate", G_TYPE_INT, 90000,
+                               "encoding-name", G_TYPE_STRING, "v3c", NULL);
+
+  GST_DEBUG_OBJECT(src, "replaying %s, link type %u, caps %" GST_PTR_FORMAT,
+                   src->location, src->linktype, caps);
+
+  GST_OBJECT_LOCK(src);
+  gst_caps_take(&src->src_caps, caps);
+  GST_OBJECT_UNLOCK(src);
+
+  return TRUE;
+
+not_pcap:
+  GST_ELEMENT_ERROR(src, STREAM, WRONG_TYPE,
+                    ("\"%s\" is not a pcap capture file", src->location),
+                    ("pcapng captures can be converted with editcap -F pcap"));
+error:
+  gst_rtp_atlas_pcap_src_stop(basesrc);
+  return FALSE;
+}
+
+static gboolean gst_rtp_atlas_pcap_src_stop(GstBaseSrc *basesrc) {
+  GstRtpAtlasPcapSrc *src = GST_RTP_ATLAS_PCAP_SRC(basesrc);
+
+  g_clear_pointer(&src->memory, gst_memory_unref);
+  g_clear_pointer(&src->file, g_mapped_file_unref);
+  src->data = NULL;
+  src->size = 0;
+  src->offset = 0;
+
+  GST_OBJECT_LOCK(src);
+  gst_clear_caps(&src->src_caps);
+  GST_OBJECT_UNLOCK(src);
+
+  return TRUE;
+}
+
+static GstCaps *gst_rtp_atlas_pcap_src_get_caps(GstBaseSrc *basesrc,
+                                                GstCaps *filter) {
+  GstRtpAtlasPcapSrc *src = GST_RTP_ATLAS_PCAP_SRC(basesrc);
+  GstCaps *caps = NULL;
+
+  GST_OBJECT_LOCK(src);
+  if (src->src_caps)
+    caps = gst_caps_ref(src->src_caps);
+  GST_OBJECT_UNLOCK(src);
+
+  if (caps == NULL)
+    caps = gst_pad_get_pad_template_caps(GST_BASE_SRC_PAD(basesrc));
+
+  if (filter) {
+    GstCaps *intersection =
+        gst_caps_intersect_full(filter, caps, GST_CAPS_INTERSECT_FIRST);
+
+    gst_caps_unref(caps);
+    caps = intersection;
+  }
+
+  return caps;
+}
+
+static gboolean gst_rtp_atlas_pcap_src_is_seekable(GstBaseSrc *basesrc) {
+  return FALSE;
+}
+
+static gboolean gst_rtp_atlas_pcap_src_unlock(GstBaseSrc *basesrc) {
+  GstRtpAtlasPcapSrc *src = GST_RTP_ATLAS_PCAP_SRC(basesrc);
+
+  GST_OBJECT_LOCK(src);
+  src->flushing = TRUE;
+  if (src->clock_id)
+    gst_clock_id_unschedule(src->clock_id);
+  GST_OBJECT_UNLOCK(src);
+
+  return TRUE;
+}
+
+static gboolean gst_rtp_atlas_pcap_src_unlock_stop(GstBaseSrc *basesrc) {
+  GstRtpAtlasPcapSrc *src = GST_RTP_ATLAS_PCAP_SRC(basesrc);
+
+  GST_OBJECT_LOCK(src);
+  src->flushing = FALSE;
+  GST_OBJECT_UNLOCK(src);
+
+  return TRUE;
+}
+
+/* Finds the UDP payload of a captured frame. FALSE for anything else than an
+ * unfragmented UDP datagram to the wanted port carrying an RTP packet */
+static gboolean gst_rtp_atlas_pcap_src_parse_frame(GstRtpAtlasPcapSrc *src,
+                                                   const guint8 *data,
+                                                   gsize size,
+                                                   gsize *payload_offset,
+                                                   gsize *payload_size) {
+  guint16 ethertype = 0;
+  guint8 protocol;
+  gsize length;
+
+  switch (src->linktype) {
+  case LINKTYPE_ETHERNET:
+    if (size < 14)
+      return FALSE;
+    ethertype = GST_READ_UINT16_BE(data + 12);
+    data += 14;
+    size -= 14;
+    /* 802.1Q and 802.1ad tags */
+    while ((ethertype == 0x8100 || ethertype == 0x88a8) && size >= 4) {
+      ethertype = GST_READ_UINT16_BE(data + 2);
+      data += 4;
+      size -= 4;
+    }
+    break;
+  case LINKTYPE_LINUX_SLL:
+    if (size < 16)
+      return FALSE;
+    ethertype = GST_READ_UINT16_BE(data + 14);
+    data += 16;
+    size -= 16;
+    break;
+  case LINKTYPE_LINUX_SLL2:
+    if (size < 20)
+      return FALSE;
+    ethertype = GST_READ_UINT16_BE(data);
+    data += 20;
+    size -= 20;
+    break;
+  case LINKTYPE_NULL:
+  case LINKTYPE_LOOP:
+    /* address family in the byte order of the capturing host */
+    if (size < 4)
+      return FALSE;
+    data += 4;
+    size -= 4;
+    break;
+  default:
+    break;
+  }
+
+  if (size < 1)
+    return FALSE;
+  /* without link layer type, told apart by the IP version */
+  if (ethertype == 0)
+    ethertype = (data[0] >> 4) == 6 ? ETHERTYPE_IPV6 : ETHERTYPE_IPV4;
+
+  if (ethertype == ETHERTYPE_IPV4) {
+    gsize header;
+
+    if (size < 20 || (data[0] >> 4) != 4)
+      return FALSE;
+    header = (data[0] & 0x0f) * 4;
+    length = GST_READ_UINT16_BE(data + 2);
+    /* fragments of a datagram would have to be reassembled first */
+    if (header < 20 || length < header ||
+        (GST_READ_UINT16_BE(data + 6) & 0x3fff) != 0)
+      return FALSE;
+    protocol = data[9];
+    /* without link layer padding */
+    size = MIN(size, length);
+    if (size < header)
+      return FALSE;
+    data += header;
+    size -= header;
+  } else if (ethertype == ETHERTYPE_IPV6) {
+    if (size < 40 || (data[0] >> 4) != 6)
+      return FALSE;
+    protocol = data[6];
+    size = MIN(size, 40 + GST_READ_UINT16_BE(data + 4));
+    data += 40;
+    size -= 40;
+    /* hop-by-hop, routing and destination options headers */
+    while (protocol == 0 || protocol == 43 || protocol == 60) {
+      gsize header;
+
+      if (size < 8)
+        return FALSE;
+      header = (data[1] + 1) * 8;
+      if (size < header)
+        return FALSE;
+      protocol = data[0];
+      data += header;
+      size -= header;
+    }
+  } else {
+    return FALSE;
+  }
+
+  if (protocol != IP_PROTOCOL_UDP || size < 8)
+    return FALSE;
+  if (src->port != 0 && GST_READ_UINT16_BE(data + 2) != src->port)
+    return FALSE;
+  length = GST_READ_UINT16_BE(data + 4);
+  if (length < 8)
+    return FALSE;
+  size = MIN(size, length);
+  data += 8;
+  size -= 8;
+
+  /* RTP version 2, RTCP (packet types 200 to 204) muxed on the same port is
+   * skipped */
+  if (size < 12 || (data[0] >> 6) != 2 ||
+      ((data[1] & 0x7f) >= 72 && (data[1] & 0x7f) <= 76))
+    return FALSE;
+
+  *payload_offset = data - src->data;
+  *payload_size = size;
+
+  return TRUE;
+}
+
+/* Waits for the running time of the next packet, FLUSHING when unlocked */
+static GstFlowReturn gst_rtp_atlas_pcap_src_wait(GstRtpAtlasPcapSrc *src,
+                                                 GstClockTime running_time) {
+  GstClock *clock;
+  GstClockID id;
+  GstClockReturn clock_ret;
+
+  clock = gst_element_get_clock(GST_ELEMENT_CAST(src));
+  if (clock == NULL)
+    return GST_FLOW_OK;
+  id = gst_clock_new_single_shot_id(
+      clock, gst_element_get_base_time(GST_ELEMENT_CAST(src)) + running_time);
+  gst_object_unref(clock);
+
+  GST_OBJECT_LOCK(src);
+  if (src->flushing) {
+    GST_OBJECT_UNLOCK(src);
+    gst_clock_id_unref(id);
+    return GST_FLOW_FLUSHING;
+  }
+  src->clock_id = id;
+  GST_OBJECT_UNLOCK(src);
+
+  clock_ret = gst_clock_id_wait(id, NULL);
+
+  GST_OBJECT_LOCK(src);
+  gst_clock_id_unref(src->clock_id);
+  src->clock_id = NULL;
+  GST_OBJECT_UNLOCK(src);
+
+  return clock_ret == GST_CLOCK_UNSCHEDULED ? GST_FLOW_FLUSHING : GST_FLOW_OK;
+}
+
+static GstFlowReturn gst_rtp_atlas_pcap_src_create(GstPushSrc *pushsrc,
+                                                   GstBuffer **buf) {
+  GstRtpAtlasPcapSrc *src = GST_RTP_ATLAS_PCAP_SRC(pushsrc);
+  gsize payload_offset = 0, payload_size = 0;
+  GstClockTime ts;
+  GstFlowReturn ret;
+
+  for (;;) {
+    const guint8 *record = src->data + src->offset;
+    guint32 captured;
+
+    if (src->size - src->offset < PCAP_RECORD_HEADER_SIZE)
+      goto eos;
+    captured = gst_rtp_atlas_pcap_src_read_uint32(src, record + 8);
+    if (captured > src->size - src->offset - PCAP_RECORD_HEADER_SIZE)
+      goto eos;
+
+    ts = gst_rtp_atlas_pcap_src_read_uint32(src, record) * GST_SECOND +
+         gst_rtp_atlas_pcap_src_read_uint32(src, record + 4) *
+             (src->nanosecond ? 1 : GST_USECOND);
+    src->offset += PCAP_RECORD_HEADER_SIZE + captured;
+
+    if (gst_rtp_atlas_pcap_src_parse_frame(
+            src, record + PCAP_RECORD_HEADER_SIZE, captured, &payload_offset,
+            &payload_size))
+      break;
+    src->skipped++;
+  }
+
+  /* capture time since the first packet, scaled by speed */
+  if (!GST_CLOCK_TIME_IS_VALID(src->first_ts))
+    src->first_ts = ts;
+  ts = ts > src->first_ts ? ts - src->first_ts : 0;
+
+  if (src->speed > 0.0) {
+    ts = (GstClockTime)((gdouble)ts / src->speed);
+
+    ret = gst_rtp_atlas_pcap_src_wait(src, ts);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
+  /* zero-copy, the packet shares the mapped capture */
+  *buf = gst_buffer_new();
+  gst_buffer_append_memory(
+      *buf, gst_memory_share(src->memory, payload_offset, payload_size));
+  GST_BUFFER_PTS(*buf) = ts;
+  GST_BUFFER_DTS(*buf) = ts;
+  GST_BUFFER_OFFSET(*buf) = src->packets++;
+
+  return GST_FLOW_OK;
+
+eos:
+  if (src->offset < src->size)
+    GST_WARNING_OBJECT(src, "truncated capture at offset %" G_GSIZE_FORMAT,
+                       src->offset);
+  GST_DEBUG_OBJECT(src,
+                   "end of capture, %" G_GUINT64_FORMAT " packets pushed, "
+                   "%" G_GUINT64_FORMAT " frames skipped",
+                   src->packets, src->skipped);
+  return GST_FLOW_EOS;
+}
+
+static void gst_rtp_atlas_pcap_src_set_property(GObject *object,
+                                                guint prop_id,
+                                                const GValue *value,
+                                                GParamSpec *pspec) {
+  GstRtpAtlasPcapSrc *src = GST_RTP_ATLAS_PCAP_SRC(object);
+
+  switch (prop_id) {
+  case PROP_LOCATION:
+    g_free(src->location);
+    src->location = g_value_dup_string(value);
+    break;
+  case PROP_SDP_LOCATION:
+    g_free(src->sdp_location);
+    src->sdp_location = g_value_dup_string(value);
+    break;
+  case PROP_CAPS: {
+    GstCaps *caps = g_value_dup_boxed(value);
+
+    GST_OBJECT_LOCK(src);
+    gst_caps_take(&src->caps, caps);
+    GST_OBJECT_UNLOCK(src);
+    break;
+  }
+  case PROP_PORT:
+    src->port = g_value_get_uint(value);
+    break;
+  case PROP_SPEED:
+    src->speed = g_value_get_double(value);
+    gst_base_src_set_live(GST_BASE_SRC(src), src->speed > 0.0);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+    break;
+  }
+}
+
+static void gst_rtp_atlas_pcap_src_get_property(GObject *object,
+                                                guint prop_id, GValue *value,
+                                                GParamSpec *pspec) {
+  GstRtpAtlasPcapSrc *src = GST_RTP_ATLAS_PCAP_SRC(object);
+
+  switch (prop_id) {
+  case PROP_LOCATION:
+    g_value_set_string(value, src->location);
+    break;
+  case PROP_SDP_LOCATION:
+    g_value_set_string(value, src->sdp_location);
+    break;
+  case PROP_CAPS:
+    GST_OBJECT_LOCK(src);
+    gst_value_set_caps(value, src->caps);
+    GST_OBJECT_UNLOCK(src);
+    break;
+  case PROP_PORT:
+    g_value_set_uint(value, src->port);
+    break;
+  case PROP_SPEED:
+    g_value_set_double(value, src->speed);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+    break;
+  }
+}
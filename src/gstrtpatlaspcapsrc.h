@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __GST_RTP_ATLAS_PCAP_SRC_H__
+#define __GST_RTP_ATLAS_PCAP_SRC_H__
+
+#include <gst/base/gstpushsrc.h>
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+#define GST_TYPE_RTP_ATLAS_PCAP_SRC (gst_rtp_atlas_pcap_src_get_type())
+#define GST_RTP_ATLAS_PCAP_SRC(obj)                                            \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_RTP_ATLAS_PCAP_SRC,              \
+                              GstRtpAtlasPcapSrc))
+#define GST_RTP_ATLAS_PCAP_SRC_CLASS(klass)                                    \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GST_TYPE_RTP_ATLAS_PCAP_SRC,               \
+                           GstRtpAtlasPcapSrcClass))
+#define GST_IS_RTP_ATLAS_PCAP_SRC(obj)                                         \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_RTP_ATLAS_PCAP_SRC))
+#define GST_IS_RTP_ATLAS_PCAP_SRC_CLASS(klass)                                 \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_RTP_ATLAS_PCAP_SRC))
+typedef struct _GstRtpAtlasPcapSrc GstRtpAtlasPcapSrc;
+typedef struct _GstRtpAtlasPcapSrcClass GstRtpAtlasPcapSrcClass;
+
+struct _GstRtpAtlasPcapSrc {
+  GstPushSrc pushsrc;
+
+  gchar *location;
+  gchar *sdp_location;
+  GstCaps *caps;
+  guint port;
+
+  /* capture time is divided by speed, 0 pushes as fast as possible */
+  gdouble speed;
+
+  /* capture mapped in start(), every packet shares the memory wrapping the
+   * whole file */
+  GMappedFile *file;
+  GstMemory *memory;
+  const guint8 *data;
+  gsize size;
+  gsize offset;
+  gboolean big_endian;
+  gboolean nanosecond;
+  guint32 linktype;
+
+  GstCaps *src_caps;
+  GstClockTime first_ts;
+  guint64 packets;
+  guint64 skipped;
+
+  /* wait of the current packet, unscheduled by unlock(). Protected by the
+   * object lock */
+  GstClockID clock_id;
+  gboolean flushing;
+};
+
+struct _GstRtpAtlasPcapSrcClass {
+  GstPushSrcClass parent_class;
+};
+
+GType gst_rtp_atlas_pcap_src_get_type(void);
+
+G_END_DECLS
+#endif /* __GST_RTP_ATLAS_PCAP_SRC_H__ */
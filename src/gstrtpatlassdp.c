@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gstrtpatlassdp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* V3C optional parameters carried in the a=fmtp line, in the order they are
+ * written. Integer ones are caps fields of type int */
+static const struct {
+  const gchar *name;
+  gboolean is_int;
+} fmtp_parameters[] = {
+    {"v3c-unit-header", FALSE},
+    {"v3c-unit-type", TRUE},
+    {"v3c-vps-id", TRUE},
+    {"v3c-atlas-id", TRUE},
+    {"v3c-parameter-set", FALSE},
+    {"v3c-atlas-data", FALSE},
+    {"v3c-sei", FALSE},
+    {"v3c-common-atlas-data", FALSE},
+    {"v3c-ptl-level-idc", TRUE},
+    {"v3c-ptl-tier-flag", TRUE},
+    {"v3c-ptl-codec-idc", TRUE},
+    {"v3c-ptl-toolset-idc", TRUE},
+    {"v3c-ptl-rec-idc", TRUE},
+    {"v3c-tile-id-pres", TRUE},
+    {"tx-mode", FALSE},
+    {"sprop-max-don-diff", TRUE},
+};
+
+/* Returns the "<name>=<value>;..." part of an a=fmtp line for the V3C
+ * optional parameters of structure, NULL without any. Free with g_free() */
+gchar *gst_rtp_atlas_structure_to_fmtp_parameters(const GstStructure *structure) {
+  GString *params;
+  guint i, count = 0;
+
+  g_return_val_if_fail(structure != NULL, NULL);
+
+  params = g_string_new(NULL);
+
+  for (i = 0; i < G_N_ELEMENTS(fmtp_parameters); i++) {
+    const GValue *value = gst_structure_get_value(structure,
+                                                  fmtp_parameters[i].name);
+
+    if (value == NULL ||
+        !(G_VALUE_HOLDS_INT(value) || G_VALUE_HOLDS_STRING(value)))
+      continue;
+
+    if (count++ > 0)
+      g_string_append(params, ";");
+
+    if (G_VALUE_HOLDS_INT(value))
+      g_string_append_printf(params, "%s=%d", fmtp_parameters[i].name,
+                             g_value_get_int(value));
+    else
+      g_string_append_printf(params, "%s=%s", fmtp_parameters[i].name,
+                             g_value_get_string(value));
+  }
+
+  if (count == 0) {
+    g_string_free(params, TRUE);
+    return NULL;
+  }
+
+  return g_string_free(params, FALSE);
+}
+
+/* Returns the value of an a=fmtp line, "<payload> <name>=<value>;...", for
+ * the V3C optional parameters of RTP caps, NULL without any. Free with
+ * g_free() */
+gchar *gst_rtp_atlas_caps_to_fmtp(GstCaps *caps) {
+  GstStructure *structure;
+  gchar *params, *fmtp;
+  gint payload = 96;
+
+  g_return_val_if_fail(GST_IS_CAPS(caps), NULL);
+
+  if (gst_caps_get_size(caps) == 0)
+    return NULL;
+
+  structure = gst_caps_get_structure(caps, 0);
+  gst_structure_get_int(structure, "payload", &payload);
+
+  params = gst_rtp_atlas_structure_to_fmtp_parameters(structure);
+  if (params == NULL)
+    return NULL;
+
+  fmtp = g_strdup_printf("%d %s", payload, params);
+  g_free(params);
+
+  return fmtp;
+}
+
+/* Sets the V3C optional parameters of an a=fmtp line on the first structure
+ * of writable RTP caps. "a=fmtp:" and the payload type in front are
+ * optional, unknown parameters are ignored */
+gboolean gst_rtp_atlas_fmtp_to_caps(const gchar *fmtp, GstCaps *caps) {
+  GstStructure *structure;
+  gchar **params;
+  guint i, j;
+
+  g_return_val_if_fail(fmtp != NULL, FALSE);
+  g_return_val_if_fail(GST_IS_CAPS(caps), FALSE);
+  g_return_val_if_fail(gst_caps_is_writable(caps), FALSE);
+
+  if (gst_caps_get_size(caps) == 0)
+    return FALSE;
+  structure = gst_caps_get_structure(caps, 0);
+
+  if (g_str_has_prefix(fmtp, "a=fmtp:"))
+    fmtp += strlen("a=fmtp:");
+  /* payload type, then parameters after a space */
+  if (g_ascii_isdigit(*fmtp)) {
+    const gchar *space = strchr(fmtp, ' ');
+
+    if (space == NULL)
+      return FALSE;
+    fmtp = space + 1;
+  }
+
+  params = g_strsplit(fmtp, ";", -1);
+  for (i = 0; params[i]; i++) {
+    gchar *param = g_strstrip(params[i]);
+    gchar *value = strchr(param, '=');
+
+    if (value == NULL)
+      continue;
+    *value++ = '\0';
+    g_strstrip(param);
+    g_strstrip(value);
+
+    for (j = 0; j < G_N_ELEMENTS(fmtp_parameters); j++) {
+      if (g_ascii_strcasecmp(param, fmtp_parameters[j].name) != 0)
+        continue;
+
+      if (fmtp_parameters[j].is_int)
+        gst_structure_set(structure, fmtp_parameters[j].name, G_TYPE_INT,
+                          atoi(value), NULL);
+      else
+        gst_structure_set(structure, fmtp_parameters[j].name, G_TYPE_STRING,
+                          value, NULL);
+      break;
+    }
+  }
+  g_strfreev(params);
+
+  return TRUE;
+}
+
+/* Returns RTP caps for the first V3C payload type of an SDP: payload and
+ * clock-rate of its a=rtpmap line, the V3C optional parameters of its a=fmtp
+ * line, and the a=extmap lines of the session and of its media section as
+ * extmap-<id> fields. NULL without any V3C payload type */
+GstCaps *gst_rtp_atlas_sdp_to_caps(const gchar *sdp) {
+  GstCaps *caps = NULL;
+  gchar **lines;
+  gint payload = -1, clock_rate = 90000;
+  guint i, session_end = 0, media_start = 0;
+
+  g_return_val_if_fail(sdp != NULL, NULL);
+
+  lines = g_strsplit(sdp, "\n", -1);
+  for (i = 0; lines[i]; i++)
+    g_strchomp(lines[i]);
+
+  /* media section holding the first a=rtpmap:<payload> v3c/<clock-rate> */
+  for (i = 0; lines[i] && payload < 0; i++) {
+    gchar encoding[16];
+    guint pt, rate;
+
+    if (g_str_has_prefix(lines[i], "m=")) {
+      if (media_start == 0)
+        session_end = i;
+      media_start = i;
+      continue;
+    }
+
+    if (media_start > 0 &&
+        sscanf(lines[i], "a=rtpmap:%u %15[^/]/%u", &pt, encoding, &rate) == 3 &&
+        pt <= 127 && g_ascii_strcasecmp(encoding, "v3c") == 0) {
+      payload = pt;
+      clock_rate = rate;
+    }
+  }
+
+  if (payload < 0)
+    goto done;
+
+  caps = gst_caps_new_simple("application/x-rtp", "media", G_TYPE_STRING,
+                             "application", "payload", G_TYPE_INT, payload,
+                             "clock-rate", G_TYPE_INT, clock_rate,
+                             "encoding-name", G_TYPE_STRING, "v3c", NULL);
+
+  for (i = 0; lines[i]; i++) {
+    if (i >= session_end && i < media_start)
+      continue;
+    if (i > media_start && g_str_has_prefix(lines[i], "m="))
+      break;
+
+    if (g_str_has_prefix(lines[i], "a=fmtp:") &&
+        atoi(lines[i] + strlen("a=fmtp:")) == payload) {
+      gst_rtp_atlas_fmtp_to_caps(lines[i], caps);
+    } else if (g_str_has_prefix(lines[i], "a=extmap:")) {
+      /* a=extmap:<id>[/<direction>] <uri> [<attributes>] */
+      gchar **fields = g_strsplit(lines[i] + strlen("a=extmap:"), " ", 3);
+      gint id = atoi(fields[0]);
+
+      if (fields[1] && id > 0 && id < 256) {
+        gchar *name = g_strdup_printf("extmap-%d", id);
+
+        gst_caps_set_simple(caps, name, G_TYPE_STRING, fields[1], NULL);
+        g_free(name);
+      }
+      g_strfreev(fields);
+    }
+  }
+
+done:
+  g_strfreev(lines);
+
+  return caps;
+}
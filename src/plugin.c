@@ -34,6 +34,7 @@
 #endif
 
 #include "gstrtpatlasdepay.h"
+#include "gstrtpatlaspcapsrc.h"
 #include "gstrtpatlaspay.h"
 
 GST_DEBUG_CATEGORY(atlas_debug);
@@ -49,6 +50,9 @@ static gboolean plugin_init(GstPlugin *plugin) {
   ret |= gst_element_register(plugin, "rtpatlaspay", GST_RANK_PRIMARY + 1,
                               GST_TYPE_RTP_ATLAS_PAY);
 
+  ret |= gst_element_register(plugin, "rtpatlaspcapsrc", GST_RANK_NONE,
+                              GST_TYPE_RTP_ATLAS_PCAP_SRC);
+
   return ret;
 }
 
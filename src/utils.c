@@ -32,148 +32,321 @@
 #include "utils.h"
 #include <stdio.h>
 
-guint8 gst_codec_data_get_unit_size_precision_bytes_minus1(GstBuffer *buffer) {
+/* Copies the first size bytes of buffer, FALSE when the buffer is shorter.
+ * The getters below read fields at fixed offsets of caps provided data */
+static gboolean gst_atlas_buffer_read(GstBuffer *buffer, guint8 *data,
+                                      gsize size) {
+  if (buffer == NULL || gst_buffer_extract(buffer, 0, data, size) != size) {
+    GST_WARNING("buffer shorter than %" G_GSIZE_FORMAT " bytes", size);
+    return FALSE;
+  }
 
-  GstMapInfo map;
-  guint8 *data = NULL;
+  return TRUE;
+}
 
-  guint8 unit_size_precision_bytes_minus1 = 0;
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
-  data = map.data;
-  unit_size_precision_bytes_minus1 = (data[0] >> 5) & 0x07;
-  gst_buffer_unmap(buffer, &map);
+guint8 gst_codec_data_get_unit_size_precision_bytes_minus1(GstBuffer *buffer) {
+  guint8 data[1];
+
+  if (!gst_atlas_buffer_read(buffer, data, sizeof(data)))
+    return 0;
 
-  return unit_size_precision_bytes_minus1;
+  return (data[0] >> 5) & 0x07;
 }
 
 GstBuffer *gst_codec_data_get_vps_unit(GstBuffer *buffer) {
-  GstMapInfo map;
-  guint8 *data = NULL;
+  guint8 data[3];
   guint8 num_of_v3c_parameter_sets = 0;
   guint16 v3c_parameter_set_length = 0;
-  
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
-  data = map.data;
+
+  if (!gst_atlas_buffer_read(buffer, data, sizeof(data)))
+    return NULL;
   num_of_v3c_parameter_sets = data[0] & 0x1F;
-  
+
   if (num_of_v3c_parameter_sets != 1) {
     GST_ERROR("num_of_v3c_parameter_sets shall be equal to 1 according "
               "to ISO/IEC 23090-10");
-    gst_buffer_unmap(buffer, &map);
     return NULL;
   }
 
-  v3c_parameter_set_length = data[1];
-  v3c_parameter_set_length = (v3c_parameter_set_length << 8) | data[2];
-  gst_buffer_unmap(buffer, &map);
+  v3c_parameter_set_length = GST_READ_UINT16_BE(data + 1);
+  if (v3c_parameter_set_length > gst_buffer_get_size(buffer) - 3) {
+    GST_ERROR("v3c_parameter_set_length %u exceeds the "
+              "V3CDecoderConfigurationRecord",
+              v3c_parameter_set_length);
+    return NULL;
+  }
 
   return gst_buffer_copy_region(buffer, GST_BUFFER_COPY_ALL, 3,
                                v3c_parameter_set_length);
 }
 
-guint8 gst_vuh_data_get_v3c_parameter_set_id(GstBuffer *buffer) {
-
+/* Appends a buffer for each setup_unit() of the setup unit arrays found in
+ * the V3CDecoderConfigurationRecord, in the order they appear */
+gboolean gst_codec_data_get_setup_units(GstBuffer *buffer, GPtrArray *units) {
   GstMapInfo map;
-  guint8 *data = NULL;
+  GstByteReader br;
+  guint8 byte, num_of_v3c_parameter_sets, num_of_setup_unit_arrays;
+  guint16 length;
+  guint i, j;
+
+  if (!gst_buffer_map(buffer, &map, GST_MAP_READ))
+    return FALSE;
+  gst_byte_reader_init(&br, map.data, map.size);
+
+  if (!gst_byte_reader_get_uint8(&br, &byte))
+    goto error;
+  num_of_v3c_parameter_sets = byte & 0x1F;
+
+  for (i = 0; i < num_of_v3c_parameter_sets; i++) {
+    if (!gst_byte_reader_get_uint16_be(&br, &length) ||
+        !gst_byte_reader_skip(&br, length))
+      goto error;
+  }
+
+  /* setup unit arrays are optional */
+  if (!gst_byte_reader_get_uint8(&br, &num_of_setup_unit_arrays))
+    num_of_setup_unit_arrays = 0;
+
+  for (i = 0; i < num_of_setup_unit_arrays; i++) {
+    guint8 num_nal_units;
+
+    /* array_completeness, reserved, nal_unit_type */
+    if (!gst_byte_reader_skip(&br, 1) ||
+        !gst_byte_reader_get_uint8(&br, &num_nal_units))
+      goto error;
+
+    for (j = 0; j < num_nal_units; j++) {
+      guint offset;
+
+      if (!gst_byte_reader_get_uint16_be(&br, &length))
+        goto error;
+      offset = gst_byte_reader_get_pos(&br);
+      if (length < 2 || !gst_byte_reader_skip(&br, length))
+        goto error;
+
+      g_ptr_array_add(units, gst_buffer_copy_region(buffer, GST_BUFFER_COPY_ALL,
+                                                    offset, length));
+    }
+  }
 
-  guint8 v3c_parameter_set_id = 0;
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
-  data = map.data;
-  v3c_parameter_set_id = ((data[0] << 5) & 0xE0) | ((data[1] >> 7) & 0x01);
   gst_buffer_unmap(buffer, &map);
+  return TRUE;
 
-  return v3c_parameter_set_id;
+error:
+  GST_ERROR("V3CDecoderConfigurationRecord is truncated");
+  gst_buffer_unmap(buffer, &map);
+  return FALSE;
 }
 
-guint8 gst_vuh_data_get_atlas_id(GstBuffer *buffer) {
+guint8 gst_vuh_data_get_v3c_parameter_set_id(GstBuffer *buffer) {
+  guint8 data[2];
 
-  GstMapInfo map;
-  guint8 *data = NULL;
+  if (!gst_atlas_buffer_read(buffer, data, sizeof(data)))
+    return 0;
 
-  guint8 atlas_id = 0;
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
-  data = map.data;
-  atlas_id = (data[1] >> 1) & 0x3F;
-  gst_buffer_unmap(buffer, &map);
+  return ((data[0] << 5) & 0xE0) | ((data[1] >> 7) & 0x01);
+}
 
-  return atlas_id;
+guint8 gst_vuh_data_get_atlas_id(GstBuffer *buffer) {
+  guint8 data[2];
+
+  if (!gst_atlas_buffer_read(buffer, data, sizeof(data)))
+    return 0;
+
+  return (data[1] >> 1) & 0x3F;
 }
 
 guint8 gst_vuh_data_get_unit_type(GstBuffer *buffer) {
+  guint8 data[1];
 
-  GstMapInfo map;
-  guint8 *data = NULL;
+  if (!gst_atlas_buffer_read(buffer, data, sizeof(data)))
+    return 0;
 
-  guint8 unit_type = 0;
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
-  data = map.data;
-  unit_type = (data[0] >> 3) & 0x1F;
-  gst_buffer_unmap(buffer, &map);
-
-  return unit_type;
+  return (data[0] >> 3) & 0x1F;
 }
 
 guint8 gst_vps_data_get_ptl_tier_flag(GstBuffer *buffer) {
-  GstMapInfo map;
-  guint8 *data = NULL;
+  guint8 data[1];
 
-  guint8 ptl_tier_flag = 0;
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
-  data = map.data;
-  ptl_tier_flag = (data[0] >> 7) & 0x01;
-  gst_buffer_unmap(buffer, &map);
+  if (!gst_atlas_buffer_read(buffer, data, sizeof(data)))
+    return 0;
 
-  return ptl_tier_flag;
+  return (data[0] >> 7) & 0x01;
 }
 
 guint8 gst_vps_data_get_ptl_codec_idc(GstBuffer *buffer) {
-  GstMapInfo map;
-  guint8 *data = NULL;
+  guint8 data[1];
 
-  guint8 ptl_codec_idc = 0;
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
-  data = map.data;
-  ptl_codec_idc = data[0] & 0x7F;
-  gst_buffer_unmap(buffer, &map);
+  if (!gst_atlas_buffer_read(buffer, data, sizeof(data)))
+    return 0;
 
-  return ptl_codec_idc;
+  return data[0] & 0x7F;
 }
 
 guint8 gst_vps_data_get_ptl_toolset_idc(GstBuffer *buffer) {
-  GstMapInfo map;
-  guint8 *data = NULL;
+  guint8 data[2];
 
-  guint8 ptl_toolset_idc = 0;
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
-  data = map.data;
-  ptl_toolset_idc = data[1];
-  gst_buffer_unmap(buffer, &map);
+  if (!gst_atlas_buffer_read(buffer, data, sizeof(data)))
+    return 0;
 
-  return ptl_toolset_idc;
+  return data[1];
 }
 
 guint8 gst_vps_data_get_ptl_rec_idc(GstBuffer *buffer) {
-  GstMapInfo map;
-  guint8 *data = NULL;
+  guint8 data[3];
 
-  guint8 ptl_rec_idc = 0;
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
-  data = map.data;
-  ptl_rec_idc = data[2];
-  gst_buffer_unmap(buffer, &map);
+  if (!gst_atlas_buffer_read(buffer, data, sizeof(data)))
+    return 0;
 
-  return ptl_rec_idc;
+  return data[2];
 }
 
 guint8 gst_vps_data_get_ptl_level_idc(GstBuffer *buffer) {
+  guint8 data[8];
+
+  if (!gst_atlas_buffer_read(buffer, data, sizeof(data)))
+    return 0;
+
+  return data[7];
+}
+
+/* FNV-1a, cheap enough to be used on every codec_data update */
+guint32 gst_atlas_hash_data(guint32 hash, const guint8 *data, gsize size) {
+  gsize i;
+
+  for (i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+guint32 gst_atlas_hash_buffer(guint32 hash, GstBuffer *buffer) {
   GstMapInfo map;
-  guint8 *data = NULL;
 
-  guint8 ptl_level_idc = 0;
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
-  data = map.data;
-  ptl_level_idc = data[7];
+  if (buffer == NULL || !gst_buffer_map(buffer, &map, GST_MAP_READ))
+    return hash;
+
+  hash = gst_atlas_hash_data(hash, map.data, map.size);
   gst_buffer_unmap(buffer, &map);
 
-  return ptl_level_idc;
+  return hash;
+}
+
+typedef struct {
+  const guint8 *data;
+  gsize size;
+  gsize byte;
+  guint bit;
+  guint zeros;
+} AtlasRbspReader;
+
+/* reads one bit of the RBSP, skipping emulation_prevention_three_byte */
+static gboolean atlas_rbsp_read_bit(AtlasRbspReader *reader, guint8 *bit) {
+  if (reader->bit == 0) {
+    if (reader->byte >= reader->size)
+      return FALSE;
+
+    if (reader->zeros >= 2 && reader->data[reader->byte] == 0x03) {
+      reader->zeros = 0;
+      reader->byte++;
+      if (reader->byte >= reader->size)
+        return FALSE;
+    }
+
+    if (reader->data[reader->byte] == 0x00)
+      reader->zeros++;
+    else
+      reader->zeros = 0;
+  }
+
+  *bit = (reader->data[reader->byte] >> (7 - reader->bit)) & 0x01;
+
+  reader->bit++;
+  if (reader->bit == 8) {
+    reader->bit = 0;
+    reader->byte++;
+  }
+
+  return TRUE;
+}
+
+static gboolean atlas_rbsp_read_ue(AtlasRbspReader *reader, guint32 *value) {
+  guint leading_zeros = 0;
+  guint32 suffix = 0;
+  guint8 bit = 0;
+  guint i;
+
+  while (TRUE) {
+    if (!atlas_rbsp_read_bit(reader, &bit))
+      return FALSE;
+    if (bit)
+      break;
+    if (++leading_zeros > 31)
+      return FALSE;
+  }
+
+  for (i = 0; i < leading_zeros; i++) {
+    if (!atlas_rbsp_read_bit(reader, &bit))
+      return FALSE;
+    suffix = (suffix << 1) | bit;
+  }
+
+  *value = (1u << leading_zeros) - 1 + suffix;
+
+  return TRUE;
+}
+
+/* ASPS, AFPS and AAPS all start with their own ue(v) coded id
+ * right after the 2 bytes NAL unit header (ISO/IEC 23090-5) */
+gboolean gst_atlas_nal_get_parameter_set_id(const guint8 *data, gsize size,
+                                            guint32 *ps_id) {
+  AtlasRbspReader reader = {0, };
+
+  if (size < 3)
+    return FALSE;
+
+  reader.data = data;
+  reader.size = size;
+  reader.byte = 2;
+
+  return atlas_rbsp_read_ue(&reader, ps_id);
+}
+
+/* Temporal sub-layer thinning (ISO/IEC 23090-5 sub-bitstream extraction).
+ * Lowering max_temporal_id takes effect at once. Raising it only happens at
+ * an IRAP, at a TSA of the next sub-layer (all sub-layers above become
+ * decodable) or at an STSA of the next sub-layer (only that one does), so no
+ * output NAL unit references a dropped one. temporal_id_limit keeps the
+ * sub-layer reached so far between calls */
+gboolean gst_atlas_nal_temporal_id_allowed(guint8 nal_type,
+                                          guint8 temporal_id_plus1,
+                                          guint max_temporal_id,
+                                          guint *temporal_id_limit) {
+  guint temporal_id;
+
+  /* forbidden value, leave it to the decoder */
+  if (temporal_id_plus1 == 0)
+    return TRUE;
+
+  temporal_id = temporal_id_plus1 - 1;
+
+  if (*temporal_id_limit > max_temporal_id)
+    *temporal_id_limit = max_temporal_id;
+
+  if (*temporal_id_limit < max_temporal_id) {
+    if (nal_type >= GST_ATLAS_NAL_BLA_W_LP &&
+        nal_type <= GST_ATLAS_NAL_RSV_IRAP_ACL_29) {
+      *temporal_id_limit = max_temporal_id;
+    } else if (temporal_id == *temporal_id_limit + 1) {
+      if (nal_type == GST_ATLAS_NAL_TSA_N || nal_type == GST_ATLAS_NAL_TSA_R)
+        *temporal_id_limit = max_temporal_id;
+      else if (nal_type == GST_ATLAS_NAL_STSA_N ||
+               nal_type == GST_ATLAS_NAL_STSA_R)
+        *temporal_id_limit = temporal_id;
+    }
+  }
+
+  return temporal_id <= *temporal_id_limit;
 }
@@ -36,6 +36,14 @@
 #include <gst/gst.h>
 
 G_BEGIN_DECLS
+
+/* initial value for gst_atlas_hash_data() */
+#define GST_ATLAS_HASH_INIT 2166136261u
+
+/* URI of the one-byte RTP header extension carrying the atlas_id of the
+ * packet when several atlases share one RTP session */
+#define GST_RTP_ATLAS_ID_EXTMAP_URI "urn:x-v3c:atlas-id"
+
 typedef enum {
   GST_ATLAS_NAL_TRAIL_N = 0,
   GST_ATLAS_NAL_TRAIL_R = 1,
@@ -81,6 +89,7 @@ typedef enum {
 
 guint8 gst_codec_data_get_unit_size_precision_bytes_minus1(GstBuffer *buffer);
 GstBuffer* gst_codec_data_get_vps_unit(GstBuffer *buffer);
+gboolean gst_codec_data_get_setup_units(GstBuffer *buffer, GPtrArray *units);
 guint8 gst_vuh_data_get_v3c_parameter_set_id(GstBuffer *buffer);
 guint8 gst_vuh_data_get_atlas_id(GstBuffer *buffer);
 guint8 gst_vuh_data_get_unit_type(GstBuffer *buffer);
@@ -89,5 +98,13 @@ guint8 gst_vps_data_get_ptl_codec_idc(GstBuffer *buffer);
 guint8 gst_vps_data_get_ptl_toolset_idc(GstBuffer *buffer);
 guint8 gst_vps_data_get_ptl_rec_idc(GstBuffer *buffer);
 guint8 gst_vps_data_get_ptl_level_idc(GstBuffer *buffer);
+guint32 gst_atlas_hash_data(guint32 hash, const guint8 *data, gsize size);
+guint32 gst_atlas_hash_buffer(guint32 hash, GstBuffer *buffer);
+gboolean gst_atlas_nal_get_parameter_set_id(const guint8 *data, gsize size,
+                                            guint32 *ps_id);
+gboolean gst_atlas_nal_temporal_id_allowed(guint8 nal_type,
+                                          guint8 temporal_id_plus1,
+                                          guint max_temporal_id,
+                                          guint *temporal_id_limit);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* rtpatlasdepay with tx-mode MRST: the FUs of two RTP streams interleaved
+ * in one depayloader, each with a sequence number space of its own. The
+ * reorder window in front of a single RTP stream, and wait-for-keyframe */
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <string.h>
+
+GST_PLUGIN_STATIC_DECLARE(atlas);
+
+#define MRST_CAPS                                                              \
+  "application/x-rtp, media=(string)application, clock-rate=(int)90000, "     \
+  "encoding-name=(string)v3c, tx-mode=(string)MRST"
+
+#define SRST_CAPS                                                              \
+  "application/x-rtp, media=(string)application, clock-rate=(int)90000, "     \
+  "encoding-name=(string)v3c"
+
+#define SSRC_A 0x11111111
+#define SSRC_B 0x22222222
+
+/* FU packets of a TRAIL_R NAL unit (F=0, Type=1, LayerId=0, TID=1), DONL
+ * after the FU header of the first fragment. NAL unit 0 is the first tile
+ * of the atlas frame on stream A, NAL unit 1 the next tile on stream B */
+static const guint8 fu_a_start[] = {0x72, 0x01, 0x81, 0x00, 0x00, 0x80, 0x11};
+static const guint8 fu_a_middle[] = {0x72, 0x01, 0x01, 0x12, 0x13};
+static const guint8 fu_a_end[] = {0x72, 0x01, 0x41, 0x14};
+static const guint8 fu_b_start[] = {0x72, 0x01, 0x81, 0x00, 0x01, 0x00, 0x21};
+static const guint8 fu_b_middle[] = {0x72, 0x01, 0x01, 0x22};
+static const guint8 fu_b_end[] = {0x72, 0x01, 0x41, 0x23};
+
+static const guint8 nal_a[] = {0x00, 0x00, 0x00, 0x07, 0x02, 0x01,
+                               0x80, 0x11, 0x12, 0x13, 0x14};
+static const guint8 nal_b[] = {0x00, 0x00, 0x00, 0x06, 0x02,
+                               0x01, 0x00, 0x21, 0x22, 0x23};
+
+/* FU packets of a TRAIL_R NAL unit without DONL, and an access unit of a
+ * single TRAIL_R NAL unit, for one RTP stream */
+static const guint8 fu_start[] = {0x72, 0x01, 0x81, 0x31};
+static const guint8 fu_middle[] = {0x72, 0x01, 0x01, 0x32};
+static const guint8 fu_end[] = {0x72, 0x01, 0x41, 0x33};
+static const guint8 single[] = {0x02, 0x01, 0x41};
+
+static const guint8 nal_fu[] = {0x00, 0x00, 0x00, 0x05, 0x02,
+                                0x01, 0x31, 0x32, 0x33};
+static const guint8 nal_single[] = {0x00, 0x00, 0x00, 0x03,
+                                    0x02, 0x01, 0x41};
+
+/* single NAL unit packets (TID=0, first tile of the atlas frame) of an
+ * IDR_N_LP, a CRA, a RASL_N and a TRAIL_R */
+static const guint8 idr[] = {0x2e, 0x01, 0x80};
+static const guint8 cra[] = {0x34, 0x01, 0x80};
+static const guint8 rasl[] = {0x10, 0x01, 0x80};
+static const guint8 trail[] = {0x02, 0x01, 0x80};
+
+static GstBuffer *make_packet(guint32 ssrc, guint16 seqnum, gboolean marker,
+                              const guint8 *payload, gsize size) {
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  GstBuffer *buffer = gst_rtp_buffer_new_allocate(size, 0, 0);
+
+  gst_rtp_buffer_map(buffer, GST_MAP_WRITE, &rtp);
+  gst_rtp_buffer_set_payload_type(&rtp, 96);
+  gst_rtp_buffer_set_ssrc(&rtp, ssrc);
+  gst_rtp_buffer_set_seq(&rtp, seqnum);
+  gst_rtp_buffer_set_marker(&rtp, marker);
+  memcpy(gst_rtp_buffer_get_payload(&rtp), payload, size);
+  gst_rtp_buffer_unmap(&rtp);
+  GST_BUFFER_PTS(buffer) = 0;
+
+  return buffer;
+}
+
+#define PUSH(h, ssrc, seqnum, marker, payload)                                \
+  fail_unless_equals_int(                                                      \
+      gst_harness_push(h, make_packet(ssrc, seqnum, marker, payload,           \
+                                      sizeof(payload))),                       \
+      GST_FLOW_OK)
+
+static void check_au(GstBuffer *au, gboolean with_b) {
+  gsize size = sizeof(nal_a) + (with_b ? sizeof(nal_b) : 0);
+
+  fail_unless(au != NULL);
+  fail_unless_equals_int(gst_buffer_get_size(au), size);
+  fail_unless(gst_buffer_memcmp(au, 0, nal_a, sizeof(nal_a)) == 0);
+  if (with_b)
+    fail_unless(gst_buffer_memcmp(au, sizeof(nal_a), nal_b, sizeof(nal_b)) ==
+                0);
+  fail_if(GST_BUFFER_FLAG_IS_SET(au, GST_BUFFER_FLAG_CORRUPTED));
+}
+
+GST_START_TEST(test_mrst_interleaved_ssrcs) {
+  GstHarness *h = gst_harness_new("rtpatlasdepay");
+  GstBuffer *au;
+
+  gst_harness_set_src_caps_str(h, MRST_CAPS);
+
+  /* sequence numbers far apart, neither stream looks old to the other */
+  PUSH(h, SSRC_A, 100, FALSE, fu_a_start);
+  PUSH(h, SSRC_B, 7, FALSE, fu_b_start);
+  PUSH(h, SSRC_A, 101, FALSE, fu_a_middle);
+  PUSH(h, SSRC_A, 102, FALSE, fu_a_end);
+  PUSH(h, SSRC_B, 8, FALSE, fu_b_middle);
+  PUSH(h, SSRC_B, 9, TRUE, fu_b_end);
+
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 1);
+  au = gst_harness_pull(h);
+  check_au(au, TRUE);
+  gst_buffer_unref(au);
+
+  gst_harness_teardown(h);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_mrst_loss_in_one_ssrc) {
+  GstHarness *h = gst_harness_new("rtpatlasdepay");
+  GstBuffer *au;
+
+  gst_harness_set_src_caps_str(h, MRST_CAPS);
+
+  /* the middle fragment of stream B is lost and a duplicate of stream A
+   * arrives, the FU of stream A is not affected */
+  PUSH(h, SSRC_A, 100, FALSE, fu_a_start);
+  PUSH(h, SSRC_B, 7, FALSE, fu_b_start);
+  PUSH(h, SSRC_A, 101, FALSE, fu_a_middle);
+  PUSH(h, SSRC_A, 101, FALSE, fu_a_middle);
+  PUSH(h, SSRC_A, 102, FALSE, fu_a_end);
+  PUSH(h, SSRC_B, 9, TRUE, fu_b_end);
+
+  /* the access unit lost its marker, it ends at EOS */
+  fail_unless(gst_harness_push_event(h, gst_event_new_eos()));
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 1);
+  au = gst_harness_pull(h);
+  check_au(au, FALSE);
+  gst_buffer_unref(au);
+
+  gst_harness_teardown(h);
+}
+GST_END_TEST;
+
+static void check_single_nal_au(GstBuffer *au, const guint8 *nal, gsize size) {
+  fail_unless(au != NULL);
+  fail_unless_equals_int(gst_buffer_get_size(au), size);
+  fail_unless(gst_buffer_memcmp(au, 0, nal, size) == 0);
+  fail_if(GST_BUFFER_FLAG_IS_SET(au, GST_BUFFER_FLAG_CORRUPTED));
+}
+
+GST_START_TEST(test_reorder_swapped_fu) {
+  GstHarness *h = gst_harness_new("rtpatlasdepay");
+  GstBuffer *au;
+
+  g_object_set(h->element, "reorder-window", 4, NULL);
+  gst_harness_set_src_caps_str(h, SRST_CAPS);
+
+  /* the last two fragments arrive swapped, the end waits for the middle */
+  PUSH(h, SSRC_A, 10, FALSE, fu_start);
+  PUSH(h, SSRC_A, 12, TRUE, fu_end);
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 0);
+  PUSH(h, SSRC_A, 11, FALSE, fu_middle);
+
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 1);
+  au = gst_harness_pull(h);
+  check_single_nal_au(au, nal_fu, sizeof(nal_fu));
+  gst_buffer_unref(au);
+
+  gst_harness_teardown(h);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_reorder_window_expiry) {
+  GstHarness *h = gst_harness_new("rtpatlasdepay");
+  GstBuffer *au;
+
+  g_object_set(h->element, "reorder-window", 4, "reorder-window-time", 1,
+               NULL);
+  gst_harness_set_src_caps_str(h, SRST_CAPS);
+
+  PUSH(h, SSRC_A, 10, FALSE, fu_start);
+  PUSH(h, SSRC_A, 12, TRUE, fu_end);
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 0);
+
+  /* the window time is over when the next packet arrives: the end of the
+   * Fragmentation Unit goes on without its middle and the NAL unit is
+   * dropped, the next access unit is not held back */
+  g_usleep(10 * G_TIME_SPAN_MILLISECOND);
+  PUSH(h, SSRC_A, 13, TRUE, single);
+
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 1);
+  au = gst_harness_pull(h);
+  check_single_nal_au(au, nal_single, sizeof(nal_single));
+  gst_buffer_unref(au);
+
+  /* the middle fragment is too late now */
+  PUSH(h, SSRC_A, 11, FALSE, fu_middle);
+  fail_unless(gst_harness_push_event(h, gst_event_new_eos()));
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 0);
+
+  gst_harness_teardown(h);
+}
+GST_END_TEST;
+
+/* the access unit of a single NAL unit packet */
+static void check_packet_au(GstHarness *h, const guint8 *payload, gsize size) {
+  GstBuffer *au = gst_harness_pull(h);
+  guint8 prefix[4];
+
+  GST_WRITE_UINT32_BE(prefix, size);
+  fail_unless(au != NULL);
+  fail_unless_equals_int(gst_buffer_get_size(au), size + 4);
+  fail_unless(gst_buffer_memcmp(au, 0, prefix, 4) == 0);
+  fail_unless(gst_buffer_memcmp(au, 4, payload, size) == 0);
+  gst_buffer_unref(au);
+}
+
+/* the properties are read when the depayloader starts */
+static GstHarness *new_keyframe_harness(void) {
+  GstElement *depay = gst_element_factory_make("rtpatlasdepay", NULL);
+  GstHarness *h;
+
+  g_object_set(depay, "wait-for-keyframe", TRUE, NULL);
+  h = gst_harness_new_with_element(depay, "sink", "src");
+  gst_object_unref(depay);
+  gst_harness_set_src_caps_str(h, SRST_CAPS);
+
+  return h;
+}
+
+GST_START_TEST(test_wait_for_keyframe) {
+  GstHarness *h = new_keyframe_harness();
+
+  /* access units before the first IRAP cannot be decoded */
+  PUSH(h, SSRC_A, 1, TRUE, trail);
+  PUSH(h, SSRC_A, 2, TRUE, trail);
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 0);
+
+  PUSH(h, SSRC_A, 3, TRUE, idr);
+  PUSH(h, SSRC_A, 4, TRUE, trail);
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 2);
+  check_packet_au(h, idr, sizeof(idr));
+  check_packet_au(h, trail, sizeof(trail));
+
+  gst_harness_teardown(h);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_wait_for_keyframe_skip_rasl) {
+  GstHarness *h = new_keyframe_harness();
+
+  /* output starts at a CRA, its RASL atlas frames reference atlas frames
+   * that were not output */
+  PUSH(h, SSRC_A, 1, TRUE, trail);
+  PUSH(h, SSRC_A, 2, TRUE, cra);
+  PUSH(h, SSRC_A, 3, TRUE, rasl);
+  PUSH(h, SSRC_A, 4, TRUE, rasl);
+  PUSH(h, SSRC_A, 5, TRUE, trail);
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 2);
+  check_packet_au(h, cra, sizeof(cra));
+  check_packet_au(h, trail, sizeof(trail));
+
+  gst_harness_teardown(h);
+}
+GST_END_TEST;
+
+static Suite *rtpatlasdepay_suite(void) {
+  Suite *s = suite_create("rtpatlasdepay");
+  TCase *tc_chain = tcase_create("mrst");
+  TCase *tc_reorder = tcase_create("reorder");
+  TCase *tc_keyframe = tcase_create("keyframe");
+
+  suite_add_tcase(s, tc_chain);
+  tcase_add_test(tc_chain, test_mrst_interleaved_ssrcs);
+  tcase_add_test(tc_chain, test_mrst_loss_in_one_ssrc);
+
+  suite_add_tcase(s, tc_reorder);
+  tcase_add_test(tc_reorder, test_reorder_swapped_fu);
+  tcase_add_test(tc_reorder, test_reorder_window_expiry);
+
+  suite_add_tcase(s, tc_keyframe);
+  tcase_add_test(tc_keyframe, test_wait_for_keyframe);
+  tcase_add_test(tc_keyframe, test_wait_for_keyframe_skip_rasl);
+
+  return s;
+}
+
+/* GStreamer without registry scan, and the plugin linked in statically */
+int main(int argc, char **argv) {
+  g_setenv("GST_REGISTRY_DISABLE", "yes", TRUE);
+  gst_check_init(&argc, &argv);
+  GST_PLUGIN_STATIC_REGISTER(atlas);
+
+  return gst_check_run_suite(rtpatlasdepay_suite(), "rtpatlasdepay",
+                             __FILE__);
+}
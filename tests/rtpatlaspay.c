@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* rtpatlaspay with a second atlas on a sink_%u request pad: the atlas_id
+ * header extension of each packet, and EOS once every sink pad is done */
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <string.h>
+
+GST_PLUGIN_STATIC_DECLARE(atlas);
+
+#define ATLAS_ID_EXT_ID 1
+
+/* V3CDecoderConfigurationRecord with 4 bytes NAL unit lengths, the same
+ * VPS for both atlases and no setup units, and the V3C unit header of
+ * V3C_AD with atlas_id 0 and 1 */
+#define ATLAS_CAPS(vuh)                                                        \
+  "video/x-atlas, stream-format=(string)v3cg, alignment=(string)au, "        \
+  "codec_data=(buffer)610008000102030405060700, vuh_data=(buffer)" vuh
+
+#define ATLAS_0_CAPS ATLAS_CAPS("08000000")
+#define ATLAS_1_CAPS ATLAS_CAPS("08000200")
+
+/* access unit of one TRAIL_R NAL unit (Type=1, TID=0) */
+static const guint8 au_data[] = {0x00, 0x00, 0x00, 0x04,
+                                 0x02, 0x01, 0xaa, 0xbb};
+
+static GstBuffer *make_au(GstClockTime pts) {
+  GstBuffer *buffer = gst_buffer_new_memdup(au_data, sizeof(au_data));
+
+  GST_BUFFER_PTS(buffer) = pts;
+  GST_BUFFER_DTS(buffer) = pts;
+
+  return buffer;
+}
+
+/* the payloader with the atlas of its sink pad in h and the one of request
+ * pad sink_0 in *atlas_h, packets come out of h */
+static GstHarness *new_pay_harness(GstHarness **atlas_h) {
+  GstHarness *h = gst_harness_new("rtpatlaspay");
+
+  g_object_set(h->element, "atlas-id-ext-id", ATLAS_ID_EXT_ID, NULL);
+  gst_harness_set_src_caps_str(h, ATLAS_0_CAPS);
+
+  *atlas_h = gst_harness_new_with_element(h->element, "sink_0", NULL);
+  gst_harness_set_src_caps_str(*atlas_h, ATLAS_1_CAPS);
+
+  return h;
+}
+
+static void check_packet(GstBuffer *packet, guint8 atlas_id) {
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  gpointer data;
+  guint size;
+
+  fail_unless(packet != NULL);
+  fail_unless(gst_rtp_buffer_map(packet, GST_MAP_READ, &rtp));
+  fail_unless(gst_rtp_buffer_get_extension_onebyte_header(
+      &rtp, ATLAS_ID_EXT_ID, 0, &data, &size));
+  fail_unless_equals_int(size, 1);
+  fail_unless_equals_int(((guint8 *)data)[0], atlas_id);
+  fail_unless(gst_rtp_buffer_get_marker(&rtp));
+  fail_unless_equals_int(gst_rtp_buffer_get_payload_len(&rtp),
+                         sizeof(au_data) - 4);
+  fail_unless(memcmp(gst_rtp_buffer_get_payload(&rtp), au_data + 4,
+                     sizeof(au_data) - 4) == 0);
+  gst_rtp_buffer_unmap(&rtp);
+}
+
+/* whether EOS left the payloader, the other events are dropped */
+static gboolean pulled_eos(GstHarness *h) {
+  GstEvent *event;
+  gboolean eos = FALSE;
+
+  while ((event = gst_harness_try_pull_event(h))) {
+    if (GST_EVENT_TYPE(event) == GST_EVENT_EOS)
+      eos = TRUE;
+    gst_event_unref(event);
+  }
+
+  return eos;
+}
+
+GST_START_TEST(test_atlas_id_per_packet) {
+  GstHarness *atlas_h;
+  GstHarness *h = new_pay_harness(&atlas_h);
+  GstBuffer *packet;
+
+  fail_unless_equals_int(gst_harness_push(h, make_au(0)), GST_FLOW_OK);
+  fail_unless_equals_int(gst_harness_push(atlas_h, make_au(0)), GST_FLOW_OK);
+  fail_unless_equals_int(gst_harness_push(h, make_au(GST_MSECOND * 40)),
+                         GST_FLOW_OK);
+
+  /* each packet carries the atlas_id of the pad its NAL unit came from */
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 3);
+  packet = gst_harness_pull(h);
+  check_packet(packet, 0);
+  gst_buffer_unref(packet);
+  packet = gst_harness_pull(h);
+  check_packet(packet, 1);
+  gst_buffer_unref(packet);
+  packet = gst_harness_pull(h);
+  check_packet(packet, 0);
+  gst_buffer_unref(packet);
+
+  gst_harness_teardown(atlas_h);
+  gst_harness_teardown(h);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_eos_after_all_sink_pads) {
+  GstHarness *atlas_h;
+  GstHarness *h = new_pay_harness(&atlas_h);
+
+  fail_unless(gst_harness_push_event(h, gst_event_new_eos()));
+  fail_if(pulled_eos(h));
+
+  /* the request pad still streams after the sink pad is EOS */
+  fail_unless_equals_int(gst_harness_push(atlas_h, make_au(0)), GST_FLOW_OK);
+  fail_unless_equals_int(gst_harness_buffers_in_queue(h), 1);
+  fail_if(pulled_eos(h));
+
+  fail_unless(gst_harness_push_event(atlas_h, gst_event_new_eos()));
+  fail_unless(pulled_eos(h));
+
+  gst_harness_teardown(atlas_h);
+  gst_harness_teardown(h);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_eos_on_release_pad) {
+  GstHarness *atlas_h;
+  GstHarness *h = new_pay_harness(&atlas_h);
+
+  fail_unless(gst_harness_push_event(h, gst_event_new_eos()));
+  fail_if(pulled_eos(h));
+
+  /* releasing sink_0 without EOS leaves no pad to wait for */
+  gst_harness_teardown(atlas_h);
+  fail_unless(pulled_eos(h));
+
+  gst_harness_teardown(h);
+}
+GST_END_TEST;
+
+static Suite *rtpatlaspay_suite(void) {
+  Suite *s = suite_create("rtpatlaspay");
+  TCase *tc_chain = tcase_create("atlases");
+
+  suite_add_tcase(s, tc_chain);
+  tcase_add_test(tc_chain, test_atlas_id_per_packet);
+  tcase_add_test(tc_chain, test_eos_after_all_sink_pads);
+  tcase_add_test(tc_chain, test_eos_on_release_pad);
+
+  return s;
+}
+
+/* GStreamer without registry scan, and the plugin linked in statically */
+int main(int argc, char **argv) {
+  g_setenv("GST_REGISTRY_DISABLE", "yes", TRUE);
+  gst_check_init(&argc, &argv);
+  GST_PLUGIN_STATIC_REGISTER(atlas);
+
+  return gst_check_run_suite(rtpatlaspay_suite(), "rtpatlaspay", __FILE__);
+}
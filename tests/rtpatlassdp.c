@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2023 Nokia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Nokia nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* gst_rtp_atlas_caps_to_fmtp(), gst_rtp_atlas_fmtp_to_caps() and
+ * gst_rtp_atlas_sdp_to_caps(): RTP caps to an a=fmtp line and back, and the
+ * caps of an SDP */
+
+#include <gst/check/gstcheck.h>
+#include "gstrtpatlassdp.h"
+
+#define FMTP                                                                   \
+  "97 v3c-unit-header=CAA=;v3c-unit-type=1;v3c-parameter-set=AAEC;"           \
+  "v3c-tile-id-pres=1;tx-mode=SRST;sprop-max-don-diff=4"
+
+#define SDP                                                                    \
+  "v=0\r\n"                                                                    \
+  "o=- 0 0 IN IP4 127.0.0.1\r\n"                                               \
+  "s=atlas\r\n"                                                                \
+  "t=0 0\r\n"                                                                  \
+  "a=extmap:1 urn:ietf:params:rtp-hdrext:sdes:mid\r\n"                         \
+  "m=audio 5002 RTP/AVP 0\r\n"                                                 \
+  "a=fmtp:0 v3c-unit-type=9\r\n"                                               \
+  "a=extmap:3 urn:example:audio\r\n"                                           \
+  "m=application 5004 RTP/AVP 97\r\n"                                          \
+  "a=rtpmap:97 v3c/90000\r\n"                                                  \
+  "a=fmtp:" FMTP "\r\n"                                                        \
+  "a=extmap:2 urn:example:atlas-id\r\n"
+
+static GstCaps *new_rtp_caps(void) {
+  return gst_caps_new_simple("application/x-rtp", "media", G_TYPE_STRING,
+                             "application", "payload", G_TYPE_INT, 97,
+                             "clock-rate", G_TYPE_INT, 90000, "encoding-name",
+                             G_TYPE_STRING, "v3c", NULL);
+}
+
+GST_START_TEST(test_fmtp_round_trip) {
+  GstCaps *caps = new_rtp_caps();
+  GstStructure *s;
+  gchar *fmtp;
+
+  fail_unless(gst_rtp_atlas_fmtp_to_caps("a=fmtp:" FMTP, caps));
+  s = gst_caps_get_structure(caps, 0);
+  fail_unless_equals_string(gst_structure_get_string(s, "v3c-unit-header"),
+                            "CAA=");
+  fail_unless(gst_structure_has_field_typed(s, "v3c-unit-type", G_TYPE_INT));
+  fail_unless_equals_string(gst_structure_get_string(s, "tx-mode"), "SRST");
+
+  /* written back in the same order */
+  fmtp = gst_rtp_atlas_caps_to_fmtp(caps);
+  fail_unless_equals_string(fmtp, FMTP);
+  g_free(fmtp);
+
+  gst_caps_unref(caps);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_fmtp_follows_caps_changes) {
+  GstCaps *caps = new_rtp_caps();
+  gchar *fmtp;
+
+  fail_unless(gst_rtp_atlas_caps_to_fmtp(caps) == NULL);
+
+  gst_caps_set_simple(caps, "v3c-unit-type", G_TYPE_INT, 1, NULL);
+  fmtp = gst_rtp_atlas_caps_to_fmtp(caps);
+  fail_unless_equals_string(fmtp, "97 v3c-unit-type=1");
+  g_free(fmtp);
+
+  /* caps still writable after a conversion, the line follows them */
+  gst_caps_set_simple(caps, "v3c-unit-type", G_TYPE_INT, 2, "tx-mode",
+                      G_TYPE_STRING, "MRST", NULL);
+  fmtp = gst_rtp_atlas_caps_to_fmtp(caps);
+  fail_unless_equals_string(fmtp, "97 v3c-unit-type=2;tx-mode=MRST");
+  g_free(fmtp);
+
+  gst_caps_unref(caps);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_sdp_to_caps) {
+  GstCaps *caps = gst_rtp_atlas_sdp_to_caps(SDP);
+  GstStructure *s;
+  gchar *fmtp;
+  gint value;
+
+  fail_unless(caps != NULL);
+  s = gst_caps_get_structure(caps, 0);
+  fail_unless(gst_structure_get_int(s, "payload", &value));
+  fail_unless_equals_int(value, 97);
+  fail_unless(gst_structure_get_int(s, "clock-rate", &value));
+  fail_unless_equals_int(value, 90000);
+  fail_unless_equals_string(gst_structure_get_string(s, "encoding-name"),
+                            "v3c");
+
+  /* extmap lines of the session and of the V3C media section only */
+  fail_unless_equals_string(gst_structure_get_string(s, "extmap-1"),
+                            "urn:ietf:params:rtp-hdrext:sdes:mid");
+  fail_unless_equals_string(gst_structure_get_string(s, "extmap-2"),
+                            "urn:example:atlas-id");
+  fail_if(gst_structure_has_field(s, "extmap-3"));
+
+  /* and the a=fmtp line of the V3C payload type back */
+  fmtp = gst_rtp_atlas_caps_to_fmtp(caps);
+  fail_unless_equals_string(fmtp, FMTP);
+  g_free(fmtp);
+
+  gst_caps_unref(caps);
+
+  fail_unless(gst_rtp_atlas_sdp_to_caps("v=0\r\nm=audio 5002 RTP/AVP 0\r\n") ==
+              NULL);
+}
+GST_END_TEST;
+
+static Suite *rtpatlassdp_suite(void) {
+  Suite *s = suite_create("rtpatlassdp");
+  TCase *tc_chain = tcase_create("general");
+
+  suite_add_tcase(s, tc_chain);
+  tcase_add_test(tc_chain, test_fmtp_round_trip);
+  tcase_add_test(tc_chain, test_fmtp_follows_caps_changes);
+  tcase_add_test(tc_chain, test_sdp_to_caps);
+
+  return s;
+}
+
+GST_CHECK_MAIN(rtpatlassdp);